@@ -0,0 +1,647 @@
+/**
+ * Benchmark.cpp
+ * 
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */ 
+
+#include "Benchmark.hpp"
+
+/**
+ * Voxelizes the triangles once for every thread count from 1 to maxThreads and prints the 
+ * time, speedup and parallel efficiency of each run relative to the single threaded one.
+ */
+void benchmarkVoxelizationScaling(unsigned int levels, const BoundingBox& boundingBox, const std::vector<Triangle>& triangles, std::string meshFilePath, const BuildOptions& buildOptions, unsigned int maxThreads)
+{
+   double singleThreadTime = 0.0;
+   BuildOptions options = buildOptions;
+
+   // Always voxelize, reading the cache would not measure anything
+   options.useVoxelCache = false;
+
+   cout << "Voxelization Scaling (" << levels << " levels, " << triangles.size() << " triangles, " << options.getVoxelizationModeName() << ", " << options.getVoxelBuildModeName() << "):" << endl;
+   cout << "Threads\tTime (ms)\tSpeedup\tEfficiency" << endl;
+
+   for (unsigned int numThreads = 1; numThreads <= maxThreads; numThreads++)
+   {
+      tbb::task_scheduler_init init(numThreads);
+
+      auto start = chrono::steady_clock::now();
+      Voxels* voxels = new Voxels(levels, boundingBox, triangles, meshFilePath, options);
+      auto end = chrono::steady_clock::now();
+      double time = chrono::duration <double, milli> (end - start).count();
+      delete voxels->voxelTriangleIndex;
+      delete voxels;
+
+      if (numThreads == 1)
+      {
+         singleThreadTime = time;
+      }
+
+      double speedup = singleThreadTime / time;
+      cout << numThreads << "\t" << time << "\t" << speedup << "\t" << (speedup / numThreads) << endl;
+   }
+   cout << endl;
+}
+
+/**
+ * Builds the SVO of the triangles once, then reduces it into the DAG once for every thread 
+ * count from 1 to maxThreads and prints the time, speedup and parallel efficiency of each 
+ * reduction relative to the single threaded one.
+ */
+void benchmarkDAGScaling(unsigned int levels, const BoundingBox& boundingBox, const std::vector<Triangle>& triangles, std::string meshFilePath, const BuildOptions& options, unsigned int maxThreads)
+{
+   std::vector<double> times;
+   uint64_t numNodes = 0;
+   SparseVoxelOctree* svo = new SparseVoxelOctree(levels, boundingBox, triangles, meshFilePath, options);
+
+   for (unsigned int numThreads = 1; numThreads <= maxThreads; numThreads++)
+   {
+      tbb::task_scheduler_init init(numThreads);
+
+      auto start = chrono::steady_clock::now();
+      DAG* dag = new DAG(levels, svo, options);
+      auto end = chrono::steady_clock::now();
+      times.push_back(chrono::duration <double, milli> (end - start).count());
+
+      numNodes = 0;
+      for (unsigned int i = 0; i < levels-1; i++)
+      {
+         numNodes += dag->sizeAtLevel[i];
+      }
+      delete dag;
+   }
+   delete svo;
+
+   // The reductions print their own progress, so the table comes after all of them
+   cout << endl << "DAG Reduction Scaling (" << levels << " levels, " << triangles.size() << " triangles, " << numNodes << " unique nodes):" << endl;
+   cout << "Threads\tTime (ms)\tSpeedup\tEfficiency" << endl;
+   for (unsigned int numThreads = 1; numThreads <= maxThreads; numThreads++)
+   {
+      double speedup = times[0] / times[numThreads-1];
+      cout << numThreads << "\t" << times[numThreads-1] << "\t" << speedup << "\t" << (speedup / numThreads) << endl;
+   }
+   cout << endl;
+}
+
+/**
+ * Times encoding and decoding MORTON_BENCHMARK_SIZE random coordinates with the bit by bit 
+ * loops and with the constant time mortonCode / mortonCodeToXYZ, checking that both agree.
+ */
+void benchmarkMortonCodes(unsigned int levels)
+{
+   unsigned int dimension = 1 << levels;
+   std::vector<unsigned int> coordinates(3 * MORTON_BENCHMARK_SIZE);
+   std::vector<uint64_t> loopCodes(MORTON_BENCHMARK_SIZE);
+   std::vector<uint64_t> codes(MORTON_BENCHMARK_SIZE);
+   uint64_t random = 88172645463325252ULL;
+   unsigned int x, y, z;
+   uint64_t sum = 0;
+   unsigned int mismatches = 0;
+
+   if (levels > MORTON_MAX_LEVEL)
+   {
+      cerr << "Morton codes only support up to " << MORTON_MAX_LEVEL << " levels" << endl;
+      return;
+   }
+
+   // xorshift64 so every run uses the same coordinates
+   for (unsigned int i = 0; i < coordinates.size(); i++)
+   {
+      random ^= random << 13;
+      random ^= random >> 7;
+      random ^= random << 17;
+      coordinates[i] = random % dimension;
+   }
+
+#if defined(__BMI2__)
+   cout << "Morton Codes (" << levels << " levels, pdep/pext):" << endl;
+#else
+   cout << "Morton Codes (" << levels << " levels, magic bits):" << endl;
+#endif
+   cout << "Function\tLoop (ns)\tConstant (ns)\tSpeedup" << endl;
+
+   auto start = chrono::steady_clock::now();
+   for (unsigned int i = 0; i < MORTON_BENCHMARK_SIZE; i++)
+   {
+      loopCodes[i] = mortonCodeLoop(coordinates[3*i], coordinates[3*i+1], coordinates[3*i+2], levels);
+   }
+   auto end = chrono::steady_clock::now();
+   double loopTime = chrono::duration <double, nano> (end - start).count() / MORTON_BENCHMARK_SIZE;
+
+   start = chrono::steady_clock::now();
+   for (unsigned int i = 0; i < MORTON_BENCHMARK_SIZE; i++)
+   {
+      codes[i] = mortonCode(coordinates[3*i], coordinates[3*i+1], coordinates[3*i+2], levels);
+   }
+   end = chrono::steady_clock::now();
+   double time = chrono::duration <double, nano> (end - start).count() / MORTON_BENCHMARK_SIZE;
+   cout << "mortonCode\t" << loopTime << "\t" << time << "\t" << (loopTime / time) << endl;
+
+   for (unsigned int i = 0; i < MORTON_BENCHMARK_SIZE; i++)
+   {
+      mismatches += (loopCodes[i] != codes[i]);
+   }
+
+   start = chrono::steady_clock::now();
+   for (unsigned int i = 0; i < MORTON_BENCHMARK_SIZE; i++)
+   {
+      mortonCodeToXYZLoop(codes[i], &x, &y, &z, levels);
+      sum += x + y + z;
+   }
+   end = chrono::steady_clock::now();
+   loopTime = chrono::duration <double, nano> (end - start).count() / MORTON_BENCHMARK_SIZE;
+
+   start = chrono::steady_clock::now();
+   for (unsigned int i = 0; i < MORTON_BENCHMARK_SIZE; i++)
+   {
+      mortonCodeToXYZ(codes[i], &x, &y, &z, levels);
+      sum -= x + y + z;
+      mismatches += (x != coordinates[3*i] || y != coordinates[3*i+1] || z != coordinates[3*i+2]);
+   }
+   end = chrono::steady_clock::now();
+   time = chrono::duration <double, nano> (end - start).count() / MORTON_BENCHMARK_SIZE;
+   cout << "mortonCodeToXYZ\t" << loopTime << "\t" << time << "\t" << (loopTime / time) << endl;
+
+   // sum is 0 when both decoders agree, printing it also keeps the loops from being optimized out
+   cout << "Mismatches: " << mismatches << " (checksum " << sum << ")" << endl << endl;
+}
+
+/**
+ * Picks numVoxels filled voxels of the DAG by random walks from the root through set children 
+ * and puts their coordinates in coordinates. The node and the child index of every step of the 
+ * walks go in stepNodes and stepIndexes, as stored: below a mirrored child the index in the 
+ * volume is the mirrored one.
+ */
+void pickFilledVoxels(DAG* dag, unsigned int numVoxels, std::vector<unsigned int>& coordinates, std::vector<void*>& stepNodes, std::vector<unsigned char>& stepIndexes)
+{
+   unsigned int levels = dag->numLevels;
+   uint64_t random = 88172645463325252ULL;
+
+   coordinates.resize(3 * (uint64_t)numVoxels);
+   stepNodes.reserve((uint64_t)numVoxels * (levels-2));
+   stepIndexes.reserve((uint64_t)numVoxels * (levels-2));
+
+   // xorshift64 so every run walks the same way
+   for (unsigned int i = 0; i < numVoxels; i++)
+   {
+      void* node = dag->levels[0];
+      uint64_t mortonIndex = 0;
+      unsigned int mirror = 0;
+
+      for (unsigned int level = 0; level < levels-2; level++)
+      {
+         random ^= random << 13;
+         random ^= random >> 7;
+         random ^= random << 17;
+
+         uint32_t mask = *((uint32_t*)node) & SET_8_BITS;
+         unsigned int skip = random % countSetBits(mask);
+         for (unsigned int j = 0; j < skip; j++)
+         {
+            mask &= mask - 1;
+         }
+         unsigned int index = __builtin_ctzll(mask);
+
+         stepNodes.push_back(node);
+         stepIndexes.push_back(index);
+         mortonIndex = (mortonIndex << 3) | (index ^ mirror);
+         node = dag->getChildPointer(node, index, level, mirror);
+      }
+
+      random ^= random << 13;
+      random ^= random >> 7;
+      random ^= random << 17;
+
+      uint64_t leaf = *((uint64_t*)node);
+      unsigned int skip = random % countSetBits(leaf);
+      for (unsigned int j = 0; j < skip; j++)
+      {
+         leaf &= leaf - 1;
+      }
+      mortonIndex = (mortonIndex << 6) | (__builtin_ctzll(leaf) ^ getLeafIndexMirror(mirror));
+      mortonCodeToXYZ(mortonIndex, &coordinates[3*i], &coordinates[3*i+1], &coordinates[3*i+2], levels);
+   }
+}
+
+/**
+ * Times looking up filled voxels in the DAG. The voxels are picked by pickFilledVoxels and 
+ * looked up with isSet, then with getMoxelIndex. The steps of the walks are also timed on 
+ * their own: following the child taken with getChildPointer, next to getChildPointerLoop 
+ * which counts the lower children bit by bit, and decoding the filled prefix of that child.
+ */
+void benchmarkMoxelIndex(DAG* dag)
+{
+   unsigned int levels = dag->numLevels;
+   std::vector<unsigned int> coordinates;
+   std::vector<void*> stepNodes;
+   std::vector<unsigned char> stepIndexes;
+   uint64_t sum = 0;
+   unsigned int numErrors = 0;
+
+   pickFilledVoxels(dag, MOXEL_BENCHMARK_SIZE, coordinates, stepNodes, stepIndexes);
+
+   cout << "DAG Lookups (" << levels << " levels, " << MOXEL_BENCHMARK_SIZE << " voxels):" << endl;
+
+   auto start = chrono::steady_clock::now();
+   for (unsigned int i = 0; i < MOXEL_BENCHMARK_SIZE; i++)
+   {
+      numErrors += !dag->isSet(coordinates[3*i], coordinates[3*i+1], coordinates[3*i+2]);
+   }
+   auto end = chrono::steady_clock::now();
+   double isSetTime = chrono::duration <double, nano> (end - start).count() / MOXEL_BENCHMARK_SIZE;
+
+   start = chrono::steady_clock::now();
+   for (unsigned int i = 0; i < MOXEL_BENCHMARK_SIZE; i++)
+   {
+      uint64_t moxelIndex;
+      numErrors += !dag->getMoxelIndex(coordinates[3*i], coordinates[3*i+1], coordinates[3*i+2], moxelIndex);
+      numErrors += moxelIndex >= dag->numFilledVoxels;
+      sum += moxelIndex;
+   }
+   end = chrono::steady_clock::now();
+   double moxelTime = chrono::duration <double, nano> (end - start).count() / MOXEL_BENCHMARK_SIZE;
+
+   start = chrono::steady_clock::now();
+   for (uint64_t i = 0; i < stepNodes.size(); i++)
+   {
+      sum += (uint64_t)dag->getChildPointerLoop(stepNodes[i], stepIndexes[i], i % (levels-2));
+   }
+   end = chrono::steady_clock::now();
+   double childLoopTime = chrono::duration <double, nano> (end - start).count() / stepNodes.size();
+
+   start = chrono::steady_clock::now();
+   for (uint64_t i = 0; i < stepNodes.size(); i++)
+   {
+      sum -= (uint64_t)dag->getChildPointer(stepNodes[i], stepIndexes[i], i % (levels-2));
+   }
+   end = chrono::steady_clock::now();
+   double childTime = chrono::duration <double, nano> (end - start).count() / stepNodes.size();
+
+   start = chrono::steady_clock::now();
+   for (uint64_t i = 0; i < stepNodes.size(); i++)
+   {
+      sum += dag->getFilledPrefix(stepNodes[i], i % (levels-2), stepIndexes[i]);
+   }
+   end = chrono::steady_clock::now();
+   double prefixTime = chrono::duration <double, nano> (end - start).count() / stepNodes.size();
+
+   cout << "Lookup\tTotal (ns)\tPer level (ns)" << endl;
+   cout << "isSet\t" << isSetTime << "\t" << (isSetTime / (levels-1)) << endl;
+   cout << "getMoxelIndex\t" << moxelTime << "\t" << (moxelTime / (levels-1)) << endl;
+   cout << "Step\tLoop (ns)\tPopcount (ns)\tSpeedup" << endl;
+   cout << "getChildPointer\t" << childLoopTime << "\t" << childTime << "\t" << (childLoopTime / childTime) << endl;
+   cout << "Step\tPer step (ns)" << endl;
+   cout << "getFilledPrefix\t" << prefixTime << endl;
+
+   // The child pointers cancel out of the sum when both slot lookups agree, printing it also 
+   // keeps the loops from being optimized out
+   cout << "Errors: " << numErrors << " (checksum " << sum << ")" << endl << endl;
+}
+
+/**
+ * Reduces the SVO of the triangles once sharing only equal nodes and once also sharing mirror 
+ * images, and prints the unique nodes, memory and build time of both next to the time to look 
+ * up MOXEL_BENCHMARK_SIZE filled voxels with isSet and getMoxelIndex. Both DAGs must give the 
+ * same answers for those voxels and for as many random, mostly empty, ones. Returns true if 
+ * they did.
+ */
+bool benchmarkMirrorReduction(unsigned int levels, const BoundingBox& boundingBox, const std::vector<Triangle>& triangles, std::string meshFilePath, const BuildOptions& options)
+{
+   SparseVoxelOctree* svo = new SparseVoxelOctree(levels, boundingBox, triangles, meshFilePath, options);
+   DAGReductionMode modes[2] = {DAG_REDUCE_EXACT, DAG_REDUCE_MIRROR};
+   DAG* dags[2];
+   double buildTimes[2];
+
+   for (unsigned int m = 0; m < 2; m++)
+   {
+      BuildOptions modeOptions = options;
+      modeOptions.dagReductionMode = modes[m];
+      auto start = chrono::steady_clock::now();
+      dags[m] = new DAG(levels, svo, modeOptions);
+      auto end = chrono::steady_clock::now();
+      buildTimes[m] = chrono::duration <double, milli> (end - start).count();
+   }
+
+   // Filled voxels, then random ones
+   std::vector<unsigned int> coordinates;
+   std::vector<void*> stepNodes;
+   std::vector<unsigned char> stepIndexes;
+   pickFilledVoxels(dags[0], MOXEL_BENCHMARK_SIZE, coordinates, stepNodes, stepIndexes);
+   uint64_t random = 88172645463325252ULL;
+   unsigned int dimension = dags[0]->dimension;
+   for (unsigned int i = 0; i < 3 * MOXEL_BENCHMARK_SIZE; i++)
+   {
+      random ^= random << 13;
+      random ^= random >> 7;
+      random ^= random << 17;
+      coordinates.push_back(random % dimension);
+   }
+
+   uint64_t numMismatches = 0;
+   for (unsigned int i = 0; i < 2 * MOXEL_BENCHMARK_SIZE; i++)
+   {
+      unsigned int x = coordinates[3*i];
+      unsigned int y = coordinates[3*i+1];
+      unsigned int z = coordinates[3*i+2];
+      uint64_t exactIndex = 0;
+      uint64_t mirrorIndex = 0;
+      bool isExactSet = dags[0]->getMoxelIndex(x, y, z, exactIndex);
+      bool isMirrorSet = dags[1]->getMoxelIndex(x, y, z, mirrorIndex);
+      numMismatches += dags[0]->isSet(x, y, z) != dags[1]->isSet(x, y, z) 
+       || isExactSet != isMirrorSet || (isExactSet && exactIndex != mirrorIndex);
+   }
+
+   cout << endl << "DAG Mirror Reduction (" << levels << " levels, " << triangles.size() << " triangles, " << MOXEL_BENCHMARK_SIZE << " lookups):" << endl;
+   cout << "Reduction\tUnique Nodes\tMoxel DAG (bytes)\tRegular DAG (bytes)\tBuild (ms)\tisSet (ns)\tgetMoxelIndex (ns)" << endl;
+   for (unsigned int m = 0; m < 2; m++)
+   {
+      DAG* dag = dags[m];
+      uint64_t numNodes = 0;
+      uint64_t moxelDAGMemory = 0;
+      uint64_t dagMemory = 0;
+      uint64_t sum = 0;
+      for (unsigned int i = 0; i < levels-1; i++)
+      {
+         numNodes += dag->sizeAtLevel[i];
+         moxelDAGMemory += dag->dagMemoryAlocated[i];
+         dagMemory += dag->prevDagMemoryAlocated[i];
+      }
+
+      auto start = chrono::steady_clock::now();
+      for (unsigned int i = 0; i < MOXEL_BENCHMARK_SIZE; i++)
+      {
+         sum += dag->isSet(coordinates[3*i], coordinates[3*i+1], coordinates[3*i+2]);
+      }
+      auto end = chrono::steady_clock::now();
+      double isSetTime = chrono::duration <double, nano> (end - start).count() / MOXEL_BENCHMARK_SIZE;
+
+      start = chrono::steady_clock::now();
+      for (unsigned int i = 0; i < MOXEL_BENCHMARK_SIZE; i++)
+      {
+         uint64_t moxelIndex;
+         dag->getMoxelIndex(coordinates[3*i], coordinates[3*i+1], coordinates[3*i+2], moxelIndex);
+         sum += moxelIndex;
+      }
+      end = chrono::steady_clock::now();
+      double moxelTime = chrono::duration <double, nano> (end - start).count() / MOXEL_BENCHMARK_SIZE;
+
+      // Printing the sum keeps the loops from being optimized out
+      cout << (m == 0 ? "exact" : "mirror") << "\t" << numNodes << "\t" << moxelDAGMemory << "\t" << dagMemory << "\t" 
+       << buildTimes[m] << "\t" << isSetTime << "\t" << moxelTime << "\t(checksum " << sum << ")" << endl;
+      delete dag;
+   }
+   delete svo;
+   cout << "Mismatches: " << numMismatches << endl << endl;
+   return numMismatches == 0;
+}
+
+/**
+ * Builds the DAG and checks it against the voxel triangle index, which holds exactly one pair 
+ * per filled voxel in Morton order: the filled voxel counts must agree, and for a sample of the 
+ * pairs the voxel must be set in the DAG, map to the moxel at the pair's position and be 
+ * followed by an empty voxel when the next pair isn't adjacent. Solid voxels only have to 
+ * contain the surface, which comes no earlier in the moxel table. From 11 levels on the Morton 
+ * codes, and so every count and offset derived from them, no longer fit in 32 bits. Returns 
+ * true if no errors were found.
+ */
+bool verifyDAG(unsigned int levels, const BoundingBox& boundingBox, const std::vector<Triangle>& triangles, std::string meshFilePath, const std::vector<PhongMaterial>& materials, const BuildOptions& options)
+{
+   DAG dag(levels, boundingBox, triangles, meshFilePath, materials, options);
+   const VoxelTrianglePair* pairs = dag.voxelTriangleIndex->pairs;
+   uint64_t numPairs = dag.voxelTriangleIndex->numPairs;
+   uint64_t step = std::max(numPairs / VERIFY_MAX_SAMPLES, (uint64_t)1);
+   uint64_t numChecked = 0;
+   uint64_t numAbove32Bits = 0;
+   uint64_t numErrors = 0;
+   unsigned int x, y, z;
+
+   cout << "Verify (" << levels << " levels, " << dag.size << " voxels):" << endl;
+   if (levels < 11)
+   {
+      cout << "Warning: " << levels << " levels do not cross 2^32 voxels, use 11 or more" << endl;
+   }
+
+   // Solid voxels also fill the inside, which no triangle filled
+   if (options.solid ? (dag.numFilledVoxels < numPairs) : (dag.numFilledVoxels != numPairs))
+   {
+      cerr << "Filled voxels in the DAG (" << dag.numFilledVoxels << ") != voxel triangle pairs (" << numPairs << ")" << endl;
+      numErrors++;
+   }
+
+   for (uint64_t i = 0; i < numPairs; i += step)
+   {
+      // Always check the last pair, it has the largest Morton code
+      uint64_t k = (i + step >= numPairs) ? numPairs - 1 : i;
+      uint64_t moxelIndex;
+
+      mortonCodeToXYZ(pairs[k].mortonIndex, &x, &y, &z, levels);
+      if (!dag.getMoxelIndex(x, y, z, moxelIndex) || (options.solid ? (moxelIndex < k) : (moxelIndex != k)))
+      {
+         cerr << "Voxel " << pairs[k].mortonIndex << " (" << x << ", " << y << ", " << z << ") is not set or has moxel " << moxelIndex << " instead of " << k << endl;
+         numErrors++;
+      }
+
+      uint64_t next = pairs[k].mortonIndex + 1;
+      if (!options.solid && next < dag.size && (k + 1 == numPairs || pairs[k+1].mortonIndex != next))
+      {
+         mortonCodeToXYZ(next, &x, &y, &z, levels);
+         if (dag.isSet(x, y, z))
+         {
+            cerr << "Voxel " << next << " (" << x << ", " << y << ", " << z << ") is set but was never filled" << endl;
+            numErrors++;
+         }
+      }
+
+      numChecked++;
+      numAbove32Bits += (pairs[k].mortonIndex >> 32) != 0;
+   }
+
+   cout << "Filled voxels: " << dag.numFilledVoxels << endl;
+   cout << "Checked: " << numChecked << " (" << numAbove32Bits << " with Morton codes >= 2^32)" << endl;
+   cout << "Errors: " << numErrors << endl << endl;
+   return numErrors == 0;
+}
+
+/**
+ * Renders a saved DAG in numWorkers processes at once, each loading the file on its own like 
+ * separate render workers on one host, and prints the memory of every worker once all of them 
+ * are done rendering. The DAG and moxel table are mapped shared, so they are counted in each 
+ * worker's RSS but split between the workers in the proportional set size (PSS): the total PSS 
+ * should only grow by the private memory of a worker (the image, the stacks) per extra worker. 
+ * That is checked on the mappings of the DAG file: their PSS summed over the workers must stay 
+ * within SHARED_WORKERS_MAX_PSS_RATIO of the largest RSS of them in one worker, which it would 
+ * be numWorkers times if every worker had its own copy. The renders are only kept in memory, 
+ * not written out. Forks before any threads are started. Returns true if every worker 
+ * succeeded and the DAG was shared.
+ */
+bool benchmarkSharedWorkers(std::string dagFilePath, const BuildOptions& options, unsigned int numWorkers, unsigned int numThreads, unsigned int imageWidth, unsigned int imageHeight)
+{
+   int readyPipe[2];
+   int releasePipe[2];
+   std::vector<pid_t> workers;
+
+   if (pipe(readyPipe) != 0 || pipe(releasePipe) != 0)
+   {
+      cerr << "Could not create the pipes for the workers" << endl;
+      return false;
+   }
+
+   for (unsigned int i = 0; i < numWorkers; i++)
+   {
+      pid_t pid = fork();
+      if (pid < 0)
+      {
+         cerr << "Could not start worker " << i << endl;
+         break;
+      }
+      if (pid == 0)
+      {
+         close(readyPipe[0]);
+         close(releasePipe[1]);
+         int status = 0;
+         DAG* dag = NULL;
+         try
+         {
+            tbb::task_scheduler_init init(numThreads);
+            dag = new DAG(dagFilePath, options);
+            Raytracer raytracer(imageWidth, imageHeight, dag);
+            raytracer.trace();
+         }
+         catch (const std::exception&)
+         {
+            status = 1;
+         }
+         cout.flush();
+
+         // Stay mapped until the parent has measured every worker
+         char ready = 'r';
+         char release;
+         if (write(readyPipe[1], &ready, 1) != 1)
+         {
+            status = 1;
+         }
+         close(readyPipe[1]);
+         while (read(releasePipe[0], &release, 1) > 0);
+         delete dag;
+         _exit(status);
+      }
+      workers.push_back(pid);
+   }
+
+   // Every worker closes its end once it is done, so this also returns if one dies
+   close(readyPipe[1]);
+   close(releasePipe[0]);
+   char ready;
+   unsigned int numReady = 0;
+   while (numReady < workers.size() && read(readyPipe[0], &ready, 1) == 1)
+   {
+      numReady++;
+   }
+
+   // smaps names the mapped file by its absolute path
+   char mappedFilePath[PATH_MAX];
+   if (realpath(dagFilePath.c_str(), mappedFilePath) == NULL)
+   {
+      mappedFilePath[0] = '\0';
+   }
+
+   uint64_t totalRSS = 0;
+   uint64_t totalPSS = 0;
+   uint64_t maxRSS = 0;
+   uint64_t maxDAGRSS = 0;
+   uint64_t totalDAGPSS = 0;
+   cout << endl << "Shared DAG Workers (" << dagFilePath << ", " << workers.size() << " workers):" << endl;
+   cout << "Worker\tRSS (kB)\tAnon (kB)\tFile (kB)\tPSS (kB)\tFile Huge Pages (kB)\tDAG RSS (kB)\tDAG PSS (kB)" << endl;
+   for (unsigned int i = 0; i < workers.size(); i++)
+   {
+      std::string procPath = "/proc/" + to_string(workers[i]);
+      uint64_t rss = readMemoryField(procPath + "/status", "VmRSS");
+      uint64_t pss = readMemoryField(procPath + "/smaps_rollup", "Pss");
+      uint64_t dagRSS;
+      uint64_t dagPSS;
+      readMappedFileMemory(procPath + "/smaps", mappedFilePath, dagRSS, dagPSS);
+      totalRSS += rss;
+      totalPSS += pss;
+      maxRSS = std::max(maxRSS, rss);
+      maxDAGRSS = std::max(maxDAGRSS, dagRSS);
+      totalDAGPSS += dagPSS;
+      cout << i << "\t" << rss << "\t" << readMemoryField(procPath + "/status", "RssAnon") << "\t" 
+       << readMemoryField(procPath + "/status", "RssFile") << "\t" << pss << "\t" 
+       << readMemoryField(procPath + "/smaps_rollup", "FilePmdMapped") << "\t" << dagRSS << "\t" << dagPSS << endl;
+   }
+   cout << "Total RSS: " << totalRSS << " kB, Total PSS: " << totalPSS << " kB" << endl;
+   if (workers.size() > 1)
+   {
+      cout << "PSS per extra worker: " << ((int64_t)(totalPSS - maxRSS) / (int64_t)(workers.size() - 1)) << " kB" << endl;
+   }
+
+   // Without sharing the DAG's PSS adds up to one copy per worker
+   bool isShared = maxDAGRSS > 0 && totalDAGPSS <= SHARED_WORKERS_MAX_PSS_RATIO * maxDAGRSS;
+   cout << "DAG file PSS: " << totalDAGPSS << " kB of " << maxDAGRSS << " kB mapped in one worker (at most " 
+    << SHARED_WORKERS_MAX_PSS_RATIO << "x): " << (isShared ? "shared" : "NOT SHARED") << endl << endl;
+
+   close(releasePipe[1]);
+   bool isSuccessful = workers.size() == numWorkers && numReady == numWorkers && isShared;
+   for (unsigned int i = 0; i < workers.size(); i++)
+   {
+      int status;
+      isSuccessful = waitpid(workers[i], &status, 0) == workers[i] && WIFEXITED(status) && WEXITSTATUS(status) == 0 && isSuccessful;
+   }
+   close(readyPipe[0]);
+   return isSuccessful;
+}
+
+/**
+ * Sums the Rss and Pss, in kB, of the mappings of mappedFilePath listed in a /proc/<pid>/smaps 
+ * file.
+ */
+void readMappedFileMemory(std::string smapsPath, std::string mappedFilePath, uint64_t& rss, uint64_t& pss)
+{
+   std::ifstream file(smapsPath.c_str());
+   std::string line;
+   bool isMappedFile = false;
+
+   rss = 0;
+   pss = 0;
+   while (std::getline(file, line))
+   {
+      std::istringstream fields(line);
+      std::string name;
+      fields >> name;
+      if (name.empty() || name[name.size()-1] != ':')
+      {
+         // A mapping: address range, permissions, offset, device, inode and the path if any
+         std::string permissions, offset, device, inode, path;
+         fields >> permissions >> offset >> device >> inode >> path;
+         isMappedFile = !mappedFilePath.empty() && path == mappedFilePath;
+      }
+      else if (isMappedFile && name == "Rss:")
+      {
+         rss += strtoull(line.c_str() + name.size(), NULL, 10);
+      }
+      else if (isMappedFile && name == "Pss:")
+      {
+         pss += strtoull(line.c_str() + name.size(), NULL, 10);
+      }
+   }
+}
+
+/**
+ * Returns the kB given for field in a /proc memory file like /proc/self/status, 0 if it is 
+ * missing (smaps_rollup needs Linux 4.14).
+ */
+uint64_t readMemoryField(std::string filePath, std::string field)
+{
+   std::ifstream file(filePath.c_str());
+   std::string line;
+   std::string prefix = field + ":";
+
+   while (std::getline(file, line))
+   {
+      if (line.compare(0, prefix.size(), prefix) == 0)
+      {
+         return strtoull(line.c_str() + prefix.size(), NULL, 10);
+      }
+   }
+   return 0;
+}
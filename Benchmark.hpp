@@ -0,0 +1,47 @@
+/**
+ * Benchmark.hpp
+ * 
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */ 
+
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "tbb/task_scheduler_init.h"
+
+#include "BoundingBox.hpp"
+#include "Triangle.hpp"
+#include "Voxels.hpp"
+#include "BuildOptions.hpp"
+#include "MortonCode.hpp"
+#include "DAG.hpp"
+#include "Raytracer.hpp"
+
+#define MORTON_BENCHMARK_SIZE (1 << 22)
+#define VERIFY_MAX_SAMPLES (1 << 20) // Filled voxels checked by verifyDAG
+#define MOXEL_BENCHMARK_SIZE (1 << 20) // Filled voxels looked up by benchmarkMoxelIndex
+#define SHARED_WORKERS_MAX_PSS_RATIO 1.25 // Most the workers' PSS of the DAG file may be of the largest RSS of it in one worker
+
+void benchmarkVoxelizationScaling(unsigned int levels, const BoundingBox& boundingBox, const std::vector<Triangle>& triangles, std::string meshFilePath, const BuildOptions& options, unsigned int maxThreads);
+void benchmarkDAGScaling(unsigned int levels, const BoundingBox& boundingBox, const std::vector<Triangle>& triangles, std::string meshFilePath, const BuildOptions& options, unsigned int maxThreads);
+void benchmarkMortonCodes(unsigned int levels);
+void pickFilledVoxels(DAG* dag, unsigned int numVoxels, std::vector<unsigned int>& coordinates, std::vector<void*>& stepNodes, std::vector<unsigned char>& stepIndexes);
+void benchmarkMoxelIndex(DAG* dag);
+bool benchmarkMirrorReduction(unsigned int levels, const BoundingBox& boundingBox, const std::vector<Triangle>& triangles, std::string meshFilePath, const BuildOptions& options);
+bool benchmarkSharedWorkers(std::string dagFilePath, const BuildOptions& options, unsigned int numWorkers, unsigned int numThreads, unsigned int imageWidth, unsigned int imageHeight);
+uint64_t readMemoryField(std::string filePath, std::string field);
+void readMappedFileMemory(std::string smapsPath, std::string mappedFilePath, uint64_t& rss, uint64_t& pss);
+bool verifyDAG(unsigned int levels, const BoundingBox& boundingBox, const std::vector<Triangle>& triangles, std::string meshFilePath, const std::vector<PhongMaterial>& materials, const BuildOptions& options);
+
+#endif
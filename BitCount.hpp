@@ -0,0 +1,44 @@
+/**
+ * BitCount.hpp
+ *
+ * Counting set bits, used for finding a child from a node's mask: the children that are set
+ * are stored next to each other, so child i is after the set children below it. Uses the
+ * popcnt instruction when the target has it, the bit parallel count otherwise.
+ *
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */
+
+#ifndef BIT_COUNT_HPP
+#define BIT_COUNT_HPP
+
+#include <stdint.h>
+
+#if defined(__POPCNT__)
+#include <nmmintrin.h>
+#endif
+
+/**
+ * Returns the number of set bits in an unsigned 64-bit int
+ */
+inline unsigned int countSetBits(uint64_t data)
+{
+#if defined(__POPCNT__)
+   return (unsigned int)_mm_popcnt_u64(data);
+#else
+   data = data - ((data >> 1) & 0x5555555555555555ULL);
+   data = (data & 0x3333333333333333ULL) + ((data >> 2) & 0x3333333333333333ULL);
+   data = (data + (data >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+   return (unsigned int)((data * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/**
+ * Returns the number of set bits below bit index, which is less than 64. For a child mask
+ * that is the slot of child index among the children that are set.
+ */
+inline unsigned int countSetBitsBelow(uint64_t data, unsigned int index)
+{
+   return countSetBits(data & (((uint64_t)1 << index) - 1));
+}
+
+#endif
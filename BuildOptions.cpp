@@ -0,0 +1,269 @@
+/**
+ * BuildOptions.cpp
+ * 
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */ 
+
+#include "BuildOptions.hpp"
+
+BuildOptions::BuildOptions()
+ : voxelizationMode(VOXELIZE_BRUTE_FORCE),
+   voxelBuildMode(BUILD_CHUNKED),
+   triangleSchedule(SCHEDULE_MORTON),
+   dagBuildMode(DAG_BUILD_REDUCE),
+   dagReductionMode(DAG_REDUCE_EXACT),
+   useVoxelCache(false),
+   solid(false),
+   memoryBudget((uint64_t)DEFAULT_MEMORY_BUDGET_MB * 1024 * 1024)
+{
+}
+
+/**
+ * Tries to parse the command line argument at index i. If the argument takes a value, i is 
+ * moved past it. Returns whether the argument was a build option.
+ */
+bool BuildOptions::parseArgument(int argc, char const *argv[], int& i)
+{
+   if (strcmp(argv[i], "-voxelizer") == 0 && i+1 < argc)
+   {
+      i++;
+      if (strcmp(argv[i], "bruteforce") == 0)
+      {
+         voxelizationMode = VOXELIZE_BRUTE_FORCE;
+      }
+      else if (strcmp(argv[i], "scanline") == 0)
+      {
+         voxelizationMode = VOXELIZE_SCANLINE;
+      }
+      else
+      {
+         std::cerr << "Unknown voxelizer: " << argv[i] << " (expected bruteforce or scanline)" << std::endl;
+         exit(1);
+      }
+      return true;
+   }
+   else if (strcmp(argv[i], "-build") == 0 && i+1 < argc)
+   {
+      i++;
+      if (strcmp(argv[i], "chunked") == 0)
+      {
+         voxelBuildMode = BUILD_CHUNKED;
+      }
+      else if (strcmp(argv[i], "topdown") == 0)
+      {
+         voxelBuildMode = BUILD_TOP_DOWN;
+      }
+      else
+      {
+         std::cerr << "Unknown build mode: " << argv[i] << " (expected chunked or topdown)" << std::endl;
+         exit(1);
+      }
+      return true;
+   }
+   else if (strcmp(argv[i], "-schedule") == 0 && i+1 < argc)
+   {
+      i++;
+      if (strcmp(argv[i], "fileorder") == 0)
+      {
+         triangleSchedule = SCHEDULE_FILE_ORDER;
+      }
+      else if (strcmp(argv[i], "morton") == 0)
+      {
+         triangleSchedule = SCHEDULE_MORTON;
+      }
+      else
+      {
+         std::cerr << "Unknown schedule: " << argv[i] << " (expected fileorder or morton)" << std::endl;
+         exit(1);
+      }
+      return true;
+   }
+   else if (strcmp(argv[i], "-dagbuild") == 0 && i+1 < argc)
+   {
+      i++;
+      if (strcmp(argv[i], "reduce") == 0)
+      {
+         dagBuildMode = DAG_BUILD_REDUCE;
+      }
+      else if (strcmp(argv[i], "stream") == 0)
+      {
+         dagBuildMode = DAG_BUILD_STREAM;
+      }
+      else
+      {
+         std::cerr << "Unknown DAG build mode: " << argv[i] << " (expected reduce or stream)" << std::endl;
+         exit(1);
+      }
+      return true;
+   }
+   else if (strcmp(argv[i], "-reduction") == 0 && i+1 < argc)
+   {
+      i++;
+      if (strcmp(argv[i], "exact") == 0)
+      {
+         dagReductionMode = DAG_REDUCE_EXACT;
+      }
+      else if (strcmp(argv[i], "mirror") == 0)
+      {
+         dagReductionMode = DAG_REDUCE_MIRROR;
+      }
+      else
+      {
+         std::cerr << "Unknown DAG reduction mode: " << argv[i] << " (expected exact or mirror)" << std::endl;
+         exit(1);
+      }
+      return true;
+   }
+   else if (strcmp(argv[i], "-voxelcache") == 0)
+   {
+      useVoxelCache = true;
+      return true;
+   }
+   else if (strcmp(argv[i], "-solid") == 0)
+   {
+      solid = true;
+      return true;
+   }
+   else if (strcmp(argv[i], "-memory") == 0 && i+1 < argc)
+   {
+      memoryBudget = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+      return true;
+   }
+   else if (strcmp(argv[i], "-lossy") == 0 && i+1 < argc)
+   {
+      // A comma separated list of budgets, the first for the leafs
+      const char* budget = argv[++i];
+      char* end;
+      lossyBudgets.clear();
+      while (true)
+      {
+         lossyBudgets.push_back((unsigned int)strtoul(budget, &end, 10));
+         if (end == budget || (*end != ',' && *end != '\0'))
+         {
+            std::cerr << "Bad lossy budgets: " << argv[i] << " (expected voxel counts like 4 or 4,2,0)" << std::endl;
+            exit(1);
+         }
+         if (*end == '\0')
+         {
+            break;
+         }
+         budget = end + 1;
+      }
+      return true;
+   }
+
+   return false;
+}
+
+std::string BuildOptions::getVoxelizationModeName() const
+{
+   switch (voxelizationMode)
+   {
+      case VOXELIZE_SCANLINE:
+         return "scanline";
+      case VOXELIZE_BRUTE_FORCE:
+      default:
+         return "bruteforce";
+   }
+}
+
+std::string BuildOptions::getVoxelBuildModeName() const
+{
+   switch (voxelBuildMode)
+   {
+      case BUILD_TOP_DOWN:
+         return "topdown";
+      case BUILD_CHUNKED:
+      default:
+         return "chunked";
+   }
+}
+
+std::string BuildOptions::getTriangleScheduleName() const
+{
+   switch (triangleSchedule)
+   {
+      case SCHEDULE_FILE_ORDER:
+         return "fileorder";
+      case SCHEDULE_MORTON:
+      default:
+         return "morton";
+   }
+}
+
+std::string BuildOptions::getDAGBuildModeName() const
+{
+   switch (dagBuildMode)
+   {
+      case DAG_BUILD_STREAM:
+         return "stream";
+      case DAG_BUILD_REDUCE:
+      default:
+         return "reduce";
+   }
+}
+
+std::string BuildOptions::getDAGReductionModeName() const
+{
+   switch (dagReductionMode)
+   {
+      case DAG_REDUCE_MIRROR:
+         return "mirror";
+      case DAG_REDUCE_EXACT:
+      default:
+         return "exact";
+   }
+}
+
+/**
+ * Returns whether nodes that differ in a few voxels may be merged anywhere in the DAG.
+ */
+bool BuildOptions::isLossy() const
+{
+   for (unsigned int i = 0; i < lossyBudgets.size(); i++)
+   {
+      if (lossyBudgets[i] > 0)
+      {
+         return true;
+      }
+   }
+   return false;
+}
+
+/**
+ * Returns the number of voxels a lossy merge may flip in one node height levels above the 
+ * leafs, 0 for merging only equal nodes.
+ */
+unsigned int BuildOptions::getLossyBudget(unsigned int height) const
+{
+   if (lossyBudgets.empty())
+   {
+      return 0;
+   }
+   return lossyBudgets[std::min(height, (unsigned int)lossyBudgets.size() - 1)];
+}
+
+void BuildOptions::print() const
+{
+   std::cout << "Voxelizer: " << getVoxelizationModeName() << std::endl;
+   std::cout << "Voxel Build: " << getVoxelBuildModeName() << std::endl;
+   std::cout << "Triangle Schedule: " << getTriangleScheduleName() << std::endl;
+   std::cout << "DAG Build: " << getDAGBuildModeName() << std::endl;
+   std::cout << "DAG Reduction: " << getDAGReductionModeName() << std::endl;
+   std::cout << "Voxel Cache: " << (useVoxelCache ? "on" : "off") << std::endl;
+   std::cout << "Solid: " << (solid ? "on" : "off") << std::endl;
+   std::cout << "Lossy Budgets: ";
+   if (isLossy())
+   {
+      for (unsigned int i = 0; i < lossyBudgets.size(); i++)
+      {
+         std::cout << (i > 0 ? "," : "") << lossyBudgets[i];
+      }
+      std::cout << " voxels per node from the leafs up" << std::endl;
+   }
+   else
+   {
+      std::cout << "off" << std::endl;
+   }
+   std::cout << "Voxelization Memory Budget: " << (memoryBudget / (1024 * 1024)) << " MB" << std::endl;
+}
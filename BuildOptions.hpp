@@ -0,0 +1,83 @@
+/**
+ * BuildOptions.hpp
+ * 
+ * Settings, mostly given on the command line, that pick between the different ways the 
+ * voxels, SVO and DAG can be built.
+ *
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */ 
+
+#ifndef BUILD_OPTIONS_HPP
+#define BUILD_OPTIONS_HPP
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+
+#define DEFAULT_MEMORY_BUDGET_MB 1024
+
+// How Voxels::voxelizeTriangle finds the voxels a triangle overlaps
+enum VoxelizationMode
+{
+   VOXELIZE_BRUTE_FORCE, // Test every voxel in the triangle's bounding box
+   VOXELIZE_SCANLINE     // Walk the columns of the triangle's dominant axis projection
+};
+
+// How Voxels splits up the volume to build the leafs
+enum VoxelBuildMode
+{
+   BUILD_CHUNKED, // Voxelize Morton ordered chunks that fit in the memory budget one at a time
+   BUILD_TOP_DOWN // Split the triangles between octants recursively, only visiting occupied ones
+};
+
+// The order Voxels hands the triangles of a chunk to the worker threads
+enum TriangleSchedule
+{
+   SCHEDULE_FILE_ORDER, // One task per triangle in the order of the mesh file
+   SCHEDULE_MORTON      // Split large triangles into tiles and sort the tasks by Morton code
+};
+
+// How DAG turns the voxels into its levels
+enum DAGBuildMode
+{
+   DAG_BUILD_REDUCE, // Build the whole SVO, then hash-cons each of its levels in parallel
+   DAG_BUILD_STREAM  // Hash-cons the nodes as the leafs come out of the voxelizer, without an SVO
+};
+
+// Which nodes DAG shares
+enum DAGReductionMode
+{
+   DAG_REDUCE_EXACT, // Nodes with the same voxels
+   DAG_REDUCE_MIRROR // Also nodes that are mirror images along any of the axes
+};
+
+class BuildOptions
+{
+   public:
+      VoxelizationMode voxelizationMode;
+      VoxelBuildMode voxelBuildMode;
+      TriangleSchedule triangleSchedule;
+      DAGBuildMode dagBuildMode;
+      DAGReductionMode dagReductionMode;
+      bool useVoxelCache; // Read the voxelization from ./voxelCache if present, write it if not
+      bool solid; // Also fill the voxels inside the (watertight) mesh, not just its surface
+      uint64_t memoryBudget; // Bytes the dense leaf words of one voxelization chunk may use, 0 for no limit
+      std::vector<unsigned int> lossyBudgets; // Voxels merging a node may flip, per level from the leafs up with the last one repeating, empty for exact DAGs
+
+      BuildOptions();
+      bool parseArgument(int argc, char const *argv[], int& i);
+      std::string getVoxelizationModeName() const;
+      std::string getVoxelBuildModeName() const;
+      std::string getTriangleScheduleName() const;
+      std::string getDAGBuildModeName() const;
+      std::string getDAGReductionModeName() const;
+      bool isLossy() const;
+      unsigned int getLossyBudget(unsigned int height) const;
+      void print() const;
+};
+
+#endif
@@ -6,12 +6,100 @@
 
 #include "DAG.hpp"
 
-DAG::DAG(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath, std::vector<PhongMaterial> materialsVal)
+/**
+ * Returns the bits of a child offset that carry its mirror for the reduction the options ask for.
+ */
+static unsigned int getChildMirrorBits(const BuildOptions& options)
+{
+   return (options.dagReductionMode == DAG_REDUCE_MIRROR) ? DAG_MIRROR_BITS : 0;
+}
+
+DAG::DAG(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath, std::vector<PhongMaterial> materialsVal, const BuildOptions& optionsVal)
 : boundingBox(boundingBoxVal),
    numLevels(levelsVal),
    size(pow(8, levelsVal)), 
    dimension(pow(2,levelsVal)),
-   voxelWidth(0)
+   voxelWidth(0),
+   filledPrefixBits(NULL),
+   nodeHeaderSizes(NULL),
+   voxelSource(NULL),
+   options(optionsVal)
+{
+   initialize(getChildMirrorBits(optionsVal));
+   materials = materialsVal;
+   boundingBox.print();
+   build(triangles, meshFilePath);
+   cout << endl << "Number of FilledVoxels: " << numFilledVoxels << endl << endl;
+   buildMoxelTable(triangles);
+}
+
+/**
+ * Builds the DAG of a voxel source. The moxel table takes the normals and materials from the 
+ * source, so no triangles are needed at all.
+ */
+DAG::DAG(const unsigned int levelsVal, const VoxelSource* voxelSourceVal, std::vector<PhongMaterial> materialsVal, const BuildOptions& optionsVal)
+: boundingBox(voxelSourceVal->getBoundingBox()),
+   numLevels(levelsVal),
+   size(pow(8, levelsVal)), 
+   dimension(pow(2,levelsVal)),
+   voxelWidth(0),
+   filledPrefixBits(NULL),
+   nodeHeaderSizes(NULL),
+   voxelSource(voxelSourceVal),
+   options(optionsVal)
+{
+   initialize(getChildMirrorBits(optionsVal));
+   materials = materialsVal;
+   boundingBox.print();
+   build(*voxelSource);
+   cout << endl << "Number of FilledVoxels: " << numFilledVoxels << endl << endl;
+   buildMoxelTable(std::vector<Triangle>());
+}
+
+/**
+ * Reduces an SVO that is already built, without a moxel table. Used to time the reduction on 
+ * its own.
+ */
+DAG::DAG(const unsigned int levelsVal, SparseVoxelOctree* svoVal, const BuildOptions& optionsVal)
+: boundingBox(svoVal->boundingBox),
+   numLevels(levelsVal),
+   size(pow(8, levelsVal)), 
+   dimension(pow(2,levelsVal)),
+   voxelWidth(0),
+   filledPrefixBits(NULL),
+   nodeHeaderSizes(NULL),
+   moxelTable(NULL),
+   voxelSource(NULL),
+   options(optionsVal)
+{
+   initialize(getChildMirrorBits(optionsVal));
+   build(svoVal);
+}
+
+/**
+ * Opens a DAG saved with save. The nodes and the moxel table are mapped from the file, so 
+ * nothing is voxelized or built.
+ */
+DAG::DAG(std::string dagFilePath, const BuildOptions& optionsVal)
+: numLevels(0),
+   size(0),
+   dimension(0),
+   voxelWidth(0),
+   filledPrefixBits(NULL),
+   nodeHeaderSizes(NULL),
+   moxelTable(NULL),
+   voxelTriangleIndex(NULL),
+   voxelSource(NULL),
+   options(optionsVal)
+{
+   load(dagFilePath);
+}
+
+/**
+ * Allocates the per level arrays and sets up the node header layout and the voxel size. 
+ * childMirrorBitsVal comes from the build options, or from the header of a loaded DAG.
+ */
+void DAG::initialize(unsigned int childMirrorBitsVal)
 {
    if (numLevels <= 2)
    {
@@ -21,19 +109,74 @@ DAG::DAG(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const
    }
    
    levels = new void*[numLevels-1]; // has the -1 because the last two levels are uint64's 
-   sizeAtLevel = new unsigned int[numLevels-1](); // has the -1 because the last two levels are uint64's 
-   newLevels = new void*[numLevels-1]; // has the -1 because the last two levels are uint64's 
+   sizeAtLevel = new uint64_t[numLevels-1](); // has the -1 because the last two levels are uint64's 
+
+   // The children of a node at level l hold up to 8^(numLevels-l-1) voxels each, so the filled 
+   // voxels before the last child are fewer than 8^(numLevels-l). The prefixes get narrower 
+   // further down. The 8 bit mask and the prefixes are packed into whole uint32_t's: 9 of 
+   // them at the root of 12 levels, 2 just above the leafs.
+   filledPrefixBits = new unsigned int[numLevels-2];
+   nodeHeaderSizes = new unsigned int[numLevels-2];
+   for (unsigned int level = 0; level < numLevels-2; level++)
+   {
+      filledPrefixBits[level] = 3 * (numLevels-level);
+      nodeHeaderSizes[level] = (8 + (NUM_FILLED_PREFIXES * filledPrefixBits[level]) + 31) / 32;
+   }
+   dagMemoryAlocated = new uint64_t[numLevels-1]();
+   fixedHeaderMemoryAlocated = new uint64_t[numLevels-1]();
+   prevDagMemoryAlocated = new uint64_t[numLevels-1]();
+   levelOffsets = new uint64_t[numLevels-1]();
+   childMirrorBits = childMirrorBitsVal;
+   numLossyMergedNodes = 0;
+   nodes = NULL;
+   numNodeWords = 0;
+   svo = NULL;
+   ownsSVO = false;
+   isMapped = false;
    boundingBox.square();
    voxelWidth = (boundingBox.maxs.x - boundingBox.mins.x) / dimension;
-   materials = materialsVal;
-   boundingBox.print();
-   build(triangles, meshFilePath);
-   cout << endl << "Number of FilledVoxels: " << numFilledVoxels << endl << endl;
-   buildMoxelTable(triangles);
 }
 
+/**
+ * Unmaps the node stream and frees the moxel table, or unmaps it for a loaded DAG. Also 
+ * deletes the SVO or voxel triangle index the DAG built for itself.
+ */
 DAG::~DAG()
 {
+   if (nodes != NULL)
+   {
+      munmap(nodes, numNodeWords * sizeof(uint32_t));
+   }
+   if (isMapped)
+   {
+      if (moxelTable != NULL)
+      {
+         munmap(moxelTable, numFilledVoxels * MOXEL_SIZE);
+      }
+   }
+   else
+   {
+      free(moxelTable);
+   }
+
+   delete [] levels;
+   delete [] sizeAtLevel;
+   delete [] filledPrefixBits;
+   delete [] nodeHeaderSizes;
+   delete [] dagMemoryAlocated;
+   delete [] fixedHeaderMemoryAlocated;
+   delete [] prevDagMemoryAlocated;
+   delete [] levelOffsets;
+
+   // A streamed build keeps the voxel triangle index itself, otherwise it belongs to the SVO
+   if (svo == NULL)
+   {
+      delete voxelTriangleIndex;
+   }
+   else if (ownsSVO)
+   {
+      delete svo;
+   }
 }
 
 void printBinaryVal(uint64_t val)
@@ -53,569 +196,518 @@ void printBinaryVal(uint64_t val)
 }
 
 /**
- * Builds the DAG from a SVO
- * Tested: 
+ * Hash-conses the numNodes nodes of a level in parallel. nodeIds gets the unique id of every 
+ * node and uniqueIndices the index of the first node of each id. Ids are numbered in the 
+ * order the nodes first appear, the same as adding them one by one. Returns the number of 
+ * unique nodes.
  */
-
-void DAG::build(const std::vector<Triangle> triangles, std::string meshFilePath)
+template <typename GetKey>
+uint64_t DAG::reduceLevel(uint64_t numNodes, const GetKey& getKey, std::vector<uint64_t>& nodeIds, std::vector<uint64_t>& uniqueIndices)
 {
-   SparseVoxelOctree* svoPtr = new SparseVoxelOctree(numLevels, boundingBox, triangles, meshFilePath);
-   auto start = chrono::steady_clock::now();
-   
-   SparseVoxelOctree svo = *svoPtr;
-   svoRoot = svo.root;
-   unsigned int* newLevelSizes = new unsigned int[numLevels-1]();
-   unsigned int newLevelIndex = numLevels-2;
-   unsigned int* dagMemoryAlocated = new unsigned int[numLevels-1];
-   unsigned int* moxelDagOptimizedMemoryAlocated = new unsigned int[numLevels-1];
-   unsigned int* prevDagMemoryAlocated = new unsigned int[numLevels-1];
-
-   unsigned int emptyCountSize[13];
-   emptyCountSize[0] = 0;
-   emptyCountSize[1] = 0;
-   emptyCountSize[2] = 0;
-   emptyCountSize[3] = 0;
-   emptyCountSize[4] = 1;
-   emptyCountSize[5] = 1;
-   emptyCountSize[6] = 1;
-   emptyCountSize[7] = 2;
-   emptyCountSize[8] = 2;
-   emptyCountSize[9] = 2;
-   emptyCountSize[10] = 3;
-   emptyCountSize[11] = 3;
-   emptyCountSize[12] = 3;
-
-   voxelTriangleIndexMap = svoPtr->voxelTriangleIndexMap;
+   uint64_t numBlocks = (numNodes + DAG_BLOCK_SIZE - 1) / DAG_BLOCK_SIZE;
+   ConcurrentDAGNodeTable table(numNodes);
 
-   cerr << "Building DAG..." << endl;
-   // cerr << "Levels: " << endl;
-   // for (int i = 0; i < 2; ++i)
-   // {
-   //    cerr << "\t" << i << ": " << svo.countAtLevel(i) << endl;
-   // }
+   tbb::parallel_for((uint64_t)0, numBlocks, [&](uint64_t block) {
+      uint64_t end = std::min((block + 1) * DAG_BLOCK_SIZE, numNodes);
+      for (uint64_t i = block * DAG_BLOCK_SIZE; i < end; i++)
+      {
+         table.insert(i, getKey);
+      }
+   });
+
+   // Every node finds the first node equal to it, which is unique if it found itself
+   std::vector<uint64_t> blockCounts(numBlocks);
+   nodeIds.resize(numNodes);
+   tbb::parallel_for((uint64_t)0, numBlocks, [&](uint64_t block) {
+      uint64_t end = std::min((block + 1) * DAG_BLOCK_SIZE, numNodes);
+      uint64_t count = 0;
+      for (uint64_t i = block * DAG_BLOCK_SIZE; i < end; i++)
+      {
+         nodeIds[i] = table.find(i, getKey);
+         count += (nodeIds[i] == i);
+      }
+      blockCounts[block] = count;
+   });
+   uint64_t numUnique = parallelExclusiveScan(blockCounts);
+
+   // Number the unique nodes, then give every node the number of its first equal node
+   std::vector<uint64_t> firstIds(numNodes);
+   uniqueIndices.resize(numUnique);
+   tbb::parallel_for((uint64_t)0, numBlocks, [&](uint64_t block) {
+      uint64_t end = std::min((block + 1) * DAG_BLOCK_SIZE, numNodes);
+      uint64_t id = blockCounts[block];
+      for (uint64_t i = block * DAG_BLOCK_SIZE; i < end; i++)
+      {
+         if (nodeIds[i] == i)
+         {
+            firstIds[i] = id;
+            uniqueIndices[id] = i;
+            id++;
+         }
+      }
+   });
+   tbb::parallel_for((uint64_t)0, numNodes, [&](uint64_t i) {
+      nodeIds[i] = firstIds[nodeIds[i]];
+   });
 
-   unsigned int numLeafs = size / 64;
-   unsigned int sizeOfLeafs = numLeafs * sizeof(uint64_t);
-   uint64_t* leafVoxels = (uint64_t*) svo.levels[numLevels-2]; // numLevels -2 b/c last 2 levels are together
-   uint64_t* copyLeafVoxels = new uint64_t[numLeafs];
-   unsigned int numChildren = numLeafs;
-   unsigned int updateCount = 0;
+   return numUnique;
+}
 
-   if (copyLeafVoxels == NULL)
+/**
+ * Merges the unique nodes of a level that are within the lossy budget of a more common one, 
+ * after the level is hash-consed, and remaps nodeIds and uniqueIndices to the ones that are 
+ * kept. childFilledCounts has the filled voxels of the level below by id. The root is kept 
+ * as it is. Returns the number of unique nodes left.
+ */
+template <typename GetKey>
+uint64_t DAG::clusterLevel(int levelIndex, uint64_t numUniqueNodes, const GetKey& getKey, std::vector<uint64_t>& nodeIds, std::vector<uint64_t>& uniqueIndices, const std::vector<uint64_t>& childFilledCounts)
+{
+   unsigned int leafLevel = numLevels-2;
+   unsigned int budget = options.getLossyBudget(leafLevel - levelIndex);
+   if (budget == 0 || levelIndex == 0)
    {
-      cerr << "Unable to allocate copyLeafVoxels\n";
+      return numUniqueNodes;
    }
-   //cerr << endl;
 
-   int parentLevelNum = numLevels-3;
-   SVONode* parentLevel = (SVONode*) svo.levels[parentLevelNum];
-   unsigned int numParents = numLeafs / 8;
-
-   std::cerr << "\tStarting leaf level (parentLevelNum: " << parentLevelNum << ")" << endl;
-   // std::cerr << "numParents: " << numParents << endl;
-   // std::cerr << "numChildren: " << numChildren << endl << endl;
+   std::vector<DAGNodeKey> keys(numUniqueNodes);
+   tbb::parallel_for((uint64_t)0, numUniqueNodes, [&](uint64_t u) {
+      keys[u] = getKey(uniqueIndices[u]);
+   });
+   std::vector<uint64_t> instanceCounts = getInstanceCounts(nodeIds, numUniqueNodes);
+   std::vector<uint64_t> representatives;
+   uint64_t numFlipped;
+   if (levelIndex == (int)leafLevel)
+   {
+      numFlipped = clusterLeafs(keys, instanceCounts, budget, representatives);
+   }
+   else
+   {
+      numFlipped = clusterNodes(keys, instanceCounts, childFilledCounts, childMirrorBits, budget, representatives);
+   }
 
-   // cerr << "\tSorting leaf nodes..." << endl;
-   memcpy(copyLeafVoxels, leafVoxels, sizeOfLeafs);
-   std::sort(copyLeafVoxels, copyLeafVoxels + numLeafs);
-   //cerr << "\tFinished sorting leaf nodes." << endl << endl;
+   uint64_t numRepresentatives = remapToRepresentatives(representatives, nodeIds, uniqueIndices);
+   numLossyMergedNodes += numUniqueNodes - numRepresentatives;
+   cerr << "\t\tLossy merged: " << (numUniqueNodes - numRepresentatives) << " of " << numUniqueNodes << " (budget " << budget << ", at most " << numFlipped << " flipped voxels)" << endl;
+   return numRepresentatives;
+}
 
-   // Calculate the number of unique leafs
-   cerr << "\tReducing leaf nodes..." << endl;
-   unsigned int numUniqueLeafs = 1;
-   for (unsigned int i = 0; i < numLeafs-1; ++i)
-   {
-      if (copyLeafVoxels[i] != copyLeafVoxels[i+1])
+/**
+ * Replaces each value with the sum of the values before it, summing blocks of DAG_BLOCK_SIZE 
+ * values in parallel. Returns the sum of all the values.
+ */
+uint64_t parallelExclusiveScan(std::vector<uint64_t>& values)
+{
+   uint64_t numValues = values.size();
+   uint64_t numBlocks = (numValues + DAG_BLOCK_SIZE - 1) / DAG_BLOCK_SIZE;
+   std::vector<uint64_t> blockSums(numBlocks);
+
+   tbb::parallel_for((uint64_t)0, numBlocks, [&](uint64_t block) {
+      uint64_t end = std::min((block + 1) * DAG_BLOCK_SIZE, numValues);
+      uint64_t sum = 0;
+      for (uint64_t i = block * DAG_BLOCK_SIZE; i < end; i++)
       {
-         numUniqueLeafs++;
+         sum += values[i];
       }
+      blockSums[block] = sum;
+   });
+
+   uint64_t total = 0;
+   for (uint64_t block = 0; block < numBlocks; block++)
+   {
+      uint64_t sum = blockSums[block];
+      blockSums[block] = total;
+      total += sum;
    }
-   std::cerr << "\t\tnumUniqueLeafs: " << numUniqueLeafs << endl;
-   
-   // Allocate the number of unique leafs and make copies of them
-   uint64_t* uniqueLeafs = new uint64_t[numUniqueLeafs];
-   unsigned int uniqueLeafIndex = 1;
-   uniqueLeafs[0] = copyLeafVoxels[0];
-   newLevels[newLevelIndex] = uniqueLeafs;
-   newLevelSizes[newLevelIndex] = numUniqueLeafs;
-   // cout << "newLevels at leafs (newLevelIndex = " << newLevelIndex << ")" << endl;
-   newLevelIndex--;
-
-   for (unsigned int i = 0; i < numLeafs-1; ++i)
-   {
-      if (copyLeafVoxels[i] != copyLeafVoxels[i+1])
+
+   tbb::parallel_for((uint64_t)0, numBlocks, [&](uint64_t block) {
+      uint64_t end = std::min((block + 1) * DAG_BLOCK_SIZE, numValues);
+      uint64_t sum = blockSums[block];
+      for (uint64_t i = block * DAG_BLOCK_SIZE; i < end; i++)
       {
-         uniqueLeafs[uniqueLeafIndex] = copyLeafVoxels[i+1];
-         uniqueLeafIndex++;
+         uint64_t value = values[i];
+         values[i] = sum;
+         sum += value;
       }
+   });
+   return total;
+}
+
+/**
+ * Builds the DAG from a SVO
+ * Tested: 
+ */
+
+void DAG::build(const std::vector<Triangle> triangles, std::string meshFilePath)
+{
+   if (options.dagBuildMode == DAG_BUILD_STREAM)
+   {
+      DAGStreamBuilder stream(numLevels, childMirrorBits);
+      auto start = chrono::steady_clock::now();
+      Voxels* voxels = new Voxels(numLevels, boundingBox, triangles, meshFilePath, options, &stream);
+      auto end = chrono::steady_clock::now();
+      auto diff = end - start;
+      cout << "\t\tTime Voxelization (" << options.getVoxelizationModeName() << ", " << options.getVoxelBuildModeName() << ", streamed): " << chrono::duration <double, milli> (diff).count() << " ms" << endl;
+      build(voxels, stream);
+   }
+   else
+   {
+      build(new SparseVoxelOctree(numLevels, boundingBox, triangles, meshFilePath, options));
+      ownsSVO = true;
    }
+}
 
-   // cout << "\nuniqueLeafs: " << endl;
-   // for (unsigned int i = 0; i < numUniqueLeafs; ++i)
-   // {
-   //    std::cout << uniqueLeafs[i] << " => " << &(uniqueLeafs[i]) << "\n";
-   // }
-   // std::cout << endl << endl; 
+/**
+ * Builds the DAG of a voxel source by reducing its SVO. Sources are not streamed, the nodes a 
+ * solid source fills entirely only exist as shared full blocks in the SVO.
+ */
+void DAG::build(const VoxelSource& source)
+{
+   build(new SparseVoxelOctree(numLevels, source, options));
+   ownsSVO = true;
+}
 
-   // Free the copy of the leafs
-   delete [] copyLeafVoxels;
-   cerr << "\tFinished reducing leaf nodes." << endl << endl;
+/**
+ * Finishes a streamed build: the leafs the voxelizer kept are streamed now, then the unique 
+ * nodes of each level are written out from the stream's tables bottom up. No SVO is built, 
+ * so the memory used is the voxelization, the unique nodes and the DAG.
+ */
+void DAG::build(Voxels* voxels, DAGStreamBuilder& stream)
+{
+   auto start = chrono::steady_clock::now();
+   voxelTriangleIndex = voxels->voxelTriangleIndex;
 
-   // Adjust the pointers of the level above in the svo
-   cerr << "\tAdjusting parent node's pointer's to unique children..." << endl; 
+   cerr << "Building DAG..." << endl;
 
-   updateCount = 0;
-   for (unsigned int i = 0; i < numParents; i++)
+   if (voxels->leafStream == NULL)
    {
-      for (unsigned int j = 0; j < 8; j++)
+      for (uint64_t i = 0; i < voxels->numLeafs; i++)
       {
-         if (parentLevel[i].childPointers[j] != NULL)
-         {
-            uint64_t childValue = *((uint64_t*)parentLevel[i].childPointers[j]);
-            bool foundUpdate = false;
-            // Search for the corresponding child value in the uniqueLeafs and replace the 
-            // childpointer with a pointer to the unique leaf
-            for (unsigned int k = 0; k < numUniqueLeafs && childValue != 0; k++)
-            {
-               if (uniqueLeafs[k] == childValue)
-               {
-                  parentLevel[i].childPointers[j] = &(uniqueLeafs[k]);
-                  updateCount++;
-                  //cerr << "\t\tUpdate: " << updateCount << "\t=> "  << childValue << " &=> " << &(uniqueLeafs[k]) << endl;
-                  foundUpdate = true;
-               }
-            }
-
-            if (!foundUpdate)
-            {
-               cerr << "!!!!!!!!! Did not find update for " << childValue << endl;
-            }
-         }
+         stream.addLeaf(voxels->leafIndices[i], voxels->leafs[i]);
       }
    }
-   cerr << "\tFinished adjusting parent node's pointer's to unique children." << endl << endl;
-   //std::cerr << "Finished leaf level (parentLevelNum: " << parentLevelNum << ")" << endl << endl << endl;
+   stream.finish();
+   delete voxels;
 
-   parentLevelNum--;
+   unsigned int leafLevel = numLevels-2;
+   DAGNodeTable* leafTable = stream.tables[leafLevel];
+   uint64_t numUniqueLeafs = leafTable->size();
+   std::cerr << "\t\tnumUniqueLeafs: " << numUniqueLeafs << endl;
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-   //Adjust the pointers of the rest of the levels in the svo
-   SVONode* childLevel;
+   auto getUniqueLeaf = [&](uint64_t u) {
+      return leafTable->keys[u].mask;
+   };
+   std::vector<uint64_t> childOffsets;
+   std::vector<uint64_t> childFilledCounts;
+   writeLeafLevel(numUniqueLeafs, getUniqueLeaf, childOffsets, childFilledCounts);
+   stream.freeTable(leafLevel);
 
-   while (parentLevelNum >= 0)
+   for (int levelIndex = numLevels-3; levelIndex >= 0; levelIndex--)
    {
-      childLevel = parentLevel;
-      parentLevel = (SVONode*) svo.levels[parentLevelNum];
-      numChildren = numParents;
-      numParents /= 8;
-      unsigned int sizeofChildren = sizeof(SVONode) * numChildren;
+      DAGNodeTable* table = stream.tables[levelIndex];
+      auto getUniqueKey = [&](uint64_t u) {
+         return table->keys[u];
+      };
+      cerr << "\tLevel " << levelIndex << " numUniqueChildren: " << table->size() << endl;
+      writeLevel(levelIndex, table->size(), getUniqueKey, childOffsets, childFilledCounts);
+      stream.freeTable(levelIndex);
+   }
 
-      std::cerr << "\tStarting parentLevelNum: " << parentLevelNum << endl;
-      // std::cerr << "numParents: " << numParents << endl;
-      // std::cerr << "numChildren: " << numChildren << endl << endl;
+   finishBuild(start);
+}
 
-      // Sort the child level based on the pointers of each child node
-      // cerr << "\tSorting child nodes..." << endl;
-      SVONode* copyChildNodes = new SVONode[numChildren];
-      memcpy(copyChildNodes, childLevel, sizeofChildren);
-      std::sort(copyChildNodes, copyChildNodes + numChildren);
+/**
+ * Reduces the SVO into the DAG. With lossy budgets the unique nodes of each level are 
+ * clustered before the level is written, so the level above is keyed by the merged ids.
+ */
+void DAG::build(SparseVoxelOctree* svoPtr)
+{
+   auto start = chrono::steady_clock::now();
+   
+   svo = svoPtr;
+   voxelTriangleIndex = svo->voxelTriangleIndex;
 
-      //cout << "copyChildNodes (at parentLevel " << parentLevelNum << "): " << endl;
-      // for (unsigned int i = 0; i < numChildren; i++)
-      // {
-      //    cout << &copyChildNodes[i] << ": ";
-      //    copyChildNodes[i].printOneLine();
-      // }
-      // cout << endl;
+   cerr << "Building DAG..." << endl;
 
-      // cerr << "\tFinished sorting child nodes." << endl << endl;
+   // The SVO only stores the non-empty nodes of each level
+   unsigned int leafLevel = numLevels-2;
+   uint64_t numLeafs = svo->levelSizes[leafLevel];
+   uint64_t* leafVoxels = (uint64_t*) svo->levels[leafLevel];
+
+   // With mirror reduction every node is replaced by its canonical mirror image before it is 
+   // hash-consed, remembering the mirror to get back to it
+   bool isMirrored = childMirrorBits > 0;
+   std::vector<unsigned char> mirrors;
+   std::vector<uint64_t> canonicalLeafs;
+   if (isMirrored)
+   {
+      canonicalLeafs.resize(numLeafs);
+      mirrors.resize(numLeafs);
+      tbb::parallel_for((uint64_t)0, numLeafs, [&](uint64_t i) {
+         DAGNodeKey key = getLeafKey(leafVoxels[i]);
+         mirrors[i] = canonicalizeDAGNodeKey(key, true);
+         canonicalLeafs[i] = key.mask;
+      });
+      leafVoxels = canonicalLeafs.data();
+   }
 
-      //Reducing child nodes
-      // cerr << "\tReducing child nodes..." << endl;
-      unsigned int numUniqueChildren = 1;
-      for (unsigned int i = 0; i < numChildren-1; ++i)
-      {
-         if (copyChildNodes[i] != copyChildNodes[i+1])
-         {
-            numUniqueChildren++;
-         }
-      }
-      cerr << "\t\tnumUniqueChildren: " << numUniqueChildren << endl;
-
-      SVONode* uniqueChildren = new SVONode[numUniqueChildren];
-      unsigned int uniqueChildIndex = 0;
-      memcpy(&uniqueChildren[uniqueChildIndex], &copyChildNodes[0], sizeof(SVONode));
-      uniqueChildIndex++;
-      newLevels[newLevelIndex] = uniqueChildren;
-      newLevelSizes[newLevelIndex] = numUniqueChildren;
-      //cout << "newLevels at newLevelIndex = " << newLevelIndex << endl;
-      newLevelIndex--;
-      for (unsigned int i = 0; i < numChildren-1; ++i)
-      {
-         if (copyChildNodes[i] != copyChildNodes[i+1])
-         {
-            memcpy(&uniqueChildren[uniqueChildIndex], &copyChildNodes[i+1], sizeof(SVONode));
-            uniqueChildIndex++;
-         }
-      }
-      delete [] copyChildNodes;
+   // Hash-cons the leafs. The unique leafs keep the order they first appear in.
+   cerr << "\tReducing leaf nodes..." << endl;
+   auto getLeafNodeKey = [&](uint64_t i) {
+      return getLeafKey(leafVoxels[i]);
+   };
+   std::vector<uint64_t> childIds;
+   std::vector<uint64_t> uniqueIndices;
+   uint64_t numUniqueLeafs = reduceLevel(numLeafs, getLeafNodeKey, childIds, uniqueIndices);
+   std::cerr << "\t\tnumUniqueLeafs: " << numUniqueLeafs << endl;
+   std::vector<uint64_t> childFilledCounts;
+   numUniqueLeafs = clusterLevel(leafLevel, numUniqueLeafs, getLeafNodeKey, childIds, uniqueIndices, childFilledCounts);
+   if (isMirrored)
+   {
+      addChildMirrors(childIds, mirrors);
+   }
+
+   // For the level below the one being reduced: the unique id of each SVO node (childIds), 
+   // the offset of each unique node in its DAG level and the number of filled voxels below it
+   auto getUniqueLeaf = [&](uint64_t u) {
+      return leafVoxels[uniqueIndices[u]];
+   };
+   std::vector<uint64_t> childOffsets;
+   writeLeafLevel(numUniqueLeafs, getUniqueLeaf, childOffsets, childFilledCounts);
+   cerr << "\tFinished reducing leaf nodes." << endl << endl;
 
-      //cerr << "\tFinished reducing child nodes." << endl << endl;
+   // Reduce the levels above bottom up. Two nodes are the same when they have the same mask 
+   // and the same unique children, so each node is keyed by those and hash-consed.
+   for (int levelIndex = numLevels-3; levelIndex >= 0; levelIndex--)
+   {
+      SVONode* nodes = (SVONode*) svo->levels[levelIndex];
+      uint64_t numNodes = svo->levelSizes[levelIndex];
 
-      // Reducing child nodes
-      //cerr << "\tAdjusting parent node's pointer's to unique children..." << endl;
-      updateCount = 0;
-      bool foundUpdate = false;
-      for (unsigned int i = 0; i < numParents; i++)
-      {
+      std::cerr << "\tStarting level: " << levelIndex << endl;
+      auto getSVONodeKey = [&](uint64_t i) {
+         DAGNodeKey key;
+         key.mask = nodes[i].getChildMask();
          for (unsigned int j = 0; j < 8; j++)
          {
-            if (parentLevel[i].childPointers[j] != NULL)
-            {
-               // Get a pointer to the address of the child value so you can replace it with the 
-               // new unique child pointer
-               SVONode childValue = *((SVONode*) parentLevel[i].childPointers[j]);
-
-               // Search for the corresponding child value in the uniqueChildren and replace the 
-               // childpointer with a pointer to the unique leaf
-               for (unsigned int k = 0; k < numUniqueChildren; k++)
-               {
-                  if (uniqueChildren[k] == childValue)
-                  {
-                     parentLevel[i].childPointers[j] = &(uniqueChildren[k]);
-                     updateCount++;
-                     //cerr << "\t\tUpdate: " << updateCount << " &=> " << &(uniqueChildren[k]) << endl;
-                     foundUpdate = true;
-                  }
-               }
-               if (!foundUpdate)
-               {
-                  cerr << "!!!!!!!!! Did not find update for ";
-                  //childValue.printOneLine();
-               }
-            }
+            key.childIds[j] = nodes[i].isChildSet(j) ? childIds[nodes[i].getChildIndex(j)] : 0;
          }
-      }
+         return key;
+      };
 
-      //cerr << "\tFinished adjusting parent node's pointer's to unique children." << endl << endl;
-
-      std::cerr << "Finished parentLevelNum: " << parentLevelNum << endl << endl << endl;
-      parentLevelNum--;
+      // The root is left as it is, there is no parent to hold its mirror
+      std::vector<DAGNodeKey> canonicalKeys;
+      bool isLevelMirrored = isMirrored && levelIndex > 0;
+      if (isLevelMirrored)
+      {
+         canonicalKeys.resize(numNodes);
+         mirrors.resize(numNodes);
+         tbb::parallel_for((uint64_t)0, numNodes, [&](uint64_t i) {
+            canonicalKeys[i] = getSVONodeKey(i);
+            mirrors[i] = canonicalizeDAGNodeKey(canonicalKeys[i], false);
+         });
+      }
+      auto getNodeKey = [&](uint64_t i) {
+         return isLevelMirrored ? canonicalKeys[i] : getSVONodeKey(i);
+      };
+
+      std::vector<uint64_t> nodeIds;
+      uint64_t numUniqueNodes = reduceLevel(numNodes, getNodeKey, nodeIds, uniqueIndices);
+      cerr << "\t\tnumUniqueChildren: " << numUniqueNodes << endl;
+      numUniqueNodes = clusterLevel(levelIndex, numUniqueNodes, getNodeKey, nodeIds, uniqueIndices, childFilledCounts);
+
+      auto getUniqueKey = [&](uint64_t u) {
+         return getNodeKey(uniqueIndices[u]);
+      };
+      writeLevel(levelIndex, numUniqueNodes, getUniqueKey, childOffsets, childFilledCounts);
+      if (isLevelMirrored)
+      {
+         addChildMirrors(nodeIds, mirrors);
+      }
+      childIds.swap(nodeIds);
+      std::cerr << "Finished level: " << levelIndex << endl << endl << endl;
    }
 
-   // Update the newLevels to include the root
-   SVONode* newRoot = new SVONode;
-   memcpy(newRoot, svo.levels[0], sizeof(SVONode));
-   newLevels[0] = newRoot;
-   svoRoot = newRoot;
-   newLevelSizes[0] = 1;
+   finishBuild(start);
+}
 
-   //cerr << "After updated SVO root:" << endl; 
-   // for (int i = 0; i < 8; ++i)
-   // {
-   //    cerr << "\t" << newRoot->childPointers[i] << endl;
-   // }
-   // cerr << endl;
+/**
+ * Moves the unique id of each node up by childMirrorBits and puts the mirror its canonical node 
+ * is seen through below it, the child ids the keys of the level above are made of.
+ */
+void DAG::addChildMirrors(std::vector<uint64_t>& nodeIds, const std::vector<unsigned char>& mirrors)
+{
+   tbb::parallel_for((uint64_t)0, (uint64_t)nodeIds.size(), [&](uint64_t i) {
+      nodeIds[i] = (nodeIds[i] << childMirrorBits) | mirrors[i];
+   });
+}
 
-   // cout << "Num unique nodes at level:" << endl;
-   // for (unsigned int i = 0; i < numLevels-1; ++i)
-   // {
-   //    cout << "\t" << i << ": " << newLevelSizes[i] << endl;
-   // }
+/**
+ * Writes the unique leafs as the DAG's leaf level, the first one in the node stream, and sets 
+ * up the offset and the number of filled voxels of each, for writing the level above. 
+ * GetLeaf is a function object returning the voxel bits of a unique leaf.
+ */
+template <typename GetLeaf>
+void DAG::writeLeafLevel(uint64_t numUniqueLeafs, const GetLeaf& getUniqueLeaf, std::vector<uint64_t>& childOffsets, std::vector<uint64_t>& childFilledCounts)
+{
+   unsigned int leafLevel = numLevels-2;
+   uint64_t* leafs = (uint64_t*)appendLevel(leafLevel, numUniqueLeafs * (sizeof(uint64_t) / sizeof(uint32_t)));
+
+   childOffsets.resize(numUniqueLeafs);
+   childFilledCounts.resize(numUniqueLeafs);
+   tbb::parallel_for((uint64_t)0, numUniqueLeafs, [&](uint64_t u) {
+      leafs[u] = getUniqueLeaf(u);
+      childOffsets[u] = u;
+      childFilledCounts[u] = countSetBits(leafs[u]);
+   });
 
-   // Go through each level and count the number of nonvoid pointers
-   unsigned int levelIndex;
-   for (levelIndex = 0; levelIndex < numLevels-2; levelIndex++)
-   {
-      unsigned int pointerCount = 0;
-      for (unsigned int i = 0; i < newLevelSizes[levelIndex]; i++)
-      {
-         for (int j = 0; j < 8; j++)
-         {
-            if ( ((SVONode*) newLevels[levelIndex])[i].childPointers[j] != NULL)
-            {
-               pointerCount++;
-            }
-         }
-      }
+   sizeAtLevel[leafLevel] = numUniqueLeafs;
+   dagMemoryAlocated[leafLevel] = numUniqueLeafs * sizeof(uint64_t);
+   prevDagMemoryAlocated[leafLevel] = numUniqueLeafs * sizeof(uint64_t);
+   fixedHeaderMemoryAlocated[leafLevel] = numUniqueLeafs * sizeof(uint64_t);
+}
 
-      // A level is made up of              the pointers in the nodes,     the masks of the nodes, and the space for the empty counts (the first 8 bits is for the mask and the next 56+64+64+64 bits is for the empty node counts)
-      levels[levelIndex] = (void*)malloc( (pointerCount * sizeof(void*)) + (newLevelSizes[levelIndex] * 4 * sizeof(uint64_t)) );
-      //cerr << levelIndex << ": " << ( (pointerCount * sizeof(void*)) + (newLevelSizes[levelIndex] * 3 * sizeof(uint64_t)) ) / 8 << " uint64_t's or void*'s" << endl;
-      dagMemoryAlocated[levelIndex] = (pointerCount * sizeof(void*)) + (newLevelSizes[levelIndex] * 4 * sizeof(uint64_t));
-      prevDagMemoryAlocated[levelIndex] = (pointerCount * sizeof(void*)) + (newLevelSizes[levelIndex] * 1 * sizeof(uint64_t));      
-      moxelDagOptimizedMemoryAlocated[levelIndex] = (pointerCount * sizeof(void*)) + (newLevelSizes[levelIndex] * (1 + emptyCountSize[levelIndex+2]) * sizeof(uint64_t));
-
-      sizeAtLevel[levelIndex] = newLevelSizes[levelIndex];
-   }
-   //cerr << levelIndex << " (leafs): " << numUniqueLeafs << " uint64_t's or void*'s" << endl << endl;
-   sizeAtLevel[levelIndex] = numUniqueLeafs;
-   dagMemoryAlocated[levelIndex] = numUniqueLeafs * sizeof(uint64_t);
-   prevDagMemoryAlocated[levelIndex] = numUniqueLeafs * sizeof(uint64_t);
-   moxelDagOptimizedMemoryAlocated[levelIndex] = numUniqueLeafs * sizeof(uint64_t);
-
-   // Just use the already allocated leafs of the compacted SVO instead of allocating a new one
-   levels[numLevels-2] = newLevels[numLevels-2];
-
-   // Set the masks and pointers of the level above the leafs
-   unsigned int currentLevelIndex = numLevels-3;
-   // cout << "Working at level above the leafs: " << currentLevelIndex << endl;
-   uint64_t* maskPtr;
-   uint64_t* currPtr = (uint64_t*) levels[currentLevelIndex];
-   unordered_map<void*, void*>* leafParentMapping = new unordered_map<void*, void*>;
-   for (unsigned int i = 0; i < newLevelSizes[currentLevelIndex]; i++)
-   {
-      uint64_t mask = 0;
-      maskPtr = (uint64_t*) currPtr;
-      // Make a mapping from the address of the node of the compacted SVO to what the address is of the new DAG node
-      leafParentMapping->insert( std::make_pair<void*,void*>( (void*) &((SVONode*) newLevels[currentLevelIndex])[i], (void*)maskPtr ) );
-      //cout << "Adding to Map: " << "( " <<  (void*) &((SVONode*) newLevels[currentLevelIndex])[i] << ", " << (void*)maskPtr << " )" << endl;
-      
-      // Move 4 x 64bit sections down to get to where the child pointers should be
-      currPtr+=4;
+/**
+ * Writes the unique nodes of a level in id order, each one the header followed by one 32 bit 
+ * offset per child, in uint32_t's from the start of the level below (in uint64_t's for the 
+ * leafs). childOffsets and childFilledCounts come in for the level below, indexed by the 
+ * children's ids, and go out for this level. With mirror reduction the offset is shifted up 
+ * to make room for the child's mirror, which leaves 29 bits for it.
+ */
+template <typename GetKey>
+void DAG::writeLevel(int levelIndex, uint64_t numUniqueNodes, const GetKey& getUniqueKey, std::vector<uint64_t>& childOffsets, std::vector<uint64_t>& childFilledCounts)
+{
+   unsigned int nodeHeaderSize = nodeHeaderSizes[levelIndex];
+   uint64_t childWordSize = (levelIndex+1 == (int)numLevels-2) ? sizeof(uint64_t) : sizeof(uint32_t);
+   if (dagMemoryAlocated[levelIndex+1] / childWordSize > (UINT32_MAX >> childMirrorBits))
+   {
+      std::string err("\nLevel " + std::to_string(levelIndex+1) + " of the DAG is too large for 32 bit child offsets\n");
+      std::cerr << err;
+      throw std::out_of_range(err);
+   }
 
-      for (int j = 0; j < 8; j++)
+   std::vector<uint64_t> nodeOffsets(numUniqueNodes);
+   tbb::parallel_for((uint64_t)0, numUniqueNodes, [&](uint64_t u) {
+      nodeOffsets[u] = nodeHeaderSize + countSetBits(getUniqueKey(u).mask);
+   });
+   uint64_t numWords = parallelExclusiveScan(nodeOffsets);
+   uint64_t pointerCount = numWords - (numUniqueNodes * nodeHeaderSize);
+
+   // The header every level had when the counts were all as wide as the root's
+   unsigned int fixedHeaderSize = nodeHeaderSizes[0];
+
+   // Each node is nodeHeaderSize uint32_t's holding its 8 bit child mask and the packed 
+   // filled voxel prefixes, followed by one 32-bit offset per child
+   appendLevel(levelIndex, numWords);
+   dagMemoryAlocated[levelIndex] = (pointerCount * sizeof(uint32_t)) + (numUniqueNodes * nodeHeaderSize * sizeof(uint32_t));
+   prevDagMemoryAlocated[levelIndex] = (pointerCount * sizeof(uint32_t)) + (numUniqueNodes * 1 * sizeof(uint32_t));      
+   fixedHeaderMemoryAlocated[levelIndex] = (pointerCount * sizeof(uint32_t)) + (numUniqueNodes * fixedHeaderSize * sizeof(uint32_t));
+   sizeAtLevel[levelIndex] = numUniqueNodes;
+
+   // Write the masks, the child offsets and the filled prefixes of the unique nodes
+   std::vector<uint64_t> nodeFilledCounts(numUniqueNodes);
+   uint64_t mirrorMask = ((uint64_t)1 << childMirrorBits) - 1;
+   tbb::parallel_for((uint64_t)0, numUniqueNodes, [&](uint64_t u) {
+      DAGNodeKey key = getUniqueKey(u);
+      uint32_t* maskPtr = ((uint32_t*) levels[levelIndex]) + nodeOffsets[u];
+      uint32_t* currPtr = maskPtr + nodeHeaderSize;
+      uint64_t filledCounts[8];
+      uint64_t filledCountsSum = 0;
+
+      *maskPtr = key.mask;
+      for (unsigned int j = 0; j < 8; j++)
       {
-         if ( ((SVONode*) newLevels[currentLevelIndex])[i].childPointers[j] != NULL)
+         if (key.mask & (1 << j))
          {
-            uint64_t toOr = 1 << j;
-            //***
-            // Add the pointer to the leaf to the new DAG node and update the mask
-            // It is the same pointer as in the SVONodes because we are using the same leaf nodes
-            uint64_t* pointerToChild = (uint64_t*) ((SVONode*) newLevels[currentLevelIndex])[i].childPointers[j];
-            uint64_t* pointerToStartOfChildsLevel = (uint64_t*)levels[numLevels-2];
-            // *currPtr = pointerToChild;
-            //cout << "pointer to child = " << pointerToChild << endl;
-            //cout << "pointer to start of child's level = " << pointerToStartOfChildsLevel << endl;
-            uint64_t offset = (uint64_t)(pointerToChild - pointerToStartOfChildsLevel);
-            //cout << "\toffset = " << offset << endl << endl;
-            *currPtr = offset;
-
-            mask |= toOr;
+            uint64_t childId = key.childIds[j] >> childMirrorBits;
+            *currPtr = (uint32_t)((childOffsets[childId] << childMirrorBits) | (key.childIds[j] & mirrorMask));
+            filledCounts[j] = childFilledCounts[childId];
             currPtr++;
          }
-      }
-      *maskPtr = mask;
-   }
-
-   unordered_map<void*, void*>* currLevelsMap = leafParentMapping;
-   unordered_map<void*, void*>* prevLevelsMap = NULL;
-   
-   // For each levels nodes: set the mask 
-   for (int levelIndex = numLevels-4; levelIndex >= 0; levelIndex--)
-   {
-      //cout << "Working at level: " << levelIndex << endl;
-      cerr << "\tSetting Mask for Level " << levelIndex << endl;
-      
-      // Update the maps releasing previous, setting previous to current, and creating a new current
-      delete prevLevelsMap;
-      prevLevelsMap = currLevelsMap;
-      currLevelsMap = new unordered_map<void*, void*>;
-
-      currPtr = (uint64_t*) levels[levelIndex];
-
-      for (unsigned int i = 0; i < newLevelSizes[levelIndex]; i++)
-      {
-         uint64_t mask = 0;
-         maskPtr = (uint64_t*) currPtr;
-         currLevelsMap->insert( std::make_pair<void*,void*>( (void*) &((SVONode*) newLevels[levelIndex])[i], (void*)maskPtr ) );
-         //cout << "\tAdding to the map: ( " << &((SVONode*) newLevels[levelIndex])[i] << ", " << (void*)maskPtr << " )" << endl;
-         
-         // Move 4 x 64bit sections down to get to where the child pointers should be
-         currPtr+=4;
-         
-         //cerr << "\t";
-         for (int j = 0; j < 8; j++)
+         else
          {
-            if ( ((SVONode*) newLevels[levelIndex])[i].childPointers[j] != NULL)
-            {
-               uint64_t toOr = 1 << j;
-               //cout << "Searching for[" << j << "]: " << ((SVONode*) newLevels[levelIndex])[i].childPointers[j] << endl;
-
-               //***
-               // Set the child pointer to the pointer of the new DAG/leaf node that is found from the mapping of the previous level
-               // *currPtr = (uint64_t*) prevLevelsMap->at( ((SVONode*) newLevels[levelIndex])[i].childPointers[j] );
-               uint64_t* pointerToChild = (uint64_t*) prevLevelsMap->at( ((SVONode*) newLevels[levelIndex])[i].childPointers[j] );
-               uint64_t* pointerToStartOfChildsLevel = (uint64_t*) levels[levelIndex+1];
-               // *currPtr = pointerToChild;
-               // cout << "\tReturned value: " << pointerToChild<< endl;
-               // cout << "pointer to child = " << pointerToChild << endl;
-               // cout << "pointer to start of child's level = " << pointerToStartOfChildsLevel << endl;
-               uint64_t offset = (uint64_t)(pointerToChild - pointerToStartOfChildsLevel);
-               // cout << "\toffset = " << offset << endl << endl;
-               *currPtr = offset;
-               
-               mask |= toOr;
-               // cerr << "1";
-               currPtr++;
-            }
-            else 
-            {
-               // cerr << "0";
-            }
+            filledCounts[j] = 0;
          }
-         // cerr << endl;
-         // cerr << "\tmask(" << maskPtr << "): " << mask << endl << endl;
-         *maskPtr = mask;
+         filledCountsSum += filledCounts[j];
       }
-      // cout << endl;
-      cerr << "\tFinished Setting Mask for Level " << levelIndex << endl;
-   }
-   root=levels[0];
-
-   //cout << "\nsizeAtLevel: " << endl;
-   // for (unsigned int i = 0; i < numLevels-1; ++i)
-   // {
-   //    cout << i << " (" << levels[i] << ")" << ": " << sizeAtLevel[i] << endl;
-   // }
-   // cout << endl;
-
-   
-   //*** Calculate and set the empty counts ***\\
-   //cout << "\tCalculating empty counts" << endl << endl;
+      setFilledPrefixes((void*)maskPtr, levelIndex, filledCounts);
+      nodeFilledCounts[u] = filledCountsSum;
+   });
 
-   // For each unique leaf node calculate its empty counts and put it in a map with the key 
-   // as its memory address and its value as the empty count
-   uint64_t* leafNodes = (uint64_t*) levels[numLevels-2];
-   unordered_map<void*, unsigned int>* leafEmptyCountMap = new unordered_map<void*, unsigned int>;
+   childOffsets.swap(nodeOffsets);
+   childFilledCounts.swap(nodeFilledCounts);
+}
 
-   //cout << "Level " << numLevels-2 << " (leafs)" << endl;
-   for (unsigned int i = 0; i < sizeAtLevel[numLevels-2]; i++)
+/**
+ * Grows the node stream by numWords uint32_t's for level and returns where the level starts. 
+ * The levels are written bottom up, leafs first, straight into the stream, so the leafs are 
+ * 8 byte aligned at offset 0. The stream is grown with mremap, which moves its pages rather 
+ * than copying them, so the DAG is never held twice while it is built. levels is updated for 
+ * the levels written so far.
+ */
+uint32_t* DAG::appendLevel(unsigned int level, uint64_t numWords)
+{
+   uint64_t oldBytes = numNodeWords * sizeof(uint32_t);
+   uint64_t newBytes = oldBytes + (numWords * sizeof(uint32_t));
+   void* grown;
+   if (nodes == NULL)
+   {
+      grown = mmap(NULL, newBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   }
+   else
+   {
+      grown = mremap(nodes, oldBytes, newBytes, MREMAP_MAYMOVE);
+   }
+   if (grown == MAP_FAILED)
    {
-      unsigned int emptyCount = getNumEmptyLeafNodes(leafNodes[i]);
-      leafEmptyCountMap->insert( std::make_pair<void*,unsigned int>( (void*) &(leafNodes[i]), (unsigned int) emptyCount ) );
-      //cout << "\t" << &(leafNodes[i]) << " => " << leafNodes[i] << " = " << emptyCount << endl;
+      std::string err("\nAllocation failed for level " + std::to_string(level) + " of the DAG node stream\n");
+      std::cerr << err;
+      throw std::out_of_range(err);
    }
-   //cout << endl;
 
-   unordered_map<void*, unsigned int>* currLevelsEmptyMap = leafEmptyCountMap;
-   unordered_map<void*, unsigned int>* prevLevelsEmptyMap = NULL;
-   // for each level above the leafs
-   for (int levelIndex = numLevels-3; levelIndex >= 0; levelIndex--)
+   nodes = (uint32_t*)grown;
+   levelOffsets[level] = numNodeWords;
+   numNodeWords += numWords;
+   for (unsigned int i = level; i < numLevels-1; i++)
    {
-      //cout << "Level " << levelIndex << endl;
-      // Update the maps releasing previous, setting previous to current, and creating a new current
-      delete prevLevelsEmptyMap;
-      prevLevelsEmptyMap = currLevelsEmptyMap;
-      currLevelsEmptyMap = new unordered_map<void*, unsigned int>;
+      levels[i] = (void*)(nodes + levelOffsets[i]);
+   }
+   return nodes + levelOffsets[level];
+}
 
-      currPtr = (uint64_t*) levels[levelIndex];
-      uint64_t* pointerToStartOfChildsLevel = (uint64_t*)levels[levelIndex+1];
+/**
+ * Returns the number of child offsets of the DAG that mirror their child, and the number of 
+ * child offsets in numChildren.
+ */
+uint64_t DAG::getNumMirroredChildren(uint64_t& numChildren)
+{
+   uint32_t mirrorMask = (1u << childMirrorBits) - 1;
+   uint64_t numMirroredChildren = 0;
 
-      // for each node at that level
-      for (unsigned int i = 0; i < newLevelSizes[levelIndex]; i++)
+   numChildren = 0;
+   for (unsigned int level = 0; level < numLevels-2; level++)
+   {
+      uint32_t* header = (uint32_t*)levels[level];
+      for (uint64_t i = 0; i < sizeAtLevel[level]; i++)
       {
-         uint64_t* maskPtr = currPtr;
-         uint64_t emptyCounts[8];
-         uint64_t emptyCountsSum = 0;
-         currPtr += 4;
-
-         // for each child node
-         for (int j = 0; j < 8; j++)
+         unsigned int numNodeChildren = getNumChildren(header);
+         for (unsigned int j = 0; j < numNodeChildren; j++)
          {
-            if (isChildSet((void*)maskPtr, j))
-            {
-               uint64_t offset = (uint64_t) *currPtr;;
-               uint64_t* childPointer = pointerToStartOfChildsLevel + offset;
-               emptyCounts[j] = prevLevelsEmptyMap->at((void*)childPointer);
-               //cout << "\t[ " <<  (void*)childPointer << " ] = " << emptyCounts[j] << endl;
-               currPtr++;
-            }
-            else
-            {
-               uint64_t emptyBranchCount = 1;
-               unsigned int power = numLevels - levelIndex - 1;
-               for (unsigned int k = 0; k < power; k++)
-               {
-                  emptyBranchCount *= 8;
-               }
-               emptyCounts[j] = emptyBranchCount;
-               //cout << "\t[                ] = " << emptyCounts[j] << endl;
-            }
-            emptyCountsSum += emptyCounts[j];
+            numMirroredChildren += (header[nodeHeaderSizes[level] + j] & mirrorMask) != 0;
          }
-
-         // Setting the empty counts next to the mask
-         
-         // Set child 0 empty count
-         uint64_t* emptyCountPtr = maskPtr; 
-         uint64_t value = 0L;
-         uint64_t toOr = emptyCounts[0] << 8;
-         value = value | toOr;
-
-         // Set child 1 empty count
-         // This overlaps 2 uint64_t's so must do extra operations to handle that
-         toOr = emptyCounts[1] << (8+33); // 8 for mask, 33 for last empty count, leaving 23 written and 10 left over
-         value = value | toOr;
-         *emptyCountPtr = *emptyCountPtr | value;
-         // cout << "\n\n0: ";
-         // printBinaryVal(*emptyCountPtr);
-         // cout << endl;
-         emptyCountPtr++;
-
-         value = 0L;
-         toOr = emptyCounts[1] >> (23); // 23 for how much was saved in last uint64_t
-         value = value | toOr;
-
-         // Set child 2 empty count
-         toOr = emptyCounts[2] << (10); // 10 for last empty count
-         value = value | toOr;
-
-         // Set child 3 empty count
-         toOr = emptyCounts[3] << (10 + 33); // 10 for the part of empty count 2, 33 for last empty count, leaving 21 written and 12 left over
-         value = value | toOr;
-         *emptyCountPtr = value;
-         // cout << "1: ";
-         // printBinaryVal(*emptyCountPtr);
-         // cout << endl;
-         emptyCountPtr++;
-
-         value = 0L;
-         toOr = emptyCounts[3] >> (21); // 21 for how much was saved in last uint64_t
-         value = value | toOr;
-
-         // Set child 4 empty count
-         // This one exactly fill the uint64_t
-         toOr = emptyCounts[4] << (12); // 12 for the part of empty count 3
-         value = value | toOr;
-
-         // Set child 5 empty count
-         toOr = emptyCounts[5] << (12 + 33); // 12 for the part of empty count 2, 33 for last empty count, leaving 19 written and 14 left over
-         value = value | toOr;
-         *emptyCountPtr = value;
-         // cout << "2: ";
-         // printBinaryVal(*emptyCountPtr);
-         // cout << endl;
-         emptyCountPtr++;
-
-         value = 0L;
-         toOr = emptyCounts[5] >> (19); // 21 for how much was saved in last uint64_t
-         value = value | toOr;
-
-         // Set child 6 empty count
-         toOr = emptyCounts[6] << (14); // 24 for last empty count
-         value = value | toOr;
-         *emptyCountPtr = value;
-         // cout << "3: ";
-         // printBinaryVal(*emptyCountPtr);
-         // cout << endl;
-
-         // cout << "\nGiven: " << endl;
-         // for (int i = 0; i < 7; ++i)
-         // {
-         //    cout << "\t[" << i << "]: " << emptyCounts[i] << " => ";
-         //    printBinaryVal(emptyCounts[i]);
-         //    cout << endl;
-         // }
-
-         //END Setting the empty counts next to the mask
-
-         //getEmptyCount((void*)maskPtr, emptyCounts);
-         //cout << endl;
-         currLevelsEmptyMap->insert( std::make_pair<void*,unsigned int>( (void*) (maskPtr), (unsigned int) emptyCountsSum ) );
+         numChildren += numNodeChildren;
+         header += nodeHeaderSizes[level] + numNodeChildren;
       }
-      //cout << endl;
    }
+   return numMirroredChildren;
+}
+
+/**
+ * Counts the filled voxels and prints the memory sizes and the time since start once all 
+ * the levels are written.
+ */
+void DAG::finishBuild(chrono::steady_clock::time_point start)
+{
+   root=levels[0];
+
    cerr << "Finished Building DAG..." << endl << endl; 
 
    // cerr << "\nUnique Nodes at Level: " << endl;
@@ -625,7 +717,7 @@ void DAG::build(const std::vector<Triangle> triangles, std::string meshFilePath)
    // }
 
    // cerr << "\nMoxel DAG Memory Size (in bytes) at Level: " << endl;
-   unsigned int totalMoxelDagMemory = 0;
+   uint64_t totalMoxelDagMemory = 0;
    for (unsigned int i = 0; i < numLevels-1; ++i)
    {
       // cerr << i << ": " << dagMemoryAlocated[i] << endl;
@@ -633,17 +725,17 @@ void DAG::build(const std::vector<Triangle> triangles, std::string meshFilePath)
    }
    // cerr << endl;
 
-   // cerr << "\nOptimized Moxel DAG Memory Size (in bytes) at Level: " << endl;
-   unsigned int totalOptMoxelDagMemory = 0;
+   // cerr << "\nFixed Header Moxel DAG Memory Size (in bytes) at Level: " << endl;
+   uint64_t totalFixedMoxelDagMemory = 0;
    for (unsigned int i = 0; i < numLevels-1; ++i)
    {
-      // cerr << i << ": " << moxelDagOptimizedMemoryAlocated[i] << endl;
-      totalOptMoxelDagMemory += moxelDagOptimizedMemoryAlocated[i];
+      // cerr << i << ": " << fixedHeaderMemoryAlocated[i] << endl;
+      totalFixedMoxelDagMemory += fixedHeaderMemoryAlocated[i];
    }
    // cerr << endl;
 
    // cerr << "\nRegular DAG Memory Size (in bytes) at Level: " << endl;
-   unsigned int totalDagMemory = 0;
+   uint64_t totalDagMemory = 0;
    for (unsigned int i = 0; i < numLevels-1; ++i)
    {
       // cerr << i << ": " << prevDagMemoryAlocated[i] << endl;
@@ -655,12 +747,34 @@ void DAG::build(const std::vector<Triangle> triangles, std::string meshFilePath)
    numFilledVoxels = getNumFilledVoxels();
    cerr << "Finished getting the number of filled leaf voxels" << endl << endl;
 
-   uint64_t materialSize = ( sizeof(float) * 3 ) + ( 1 * sizeof(unsigned int) );
-   uint64_t svoMemorySizeWithMaterials = svo.sizeWithoutMaterials + (numFilledVoxels * materialSize );
-   cout << "SVO (with materials) Memory Size: " << svoMemorySizeWithMaterials << " (" << getMemorySize(svoMemorySizeWithMaterials) << ")" << endl;
+   // The streaming builder never has the whole SVO
+   if (svo != NULL)
+   {
+      uint64_t materialSize = ( sizeof(float) * 3 ) + ( 1 * sizeof(unsigned int) );
+      uint64_t svoMemorySizeWithMaterials = svo->sizeWithoutMaterials + (numFilledVoxels * materialSize );
+      cout << "SVO (with materials) Memory Size: " << svoMemorySizeWithMaterials << " (" << getMemorySize(svoMemorySizeWithMaterials) << ")" << endl;
+   }
    cout << "Moxel DAG Memory Size: " << totalMoxelDagMemory << " (" << getMemorySize(totalMoxelDagMemory) << ")" << endl;
-   cout << "Optimized Moxel DAG Memory Size: " << totalOptMoxelDagMemory << " (" << getMemorySize(totalOptMoxelDagMemory) << ")" << endl;
+   cout << "Fixed Header Moxel DAG Memory Size: " << totalFixedMoxelDagMemory << " (" << getMemorySize(totalFixedMoxelDagMemory) << ")" << endl;
    cout << "Regular DAG Memory Size: " << totalDagMemory << " (" << getMemorySize(totalDagMemory) << ")" << endl;
+   if (childMirrorBits > 0)
+   {
+      uint64_t numChildren;
+      uint64_t numMirroredChildren = getNumMirroredChildren(numChildren);
+      cout << "Mirrored Child References: " << numMirroredChildren << " of " << numChildren << endl;
+   }
+   // Only the reduction of a whole SVO is lossy
+   if (options.isLossy() && svo != NULL)
+   {
+      uint64_t numUniqueNodes = 0;
+      for (unsigned int i = 0; i < numLevels-1; ++i)
+      {
+         numUniqueNodes += sizeAtLevel[i];
+      }
+      uint64_t numFlippedVoxels = getNumFlippedVoxels();
+      cout << "Lossy Merged Nodes: " << numLossyMergedNodes << " of " << (numUniqueNodes + numLossyMergedNodes) << " unique nodes, " << numUniqueNodes << " left" << endl;
+      cout << "Flipped Voxels: " << numFlippedVoxels << " (" << (100.0 * numFlippedVoxels / numFilledVoxels) << "% of the filled voxels)" << endl;
+   }
 
    auto end = chrono::steady_clock::now();
    auto diff = end - start;
@@ -668,24 +782,87 @@ void DAG::build(const std::vector<Triangle> triangles, std::string meshFilePath)
 }
 
 /**
- * Returns the number of filled
+ * Returns the number of filled voxels. Every unique node is counted once and the result is 
+ * reused wherever the node is shared, so it takes time proportional to the size of the DAG 
+ * rather than the volume.
  *
  * Tested: 
  */
 uint64_t DAG::getNumFilledVoxels()
 {
-   // unsigned int count = 0;
-   tbb::atomic<unsigned int> count = 0;
-   tbb::parallel_for((unsigned int)0, (unsigned int)size, [&](unsigned int i) {
-   // for (uint32_t i = 0; i < size; i++)
-   // {
-      unsigned int x, y, z;
-      mortonCodeToXYZ((uint32_t)i, &x, &y, &z, numLevels);
-      if (isSet(x,y,z))
+   unordered_map<void*, uint64_t> filledCounts;
+   return getNumFilledVoxels(levels[0], 0, filledCounts);
+}
+
+/**
+ * Returns the number of filled voxels below node, remembering the count of each node visited 
+ * in filledCounts.
+ */
+uint64_t DAG::getNumFilledVoxels(void* node, unsigned int level, unordered_map<void*, uint64_t>& filledCounts)
+{
+   if (level == numLevels-2)
+   {
+      return countSetBits(*((uint64_t*)node));
+   }
+
+   unordered_map<void*, uint64_t>::iterator found = filledCounts.find(node);
+   if (found != filledCounts.end())
+   {
+      return found->second;
+   }
+
+   uint64_t count = 0;
+   for (unsigned int i = 0; i < 8; i++)
+   {
+      if (isChildSet(node, i))
       {
-         count++;
+         count += getNumFilledVoxels(getChildPointer(node, i, level), level+1, filledCounts);
       }
-   });
+   }
+   filledCounts.insert(std::make_pair(node, count));
+   return count;
+}
+
+/**
+ * Returns the number of voxels that differ between the SVO and the DAG reduced from it, 
+ * which is 0 unless the reduction was lossy.
+ */
+uint64_t DAG::getNumFlippedVoxels()
+{
+   unordered_map<void*, uint64_t> filledCounts;
+   return getNumFlippedVoxels(0, 0, levels[0], 0, filledCounts);
+}
+
+/**
+ * Returns the number of voxels that differ between the SVO node at svoIndex of level and 
+ * node seen through mirror, NULL for an empty node. Where only the DAG has a child all of 
+ * its voxels differ.
+ */
+uint64_t DAG::getNumFlippedVoxels(unsigned int level, uint64_t svoIndex, void* node, unsigned int mirror, unordered_map<void*, uint64_t>& filledCounts)
+{
+   if (level == numLevels-2)
+   {
+      uint64_t svoLeaf = ((uint64_t*)svo->levels[level])[svoIndex];
+      uint64_t leaf = (node != NULL) ? mirrorLeaf(*((uint64_t*)node), mirror) : 0;
+      return countSetBits(svoLeaf ^ leaf);
+   }
+
+   const SVONode& svoNode = ((SVONode*)svo->levels[level])[svoIndex];
+   uint64_t count = 0;
+   for (unsigned int i = 0; i < 8; i++)
+   {
+      bool isDAGChildSet = (node != NULL) && isChildSet(node, i ^ mirror);
+      unsigned int childMirror = mirror;
+      void* child = isDAGChildSet ? getChildPointer(node, i ^ mirror, level, childMirror) : NULL;
+      if (svoNode.isChildSet(i))
+      {
+         count += getNumFlippedVoxels(level+1, svoNode.getChildIndex(i), child, childMirror, filledCounts);
+      }
+      else if (isDAGChildSet)
+      {
+         count += getNumFilledVoxels(child, level+1, filledCounts);
+      }
+   }
    return count;
 }
 
@@ -791,56 +968,201 @@ uint64_t DAG::getNumFilledVoxels()
 //    }
 // }
 
+/**
+ * Builds the moxel table by walking the DAG depth first in Morton order. The filled voxels come 
+ * out in the same order as the sorted voxel triangle index, so each voxel's triangle is found 
+ * by advancing through the index instead of looking it up.
+ */
 void DAG::buildMoxelTable(const std::vector<Triangle> triangles)
 {
    auto start = chrono::steady_clock::now();
-   unsigned int moxelTableAllocSize = ((sizeof(float) * 3) + (sizeof(unsigned int) * 1)) * numFilledVoxels; // Only space for normals and material index
+   uint64_t moxelTableAllocSize = MOXEL_SIZE * numFilledVoxels; // Only space for normals and material index
    moxelTable = (void*) malloc(moxelTableAllocSize);
-   unsigned int x, y, z;
-   glm::vec3 boundingBoxMins(boundingBox.mins.x, boundingBoxMins.y, boundingBoxMins.z);
-   float halfVoxelWidth = 0.5f * voxelWidth;
-   float voxelRadius = sqrtf(2.0f) * halfVoxelWidth; // Length from center of voxel to any corner
-   float epsilon = voxelRadius * 0.001f;
-   float voxelRadiusPlusEpsilon = voxelRadius + epsilon;
-   void* moxelTablePointer = moxelTable;
-   unsigned int moxelIndex = 0;
+   uint64_t pairIndex = 0;
+   uint64_t moxelIndex = 0;
+   uint64_t numMissing = 0;
+   uint64_t numInterior = 0;
 
    cout << "Moxel Table Size: " << moxelTableAllocSize << " (" << getMemorySize(moxelTableAllocSize) << ")" << endl;
 
    //boundingBox.print();
    cerr << "Creating moxel table for size " << size <<  "..." << endl;
 
-   for (uint32_t i = 0; i < size; i++)
-   {
-      mortonCodeToXYZ((uint32_t)i, &x, &y, &z, numLevels);
-      if (isSet(x,y,z))
-      {  
-         unsigned int triangleIndex = voxelTriangleIndexMap->at(i);
-         Triangle triangle = triangles[triangleIndex];
+   buildMoxelTable(triangles, levels[0], 0, 0, 0, pairIndex, moxelIndex, numMissing, numInterior);
+
+   if (options.solid && voxelSource == NULL)
+   {
+      // Only the surface voxels were filled by a triangle
+      cout << "Interior Moxels (no normal): " << numInterior << endl;
+   }
+   if (options.isLossy())
+   {
+      // Voxels filled by merging a node into a close one
+      cout << "Lossy Moxels (normal of the next voxel): " << numMissing << endl;
+   }
+   else if (numMissing > 0)
+   {
+      cerr << "### ERROR: Could not find a triangle for " << numMissing << " filled voxels" << endl;
+   }
+   cerr << "Finished Creating moxel table" << endl;
+
+   auto end = chrono::steady_clock::now();
+   auto diff = end - start;
+   cout << "\t\tTime Moxel Table Building: " << chrono::duration <double, milli> (diff).count() << " ms" << endl;
+}
+
+/**
+ * Adds the moxel table entries of every filled voxel below node, seen through mirror, whose 
+ * first voxel has the given Morton code.
+ */
+void DAG::buildMoxelTable(const std::vector<Triangle>& triangles, void* node, unsigned int level, unsigned int mirror, uint64_t mortonIndex, uint64_t& pairIndex, uint64_t& moxelIndex, uint64_t& numMissing, uint64_t& numInterior)
+{
+   if (level == numLevels-2)
+   {
+      uint64_t leaf = mirrorLeaf(*((uint64_t*)node), mirror);
+      while (leaf)
+      {
+         unsigned int i = __builtin_ctzll(leaf);
+         leaf &= leaf - 1;
+         addMoxel(triangles, mortonIndex + i, pairIndex, moxelIndex, numMissing, numInterior);
+      }
+      return;
+   }
+
+   for (unsigned int i = 0; i < 8; i++)
+   {
+      if (isChildSet(node, i ^ mirror))
+      {
+         unsigned int childMirror = mirror;
+         void* child = getChildPointer(node, i ^ mirror, level, childMirror);
+         buildMoxelTable(triangles, child, level+1, childMirror, mortonIndex + getLevelIndexSum(level, i), pairIndex, moxelIndex, numMissing, numInterior);
+      }
+   }
+}
+
+/**
+ * Writes the moxel table entry of one filled voxel. Voxels are visited in increasing Morton 
+ * order, so the voxel triangle index only ever moves forward. A voxel no triangle filled, 
+ * inside a solid mesh, gets a zero normal and material 0 and is counted in numInterior, the 
+ * other voxels without a triangle in numMissing. One filled by a lossy merge takes the 
+ * triangle of the next surface voxel instead. Voxels of a source take the gradient of its 
+ * distance as the normal.
+ */
+void DAG::addMoxel(const std::vector<Triangle>& triangles, uint64_t mortonIndex, uint64_t& pairIndex, uint64_t& moxelIndex, uint64_t& numMissing, uint64_t& numInterior)
+{
+   const VoxelTrianglePair* pairs = voxelTriangleIndex->pairs;
+   uint64_t numPairs = voxelTriangleIndex->numPairs;
+   glm::vec3 normal(0.0f, 0.0f, 0.0f);
+   unsigned int materialIndex = 0;
+
+   while (pairIndex < numPairs && pairs[pairIndex].mortonIndex < mortonIndex)
+   {
+      pairIndex++;
+   }
+
+   if (voxelSource != NULL)
+   {
+      unsigned int x, y, z;
+      mortonCodeToXYZ(mortonIndex, &x, &y, &z, numLevels);
+      Vec3 center(boundingBox.mins.x + ((x + 0.5f) * voxelWidth),
+       boundingBox.mins.y + ((y + 0.5f) * voxelWidth),
+       boundingBox.mins.z + ((z + 0.5f) * voxelWidth));
+      Vec3 sourceNormal = voxelSource->getNormal(center, 0.5f * voxelWidth);
+
+      normal = glm::vec3(sourceNormal.x, sourceNormal.y, sourceNormal.z);
+      materialIndex = voxelSource->getMaterialIndex(center);
+   }
+   else
+   {
+      const VoxelTrianglePair* pair = NULL;
+      if (pairIndex < numPairs && pairs[pairIndex].mortonIndex == mortonIndex)
+      {
+         pair = &pairs[pairIndex];
+      }
+      else if (options.solid && isInteriorVoxel(triangles, mortonIndex, pairIndex))
+      {
+         numInterior++;
+      }
+      else
+      {
+         numMissing++;
+         if (options.isLossy() && !options.solid && numPairs > 0)
+         {
+            pair = &pairs[std::min(pairIndex, numPairs-1)];
+         }
+      }
+
+      if (pair != NULL)
+      {
+         const Triangle& triangle = triangles[pair->triangleIndex];
          glm::vec3 v0(triangle.v0.x,triangle.v0.y,triangle.v0.z);
          glm::vec3 v1(triangle.v1.x,triangle.v1.y,triangle.v1.z);
          glm::vec3 v2(triangle.v2.x,triangle.v2.y,triangle.v2.z);
 
          // Calculate the normal of the triangle
-         glm::vec3 normal = glm::normalize( glm::cross(v1-v0, v2-v0) );
-
-         *((float*)moxelTablePointer) = (float) normal.x;
-         moxelTablePointer += sizeof(float);
-         *((float*)moxelTablePointer) = (float) normal.y;
-         moxelTablePointer += sizeof(float);
-         *((float*)moxelTablePointer) = (float) normal.z;
-         moxelTablePointer += sizeof(float);
-         *((unsigned int *)moxelTablePointer) = (unsigned int) triangle.materialIndex;
-         moxelTablePointer += sizeof(unsigned int);
-
-         moxelIndex++;
+         normal = glm::normalize( glm::cross(v1-v0, v2-v0) );
+         materialIndex = triangle.materialIndex;
       }
    }
-   cerr << "Finished Creating moxel table" << endl;
 
-   auto end = chrono::steady_clock::now();
-   auto diff = end - start;
-   cout << "\t\tTime Moxel Table Building: " << chrono::duration <double, milli> (diff).count() << " ms" << endl;
+   char* moxelTablePointer = (char*)moxelTable + (moxelIndex * ((sizeof(float) * 3) + sizeof(unsigned int)));
+   *((float*)moxelTablePointer) = (float) normal.x;
+   moxelTablePointer += sizeof(float);
+   *((float*)moxelTablePointer) = (float) normal.y;
+   moxelTablePointer += sizeof(float);
+   *((float*)moxelTablePointer) = (float) normal.z;
+   moxelTablePointer += sizeof(float);
+   *((unsigned int *)moxelTablePointer) = materialIndex;
+
+   moxelIndex++;
+}
+
+/**
+ * Returns true if a filled voxel without a triangle is inside the solid mesh, false if it is a 
+ * surface voxel whose triangle is missing. A triangle that fills a voxel is recorded for the 
+ * other voxels it overlaps too, so the triangles recorded in the voxel's leaf block, which are 
+ * the pairs just before and after pairIndex, are tested against the voxel. An interior voxel 
+ * overlaps none of them.
+ */
+bool DAG::isInteriorVoxel(const std::vector<Triangle>& triangles, uint64_t mortonIndex, uint64_t pairIndex)
+{
+   const VoxelTrianglePair* pairs = voxelTriangleIndex->pairs;
+   uint64_t numPairs = voxelTriangleIndex->numPairs;
+   uint64_t blockStart = mortonIndex & ~(uint64_t)63;
+   uint64_t blockEnd = blockStart + 64;
+   uint64_t first = pairIndex;
+   uint64_t last = pairIndex;
+
+   while (first > 0 && pairs[first-1].mortonIndex >= blockStart)
+   {
+      first--;
+   }
+   while (last < numPairs && pairs[last].mortonIndex < blockEnd)
+   {
+      last++;
+   }
+
+   unsigned int x, y, z;
+   mortonCodeToXYZ(mortonIndex, &x, &y, &z, numLevels);
+   Vec3 p(boundingBox.mins.x + (x * voxelWidth), boundingBox.mins.y + (y * voxelWidth), 0.0f);
+   Vec3 deltaP(voxelWidth, voxelWidth, voxelWidth);
+
+   // Test the voxel the same way the voxelizer does, only within the triangle's voxel range
+   for (uint64_t i = first; i < last; i++)
+   {
+      const Triangle& triangle = triangles[pairs[i].triangleIndex];
+      Vec3 triMins(triangle.getMins());
+      Vec3 triMaxs(triangle.getMaxs());
+      bool isInRange = x >= (unsigned int)((triMins.x - boundingBox.mins.x) / voxelWidth) && x <= (unsigned int)((triMaxs.x - boundingBox.mins.x + 0.5) / voxelWidth) &&
+       y >= (unsigned int)((triMins.y - boundingBox.mins.y) / voxelWidth) && y <= (unsigned int)((triMaxs.y - boundingBox.mins.y + 0.5) / voxelWidth) &&
+       z >= (unsigned int)((triMins.z - boundingBox.mins.z) / voxelWidth) && z <= (unsigned int)((triMaxs.z - boundingBox.mins.z + 0.5) / voxelWidth);
+
+      if (isInRange && triangleAABBIntersectRow(TriangleAABBSetup(triangle, deltaP), p, 2, boundingBox.mins.z, voxelWidth, z, 1))
+      {
+         return false;
+      }
+   }
+   return true;
 }
 
 
@@ -853,27 +1175,12 @@ void DAG::buildMoxelTable(const std::vector<Triangle> triangles)
  */
 bool DAG::isSetSVO(unsigned int x, unsigned int y, unsigned int z)
 {
-   void* currentNode = svoRoot;
-   int currentLevel = numLevels;
-   unsigned int mortonIndex = mortonCode(x,y,z,currentLevel);
-   
-   int divBy = pow(8.0f, (float)currentLevel-1);
-   int modBy = divBy;
-   int index = mortonIndex / divBy;
-   
-   while (divBy >= 64)
+   // A streamed DAG has no SVO to look in
+   if (svo == NULL)
    {
-      if (!isSVOChildSet((SVONode*)currentNode, index)) 
-      {
-         return false;
-      }
-      currentNode = (void*) ((SVONode*)currentNode)->childPointers[index];
-      modBy = divBy;
-      divBy /= 8;
-      index = (mortonIndex % modBy) / divBy;
+      return false;
    }
-   index = mortonIndex % modBy;
-   return isLeafSet((uint64_t*)currentNode, index);
+   return svo->isSet(x, y, z);
 }
 
 /**
@@ -883,42 +1190,116 @@ bool DAG::isSetSVO(unsigned int x, unsigned int y, unsigned int z)
  */
 bool DAG::isSVOChildSet(SVONode *node, unsigned int i)
 {
-   return node->childPointers[i] != NULL;
+   return node->isChildSet(i);
 }
 
+/**
+ * Returns whether the voxel at the given coordinate is set. Below a mirrored child the 
+ * coordinate is mirrored the same way before it is looked up.
+ */
 bool DAG::isSet(unsigned int x, unsigned int y, unsigned int z)
 {
    void* currentNode = levels[0];
-   int currentLevel = 0;
-   unsigned int mortonIndex = mortonCode(x,y,z,numLevels);
-   
-   int divBy = pow(8, numLevels-1);
-   int modBy = divBy;
-   int index = mortonIndex / divBy;
-   
-   while (divBy >= 64)
+   uint64_t mortonIndex = mortonCode(x,y,z,numLevels);
+   unsigned int mirror = 0;
+
+   for (unsigned int level = 0; level < numLevels-2; level++)
    {
+      unsigned int index = ((mortonIndex >> (3 * (numLevels-level-1))) & 7) ^ mirror;
       if (!isChildSet(currentNode, index)) 
       {
          return false;
       }
-      currentNode = (void*) getChildPointer(currentNode, index, currentLevel);
-      modBy = divBy;
-      divBy /= 8;
-      index = (mortonIndex % modBy) / divBy;
-      currentLevel++;
+      currentNode = getChildPointer(currentNode, index, level, mirror);
+   }
+   return isLeafSet((uint64_t*)currentNode, (mortonIndex % 64) ^ getLeafIndexMirror(mirror));
+}
+
+/**
+ * Finds the moxel table index of the voxel at the given coordinate by summing the filled 
+ * voxels before it on the way down, the same way intersect does. Returns false if the voxel 
+ * is empty.
+ */
+bool DAG::getMoxelIndex(unsigned int x, unsigned int y, unsigned int z, uint64_t& moxelIndex)
+{
+   if (childMirrorBits > 0)
+   {
+      return getMirroredMoxelIndex(x, y, z, moxelIndex);
+   }
+
+   void* currentNode = levels[0];
+   uint64_t mortonIndex = mortonCode(x,y,z,numLevels);
+
+   moxelIndex = 0;
+   for (unsigned int level = 0; level < numLevels-2; level++)
+   {
+      unsigned int index = (mortonIndex >> (3 * (numLevels-level-1))) & 7;
+      if (!isChildSet(currentNode, index))
+      {
+         return false;
+      }
+      moxelIndex += getFilledPrefix(currentNode, level, index);
+      currentNode = getChildPointer(currentNode, index, level);
    }
-   index = mortonIndex % modBy;
+
+   unsigned int index = mortonIndex % 64;
+   moxelIndex += getLeafFilledPrefix(*((uint64_t*)currentNode), index);
    return isLeafSet((uint64_t*)currentNode, index);
 }
 
+/**
+ * getMoxelIndex of a mirror reduced DAG. The filled voxels of each node on the way down are 
+ * followed as well, getMirroredFilledPrefix needs them once the node is mirrored.
+ */
+bool DAG::getMirroredMoxelIndex(unsigned int x, unsigned int y, unsigned int z, uint64_t& moxelIndex)
+{
+   void* currentNode = levels[0];
+   uint64_t mortonIndex = mortonCode(x,y,z,numLevels);
+   unsigned int mirror = 0;
+   uint64_t filledCount = numFilledVoxels;
+
+   moxelIndex = 0;
+   for (unsigned int level = 0; level < numLevels-2; level++)
+   {
+      unsigned int index = (mortonIndex >> (3 * (numLevels-level-1))) & 7;
+      if (!isChildSet(currentNode, index ^ mirror))
+      {
+         return false;
+      }
+      moxelIndex += getMirroredFilledPrefix(currentNode, level, index, mirror, filledCount);
+      currentNode = getChildPointer(currentNode, index ^ mirror, level, mirror);
+   }
+
+   uint64_t leaf = mirrorLeaf(*((uint64_t*)currentNode), mirror);
+   unsigned int index = mortonIndex % 64;
+   moxelIndex += getLeafFilledPrefix(leaf, index);
+   return isLeafSet(&leaf, index);
+}
 
+/**
+ * Returns the child at index of a node at level. The offsets of the set children follow the 
+ * header (mask + space for filled prefixes), so the child's is after those of the set 
+ * children below it.
+ */
 void* DAG::getChildPointer(void* node, unsigned int index, unsigned int level)
 {
-   uint64_t** pointer = (uint64_t**)node;
+   uint32_t* header = (uint32_t*)node;
+   uint64_t offset = header[nodeHeaderSizes[level] + getChildSlot(node, index)] >> childMirrorBits;
+
+   if (level+1 == numLevels-2)
+   {
+      return (void*) (((uint64_t*)levels[level+1]) + offset);
+   }
+   return (void*) (((uint32_t*)levels[level+1]) + offset);
+}
 
-   // Move 4 x 64bit sections down to get to where the child pointers should be (mask + space for empty count = 3x64bits)
-   pointer+=4;
+/**
+ * getChildPointer that finds the child's slot by testing every lower child bit by bit, 
+ * O(index). Kept as the reference for the benchmark.
+ */
+void* DAG::getChildPointerLoop(void* node, unsigned int index, unsigned int level)
+{
+   uint32_t* pointer = (uint32_t*)node + nodeHeaderSizes[level];
    for (unsigned int i = 0; i < index; i++)
    {
       if (isChildSet(node, i))
@@ -926,14 +1307,31 @@ void* DAG::getChildPointer(void* node, unsigned int index, unsigned int level)
          pointer++;
       }
    }
+   uint64_t offset = *pointer >> childMirrorBits;
+
+   if (level+1 == numLevels-2)
+   {
+      return (void*) (((uint64_t*)levels[level+1]) + offset);
+   }
+   return (void*) (((uint32_t*)levels[level+1]) + offset);
+}
 
-   //cout << "Getting childpointer " << index << " for node " << node << " = " << *pointer << endl;
+/**
+ * Returns the child at index of a node at level like getChildPointer, and adds the mirror the 
+ * child is seen through to mirror. Mirrors combine by xor.
+ */
+void* DAG::getChildPointer(void* node, unsigned int index, unsigned int level, unsigned int& mirror)
+{
+   uint32_t* header = (uint32_t*)node;
+   uint32_t childWord = header[nodeHeaderSizes[level] + getChildSlot(node, index)];
+   uint64_t offset = childWord >> childMirrorBits;
 
-   //*** Update to calculate based on offset
-   uint64_t offset = (uint64_t) *pointer;
-   uint64_t* pointerToStartOfChildsLevel = (uint64_t*)levels[level+1];
-   return (void*) (pointerToStartOfChildsLevel + offset);
-   //return *pointer;  
+   mirror ^= childWord & ((1u << childMirrorBits) - 1);
+   if (level+1 == numLevels-2)
+   {
+      return (void*) (((uint64_t*)levels[level+1]) + offset);
+   }
+   return (void*) (((uint32_t*)levels[level+1]) + offset);
 }
 
 
@@ -942,31 +1340,29 @@ void DAG::printLevels()
    void* node;
    void** pointer;
 
-   // levels above the leafs
+   // levels above the leafs, each node's header followed by the offsets of its set children
    cout << "DAG:" << endl;
    unsigned int levelIndex;
    for (levelIndex = 0; levelIndex < numLevels-2; levelIndex++)
    {
-      node = levels[levelIndex];
-      pointer = (void**)node;
+      uint32_t* header = (uint32_t*)levels[levelIndex];
       cout << "Level " << levelIndex << ":" << endl;
 
-      for (unsigned int i = 0; i < sizeAtLevel[levelIndex]; ++i)
+      for (uint64_t i = 0; i < sizeAtLevel[levelIndex]; ++i)
       {
+         node = (void*)header;
          cout << i << ": " << node << " (";
          printMask(node);
          cout << "): ";
-         for (unsigned int i = 0; i < 8; i++)
+         for (unsigned int j = 0; j < 8; j++)
          {
-            if (isChildSet(node, i))
+            if (isChildSet(node, j))
             {
-               pointer++;
-               cout << *pointer << " ";
+               cout << header[nodeHeaderSizes[levelIndex] + getChildSlot(node, j)] << " ";
             }
          }
          cout << endl;
-         pointer++;
-         node = (void*)pointer;
+         header += nodeHeaderSizes[levelIndex] + getNumChildren(node);
       }
       cout << endl;
    }
@@ -976,7 +1372,7 @@ void DAG::printLevels()
    pointer = (void**)node;
    cout << "Level " << levelIndex << ":" << endl;
 
-   for (unsigned int i = 0; i < sizeAtLevel[levelIndex]; ++i)
+   for (uint64_t i = 0; i < sizeAtLevel[levelIndex]; ++i)
    {
       cout << i << ": " << node << " = " << *((uint64_t*)pointer);
       cout << endl;
@@ -995,17 +1391,17 @@ void DAG::printSVOLevels()
    for (levelIndex = 0; levelIndex < numLevels-2; levelIndex++)
    {
       cout << "Level " << levelIndex << ":" << endl;
-      nodes = (SVONode*) newLevels[levelIndex];
-      for (unsigned int i = 0; i < sizeAtLevel[levelIndex]; i++)
+      nodes = (SVONode*) svo->levels[levelIndex];
+      for (uint64_t i = 0; i < svo->levelSizes[levelIndex]; i++)
       {
-         cout << i << ": " << &nodes[i] << " (";
+         cout << i << ": (";
          printSVOMask(&nodes[i]);
          cout << "): ";
          for (unsigned int j = 0; j < 8; j++)
          {
             if (isSVOChildSet(&nodes[i], j))
             {
-               cout << nodes[i].childPointers[j] << " ";
+               cout << nodes[i].getChildIndex(j) << " ";
             }
          }
          cout << endl;
@@ -1014,10 +1410,10 @@ void DAG::printSVOLevels()
    }
 
    cout << "Level " << levelIndex << ":" << endl;
-   uint64_t* leafs = (uint64_t*)newLevels[levelIndex];
-   for (unsigned int i = 0; i < sizeAtLevel[levelIndex]; i++)
+   uint64_t* leafs = (uint64_t*)svo->levels[levelIndex];
+   for (uint64_t i = 0; i < svo->levelSizes[levelIndex]; i++)
    {
-      cout << i << ": " << &leafs[i] << " = " << leafs[i] << endl;
+      cout << i << ": " << leafs[i] << endl;
    }
 }
 
@@ -1025,7 +1421,7 @@ void DAG::printSVOLevels()
 
 void DAG::printMask(void* node)
 {
-   uint64_t mask = *((uint64_t*)node);
+   uint32_t mask = *((uint32_t*)node);
    for (unsigned int i = 0; i < 8; i++)
    {
       if (isChildSet(node,i))
@@ -1078,10 +1474,8 @@ bool DAG::isLeafSet(uint64_t* node, unsigned int i)
  */
 bool DAG::isChildSet(void* node, unsigned int i)
 {
-   uint64_t toAnd = 1L << i;
-   uint64_t mask = *((uint64_t*) node);
-   //cout << "\t\t(" << mask <<  " & " << toAnd << ") = " << (mask | toAnd) << endl;
-   return (mask & toAnd) != 0;
+   uint32_t mask = *((uint32_t*) node);
+   return (mask & (1u << i)) != 0;
 }
 
 
@@ -1147,15 +1541,7 @@ void DAG::writeSVOImages()
 
 unsigned int DAG::getNumChildren(void* node)
 {
-   uint64_t mask = *((uint64_t*)node);
-   unsigned int count = 0;
-   for (int i = 0; i < 8; ++i)
-   {
-      uint64_t toOr = 1 << i;
-      if (toOr | mask)
-         count++;
-   }
-   return count;
+   return countSetBits(*((uint32_t*)node) & SET_8_BITS);
 }
 
 
@@ -1166,148 +1552,120 @@ unsigned int DAG::getNumChildren(void* node)
  */
 uint64_t DAG::getNumEmptyLeafNodes(uint64_t leafNode)
 {
-   uint64_t count = 0;
-   for (int i = 0; i < 64; i++)
-   {
-      uint64_t toAnd = 1L << i;
-      if (toAnd & leafNode)
-      {
-         count++;
-      }
-   }
-   
-   return 64 - count;
+   return 64 - countSetBits(leafNode);
 }
 
 /**
- * Returns the number of empty leaf nodes
- *
- * Tested: 
+ * Returns the number of filled voxels below the children of the node before the child at 
+ * index, which is stored as is: one field at a fixed place. The field is read with one 
+ * unaligned 64 bit load, and a third uint32_t when it straddles past it. A load can reach 
+ * one uint32_t past the header, which is always the node's first child offset.
  */
-uint64_t DAG::getEmptyCount(void* node, unsigned int index)
+uint64_t DAG::getFilledPrefix(void* node, unsigned int level, unsigned int index)
 {
-   uint64_t *emptyCountPtr = (uint64_t*)node;
-   uint64_t emptyCounts[7];
-   uint64_t mask33 = 8589934591L;
-   uint64_t mask23 = 8388607L;
-   uint64_t mask10 = 1023L;
-   uint64_t mask21 = 2097151L;
-   uint64_t mask12 = 4095L;
-   uint64_t mask19 = 524287L;
-   uint64_t mask14 = 16383L;
-   uint64_t value;
-   uint64_t sum = 0;
-
-   for (int i = 0; i < 7; ++i)
+   if (index == 0)
    {
-      emptyCounts[i] = 0L;
+      return 0;
    }
 
-   // Get empty count 0
-   value = *emptyCountPtr;
-   emptyCounts[0] = mask33 & (value >> 8);
-
-   // Get empty count 1
-   emptyCounts[1] = mask23 & (value >> (8 + 33));
-   emptyCountPtr++;
-   value = *emptyCountPtr;
-   emptyCounts[1] = emptyCounts[1] | ((value & mask10) << 23);
-
-   // Get empty count 2
-   emptyCounts[2] = mask33 & (value >> (10));
-
-   // Get empty count 3
-   emptyCounts[3] = mask21 & (value >> (10 + 33));
-   emptyCountPtr++;
-   value = *emptyCountPtr;
-   emptyCounts[3] = emptyCounts[3] | ((value & mask12) << 21);
-
-   // Get empty count 4
-   emptyCounts[4] = mask33 & (value >> (12));
-
-   // Get empty count 5
-   emptyCounts[5] = mask19 & (value >> (12 + 33));
-   emptyCountPtr++;
-   value = *emptyCountPtr;
-   emptyCounts[5] = emptyCounts[5] | ((value & mask14) << 19);
-
-   // Get empty count 6
-   emptyCounts[6] = mask33 & (value >> (14));
-
-   // cout << "Found: " << endl;
-   // for (int i = 0; i < 7; ++i)
-   // {
-   //    cout << "\t[" << i << "]: " << emptyCounts[i] << " => ";
-   //    printBinaryVal(emptyCounts[i]);
-   //    cout << endl;
-   // }
-   // cout << endl;
-
-   for (int i = 0; i < index; ++i)
+   uint32_t* header = (uint32_t*)node;
+   unsigned int bits = filledPrefixBits[level];
+   unsigned int bit = 8 + ((index - 1) * bits);
+   unsigned int word = bit / 32;
+   unsigned int shift = bit % 32;
+   uint64_t value;
+   memcpy(&value, header + word, sizeof(uint64_t));
+   value >>= shift;
+   if (shift + bits > 64)
    {
-      sum += emptyCounts[i];
+      value |= (uint64_t)header[word+2] << (64 - shift);
    }
-   
-   return sum;
+   return value & (((uint64_t)1 << bits) - 1);
 }
 
-void DAG::getEmptyCount(void* node, uint64_t* expected)
+/**
+ * Returns the number of filled voxels before the child at index of a node seen through 
+ * mirror, and moves filledCount from the filled voxels of the node to those of that child. 
+ * The prefixes are stored in the order of the node's own children, which a mirror shuffles. 
+ * The children before index are made of up to 3 aligned blocks (4, 2 and 1 wide for the set 
+ * bits of index), though, and a mirror moves an aligned block onto another one, so each 
+ * block's filled voxels are the difference of two stored prefixes.
+ */
+uint64_t DAG::getMirroredFilledPrefix(void* node, unsigned int level, unsigned int index, unsigned int mirror, uint64_t& filledCount)
 {
-   uint64_t *emptyCountPtr = (uint64_t*)node;
-   uint64_t emptyCounts[7];
-   uint64_t mask33 = 8589934591L;
-   uint64_t mask23 = 8388607L;
-   uint64_t mask10 = 1023L;
-   uint64_t mask21 = 2097151L;
-   uint64_t mask12 = 4095L;
-   uint64_t mask19 = 524287L;
-   uint64_t mask14 = 16383L;
-   uint64_t value;
-   uint64_t sum = 0;
-
-   for (int i = 0; i < 7; ++i)
+   // The filled voxels before stored child i, all of them for i = 8
+   auto getPrefix = [&](unsigned int i) {
+      return (i == 8) ? filledCount : getFilledPrefix(node, level, i);
+   };
+   unsigned int storedIndex = index ^ mirror;
+   uint64_t prefix = 0;
+
+   if (mirror == 0)
    {
-      emptyCounts[i] = 0L;
+      prefix = getPrefix(index);
    }
+   else
+   {
+      for (unsigned int bit = 0; bit < 3; bit++)
+      {
+         if (index & (1u << bit))
+         {
+            unsigned int blockSize = 1u << bit;
+            unsigned int blockStart = ((index & ~(2*blockSize - 1)) ^ mirror) & ~(blockSize - 1);
+            prefix += getPrefix(blockStart + blockSize) - getPrefix(blockStart);
+         }
+      }
+   }
+   filledCount = getPrefix(storedIndex + 1) - getPrefix(storedIndex);
+   return prefix;
+}
 
-   // Get empty count 0
-   value = *emptyCountPtr;
-   emptyCounts[0] = mask33 & (value >> 8);
-
-   // Get empty count 1
-   emptyCounts[1] = mask23 & (value >> (8 + 33));
-   emptyCountPtr++;
-   value = *emptyCountPtr;
-   emptyCounts[1] = emptyCounts[1] | ((value & mask10) << 23);
-
-   // Get empty count 2
-   emptyCounts[2] = mask33 & (value >> (10));
-
-   // Get empty count 3
-   emptyCounts[3] = mask21 & (value >> (10 + 33));
-   emptyCountPtr++;
-   value = *emptyCountPtr;
-   emptyCounts[3] = emptyCounts[3] | ((value & mask12) << 21);
-
-   // Get empty count 4
-   emptyCounts[4] = mask33 & (value >> (12));
+/**
+ * Packs the filled voxels before each of the children 1 to 7, from the filled voxels of each 
+ * child, into the header after the mask, which is left as it is. Each prefix is 
+ * filledPrefixBits[level] wide.
+ */
+void DAG::setFilledPrefixes(void* node, unsigned int level, const uint64_t* filledCounts)
+{
+   uint32_t* header = (uint32_t*)node;
+   unsigned int bits = filledPrefixBits[level];
+   uint64_t prefix = 0;
 
-   // Get empty count 5
-   emptyCounts[5] = mask19 & (value >> (12 + 33));
-   emptyCountPtr++;
-   value = *emptyCountPtr;
-   emptyCounts[5] = emptyCounts[5] | ((value & mask14) << 19);
+   header[0] &= SET_8_BITS;
+   for (unsigned int i = 1; i < nodeHeaderSizes[level]; ++i)
+   {
+      header[i] = 0;
+   }
 
-   // Get empty count 6
-   emptyCounts[6] = mask33 & (value >> (14));
+   for (unsigned int i = 0; i < NUM_FILLED_PREFIXES; ++i)
+   {
+      unsigned int bit = 8 + (i * bits);
+      unsigned int word = bit / 32;
+      unsigned int shift = bit % 32;
+      prefix += filledCounts[i];
+      uint64_t shifted = prefix << shift;
+      header[word] |= (uint32_t)shifted;
+      if (shift + bits > 32)
+      {
+         header[word+1] |= (uint32_t)(shifted >> 32);
+      }
+      if (shift + bits > 64)
+      {
+         header[word+2] |= (uint32_t)(prefix >> (64 - shift));
+      }
+   }
+}
 
+void DAG::printFilledPrefixes(void* node, unsigned int level, uint64_t* expected)
+{
    cout << "Found: " << endl;
-   for (int i = 0; i < 7; ++i)
+   for (unsigned int i = 0; i < 8; ++i)
    {
-      cout << "\t[" << i << "]: " << emptyCounts[i] << " => ";
-      printBinaryVal(emptyCounts[i]);
+      uint64_t prefix = getFilledPrefix(node, level, i);
+      cout << "\t[" << i << "]: " << prefix << " => ";
+      printBinaryVal(prefix);
       
-      if (emptyCounts[i] != expected[i])
+      if (prefix != expected[i])
       {
          cout << " ERROR ";
       }
@@ -1324,31 +1682,23 @@ void DAG::getEmptyCount(void* node, uint64_t* expected)
  */
 uint64_t DAG::getLeafNodeEmptyCount(uint64_t leafNode, unsigned int index)
 {
-   uint64_t count = 0;
-   for (int i = 0; i < index; i++)
-   {
-      uint64_t toAnd = 1L << i;
-      if (!(toAnd & leafNode))
-      {
-         count++;
-      }
-   }
-   
-   return count;
+   return index - countSetBitsBelow(leafNode, index);
 }
 
-uint64_t DAG::getLevelIndexSum(unsigned int level, unsigned int index)
+/**
+ * Returns the number of filled voxels in the leaf before the voxel at index.
+ */
+uint64_t DAG::getLeafFilledPrefix(uint64_t leafNode, unsigned int index)
 {
-   uint64_t sum = 0;
-   uint64_t perChild = 1;
-
-   for (unsigned int i = 0; i < (numLevels - level - 1); i++)
-   {
-      perChild *= 8;
-   }
-   sum = perChild * index;
+   return countSetBitsBelow(leafNode, index);
+}
 
-   return sum;
+/**
+ * Returns the number of voxels in the children of a node at level before the child at index.
+ */
+uint64_t DAG::getLevelIndexSum(unsigned int level, unsigned int index)
+{
+   return (uint64_t)index << (3 * (numLevels - level - 1));
 }
 
 
@@ -1363,16 +1713,17 @@ bool DAG::intersect(const Ray& ray, float& t, glm::vec3& normal, uint64_t& moxel
    glm::vec3 mins(boundingBox.mins.x, boundingBox.mins.y, boundingBox.mins.z);
    glm::vec3 maxs(boundingBox.maxs.x, boundingBox.maxs.y, boundingBox.maxs.z);
    AABB aabb(mins, maxs);
-   return intersect(ray, t, root, 0, aabb, normal, moxelIndex);
+   return intersect(ray, t, root, 0, 0, numFilledVoxels, aabb, normal, moxelIndex);
 }
 
 /**
  * Resursive intersection method that returns whether the ray provided intersects the DAG and t the
- * distance along the ray.
+ * distance along the ray. The node is seen through mirror and has filledCount filled voxels, 
+ * which is only needed to find the moxel index below a mirrored child.
  *
  * Tested: 
  */
-bool DAG::intersect(const Ray& ray, float& t, void* node, unsigned int level, AABB aabb, glm::vec3& normal, uint64_t& moxelIndex)
+bool DAG::intersect(const Ray& ray, float& t, void* node, unsigned int level, unsigned int mirror, uint64_t filledCount, AABB aabb, glm::vec3& normal, uint64_t& moxelIndex)
 {
    // Child values by index based on morton encoding
    glm::vec3 childOffsets[8] = { 
@@ -1408,7 +1759,7 @@ bool DAG::intersect(const Ray& ray, float& t, void* node, unsigned int level, AA
          
          for (unsigned int i = 0; i < 8; i++)
          {
-            if (isChildSet(node, i))
+            if (isChildSet(node, i ^ mirror))
             {
                //cout << "\tChild " << i << " is set." << endl;
                glm::vec3 newMins(mins + (childOffsets[i] * newDim));
@@ -1419,17 +1770,22 @@ bool DAG::intersect(const Ray& ray, float& t, void* node, unsigned int level, AA
                //newAABB.print();
                //cout <<  "\tIntersecting with child..." << endl << endl;
                
-               uint64_t emptyCount = getEmptyCount((void*)node,i);
-               uint64_t levelIndexSum = getLevelIndexSum(level,i);
-               uint64_t tempMoxelIndex = moxelIndex + levelIndexSum - emptyCount;
-
-               // cout << "Level " << level << ", child = " << i << endl;
-               // cout << "\ttempMoxelIndex = moxelIndex + levelIndexSum - emptyCount;" << endl;
-               // cout << "\t" << tempMoxelIndex << " = " << moxelIndex << " + " << levelIndexSum << " - " << emptyCount << endl << endl;
+               uint64_t childFilledCount = filledCount;
+               uint64_t tempMoxelIndex = moxelIndex;
+               if (childMirrorBits > 0)
+               {
+                  tempMoxelIndex += getMirroredFilledPrefix((void*)node, level, i, mirror, childFilledCount);
+               }
+               else
+               {
+                  tempMoxelIndex += getFilledPrefix((void*)node, level, i);
+               }
 
                float newT;
+               unsigned int childMirror = mirror;
+               void* child = getChildPointer(node, i ^ mirror, level, childMirror);
                
-               bool newHit = intersect(ray, newT, getChildPointer(node,i, level), level+1, newAABB, normal, tempMoxelIndex);
+               bool newHit = intersect(ray, newT, child, level+1, childMirror, childFilledCount, newAABB, normal, tempMoxelIndex);
                //cout << "\n\tChild " << i << " hit: " << newHit << endl;
 
                if (newHit && newT < t)
@@ -1456,12 +1812,13 @@ bool DAG::intersect(const Ray& ray, float& t, void* node, unsigned int level, AA
       t = FLT_MAX;
       bool isHit = false;
       uint64_t finalMoxelIndex;
+      uint64_t leaf = mirrorLeaf(*((uint64_t*)node), mirror);
 
       // Go through each of the 64 child nodes stored in the given leaf
       for (unsigned int i = 0; i < 64; i++)
       {
          // If the leaf is not empty
-         if (isLeafSet((uint64_t*)node, i))
+         if (isLeafSet(&leaf, i))
          {
             unsigned int x, y, z;
             mortonCodeToXYZ((uint32_t)i, &x, &y, &z, 2);
@@ -1473,16 +1830,10 @@ bool DAG::intersect(const Ray& ray, float& t, void* node, unsigned int level, AA
             glm::vec3 tempNormal;
             bool newHit = newAABB.intersect(ray,newT,tempNormal,uselessMoxelIndex);
 
-            uint64_t emptyCount = getLeafNodeEmptyCount( *((uint64_t*)node), i);
-            uint64_t levelIndexSum = i; // Beacause at the last 2 levels it is just the # to the left of it which in this case is the index within the uint64_t
-            uint64_t tempMoxelIndex = moxelIndex + levelIndexSum - emptyCount;
+            uint64_t tempMoxelIndex = moxelIndex + getLeafFilledPrefix(leaf, i);
 
             if (newHit && newT < t)
             {
-               // cout << "Level " << level << ", child = " << i << endl;
-               // cout << "\ttempMoxelIndex = moxelIndex + levelIndexSum - emptyCount;" << endl;
-               // cout << "\t" << tempMoxelIndex << " = " << moxelIndex << " + " << levelIndexSum << " - " << emptyCount << endl << endl;
-
                t = newT;
                normal = tempNormal;
                finalMoxelIndex = tempMoxelIndex;
@@ -1496,11 +1847,11 @@ bool DAG::intersect(const Ray& ray, float& t, void* node, unsigned int level, AA
 }
 
 
-void DAG::getNormalFromMoxelTable(uint32_t index, glm::vec3& normal, unsigned int& materialIndex)
+void DAG::getNormalFromMoxelTable(uint64_t index, glm::vec3& normal, unsigned int& materialIndex)
 {
    float x, y, z;
    void* moxelTablePointer = moxelTable;
-   moxelTablePointer += ((3 * sizeof(float)) + sizeof(unsigned int)) * index;
+   moxelTablePointer += MOXEL_SIZE * index;
    
    normal.x = *((float*)moxelTablePointer);
    moxelTablePointer += sizeof(float);
@@ -1513,20 +1864,287 @@ void DAG::getNormalFromMoxelTable(uint32_t index, glm::vec3& normal, unsigned in
 
    materialIndex = *((unsigned int*)moxelTablePointer);
 
+   // save only writes valid indices, but a loaded file could still be damaged
+   if (materialIndex >= materials.size())
+   {
+      materialIndex = materials.size() - 1;
+   }
+}
+
+/**
+ * Writes the DAG, its moxel table and materials to one file that load maps back in. The file 
+ * is written under a temporary name and renamed into place so a reader never sees half of it.
+ * Returns false if there is no moxel table to save, a moxel names a material the DAG does not 
+ * have or the file could not be written.
+ */
+bool DAG::save(std::string dagFilePath)
+{
+   auto start = chrono::steady_clock::now();
+
+   if (moxelTable == NULL)
+   {
+      std::cerr << "Cannot save a DAG without a moxel table" << endl;
+      return false;
+   }
+
+   // Every moxel has to name one of the materials, checked once here instead of on every load
+   for (uint64_t i = 0; i < numFilledVoxels; i++)
+   {
+      unsigned int materialIndex = *((unsigned int*)((char*)moxelTable + (i * MOXEL_SIZE) + (sizeof(float) * 3)));
+      if (materialIndex >= materials.size())
+      {
+         std::cerr << "Cannot save the DAG, moxel " << i << " has material " << materialIndex << " of " << materials.size() << endl;
+         return false;
+      }
+   }
+
+   DAGFileHeader header;
+   memset(&header, 0, sizeof(header));
+   header.magic = DAG_FILE_MAGIC;
+   header.version = DAG_FILE_VERSION;
+   header.levels = numLevels;
+   header.numMaterials = materials.size();
+   header.mins[0] = boundingBox.mins.x;
+   header.mins[1] = boundingBox.mins.y;
+   header.mins[2] = boundingBox.mins.z;
+   header.maxs[0] = boundingBox.maxs.x;
+   header.maxs[1] = boundingBox.maxs.y;
+   header.maxs[2] = boundingBox.maxs.z;
+   header.childMirrorBits = childMirrorBits;
+   header.numFilledVoxels = numFilledVoxels;
+   header.numNodeWords = numNodeWords;
+   header.levelOffsetsOffset = DAG_FILE_ALIGNMENT;
+   header.nodesOffset = alignCacheOffset(header.levelOffsetsOffset + (2 * (numLevels-1) * sizeof(uint64_t)), DAG_FILE_ALIGNMENT);
+   header.moxelTableOffset = alignCacheOffset(header.nodesOffset + (numNodeWords * sizeof(uint32_t)), DAG_FILE_ALIGNMENT);
+   header.materialsOffset = alignCacheOffset(header.moxelTableOffset + (numFilledVoxels * MOXEL_SIZE), DAG_FILE_ALIGNMENT);
+
+   std::vector<float> materialFloats;
+   for (unsigned int i = 0; i < materials.size(); i++)
+   {
+      const PhongMaterial& material = materials[i];
+      float values[MATERIAL_FLOATS] = {material.ka.x, material.ka.y, material.ka.z, 
+       material.kd.x, material.kd.y, material.kd.z, material.ks.x, material.ks.y, material.ks.z, material.ns};
+      materialFloats.insert(materialFloats.end(), values, values + MATERIAL_FLOATS);
+   }
+
+   std::string tempFilePath = dagFilePath + ".tmp";
+   FILE* file = fopen(tempFilePath.c_str(), "wb");
+   if (file == NULL)
+   {
+      std::cerr << "Could not open " << tempFilePath << " to write the DAG" << endl;
+      return false;
+   }
+
+   bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1 
+    && fseeko(file, header.levelOffsetsOffset, SEEK_SET) == 0
+    && fwrite(levelOffsets, sizeof(uint64_t), numLevels-1, file) == numLevels-1
+    && fwrite(sizeAtLevel, sizeof(uint64_t), numLevels-1, file) == numLevels-1
+    && fseeko(file, header.nodesOffset, SEEK_SET) == 0
+    && fwrite(nodes, sizeof(uint32_t), numNodeWords, file) == numNodeWords
+    && fseeko(file, header.moxelTableOffset, SEEK_SET) == 0
+    && fwrite(moxelTable, MOXEL_SIZE, numFilledVoxels, file) == numFilledVoxels
+    && fseeko(file, header.materialsOffset, SEEK_SET) == 0
+    && fwrite(materialFloats.data(), sizeof(float), materialFloats.size(), file) == materialFloats.size();
+   isWritten = (fclose(file) == 0) && isWritten;
+
+   if (!isWritten || rename(tempFilePath.c_str(), dagFilePath.c_str()) != 0)
+   {
+      std::cerr << "Could not write the DAG " << dagFilePath << endl;
+      remove(tempFilePath.c_str());
+      return false;
+   }
+
+   auto end = chrono::steady_clock::now();
+   auto diff = end - start;
+   cout << "Wrote DAG " << dagFilePath << endl;
+   cout << "\t\tTime Saving DAG: " << chrono::duration <double, milli> (diff).count() << " ms" << endl;
+   return true;
+}
+
+/**
+ * Maps the node stream and the moxel table of a file written by save straight into memory and 
+ * points the levels into it, no parsing or pointer fixing needed. Only the level offsets and 
+ * the materials are read. Throws if the file is missing, from another version or cut short.
+ * 
+ * The sections are mapped shared and read only, so any number of processes rendering the same 
+ * file use one physical copy of the DAG and moxel table, the one in the page cache.
+ */
+void DAG::load(std::string dagFilePath)
+{
+   auto start = chrono::steady_clock::now();
+
+   int fd = open(dagFilePath.c_str(), O_RDONLY);
+   if (fd < 0)
+   {
+      std::string err("\nCould not open the DAG " + dagFilePath + "\n");
+      std::cerr << err;
+      throw std::out_of_range(err);
+   }
+
+   DAGFileHeader header;
+   struct stat sb;
+   bool isValid = pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) 
+    && fstat(fd, &sb) == 0
+    && header.magic == DAG_FILE_MAGIC 
+    && header.version == DAG_FILE_VERSION 
+    && header.levels > 2 
+    && header.levels <= MORTON_MAX_LEVEL 
+    && (header.childMirrorBits == 0 || header.childMirrorBits == DAG_MIRROR_BITS) 
+    && (header.numMaterials > 0 || header.numFilledVoxels == 0) 
+    && header.numNodeWords <= (uint64_t)sb.st_size / sizeof(uint32_t) 
+    && header.numFilledVoxels <= (uint64_t)sb.st_size / MOXEL_SIZE 
+    && header.levelOffsetsOffset % DAG_FILE_ALIGNMENT == 0 
+    && header.nodesOffset % DAG_FILE_ALIGNMENT == 0 
+    && header.moxelTableOffset % DAG_FILE_ALIGNMENT == 0 
+    && header.materialsOffset % DAG_FILE_ALIGNMENT == 0 
+    && header.levelOffsetsOffset + (2 * (header.levels-1) * sizeof(uint64_t)) <= (uint64_t)sb.st_size 
+    && header.nodesOffset + (header.numNodeWords * sizeof(uint32_t)) <= (uint64_t)sb.st_size 
+    && header.moxelTableOffset + (header.numFilledVoxels * MOXEL_SIZE) <= (uint64_t)sb.st_size 
+    && header.materialsOffset + ((uint64_t)header.numMaterials * MATERIAL_FLOATS * sizeof(float)) <= (uint64_t)sb.st_size;
+
+   if (!isValid)
+   {
+      close(fd);
+      std::string err("\nInvalid DAG file " + dagFilePath + "\n");
+      std::cerr << err;
+      throw std::out_of_range(err);
+   }
+
+   numLevels = header.levels;
+   size = pow(8, numLevels);
+   dimension = pow(2, numLevels);
+   boundingBox = BoundingBox(Vec3(header.mins[0], header.mins[1], header.mins[2]), Vec3(header.maxs[0], header.maxs[1], header.maxs[2]));
+   initialize(header.childMirrorBits);
+   numFilledVoxels = header.numFilledVoxels;
+   numNodeWords = header.numNodeWords;
+
+   uint64_t levelArrayBytes = (numLevels-1) * sizeof(uint64_t);
+   std::vector<float> materialFloats(header.numMaterials * MATERIAL_FLOATS);
+   uint64_t materialBytes = materialFloats.size() * sizeof(float);
+   isValid = pread(fd, levelOffsets, levelArrayBytes, header.levelOffsetsOffset) == (ssize_t)levelArrayBytes 
+    && pread(fd, sizeAtLevel, levelArrayBytes, header.levelOffsetsOffset + levelArrayBytes) == (ssize_t)levelArrayBytes 
+    && pread(fd, materialFloats.data(), materialBytes, header.materialsOffset) == (ssize_t)materialBytes 
+    && levelOffsets[numLevels-2] % 2 == 0; // The leafs are read as uint64_t's
+   for (unsigned int i = 0; i < numLevels-1; i++)
+   {
+      isValid = isValid && levelOffsets[i] < numNodeWords;
+   }
+
+   uint64_t nodesBytes = numNodeWords * sizeof(uint32_t);
+   uint64_t moxelTableBytes = numFilledVoxels * MOXEL_SIZE;
+   void* mappedNodes = isValid ? mapDAGSection(fd, header.nodesOffset, nodesBytes) : MAP_FAILED;
+   void* mappedMoxelTable = isValid ? mapDAGSection(fd, header.moxelTableOffset, moxelTableBytes) : MAP_FAILED;
+   close(fd);
+
+   if (mappedNodes == MAP_FAILED || mappedNodes == NULL || mappedMoxelTable == MAP_FAILED)
+   {
+      if (mappedNodes != MAP_FAILED && mappedNodes != NULL)
+         munmap(mappedNodes, nodesBytes);
+      if (mappedMoxelTable != MAP_FAILED && mappedMoxelTable != NULL)
+         munmap(mappedMoxelTable, moxelTableBytes);
+      std::string err("\nCould not map the DAG " + dagFilePath + "\n");
+      std::cerr << err;
+      throw std::out_of_range(err);
+   }
+
+   nodes = (uint32_t*)mappedNodes;
+   moxelTable = mappedMoxelTable;
+   isMapped = true;
+   for (unsigned int i = 0; i < numLevels-1; i++)
+   {
+      levels[i] = (void*)(nodes + levelOffsets[i]);
+   }
+   root = levels[0];
+
+   for (unsigned int i = 0; i < header.numMaterials; i++)
+   {
+      const float* values = &materialFloats[i * MATERIAL_FLOATS];
+      materials.push_back(PhongMaterial(glm::vec3(values[0], values[1], values[2]), 
+       glm::vec3(values[3], values[4], values[5]), glm::vec3(values[6], values[7], values[8]), values[9]));
+   }
+
+   auto end = chrono::steady_clock::now();
+   auto diff = end - start;
+   boundingBox.print();
+   cout << "Loaded DAG " << dagFilePath << endl;
+   cout << "Number of FilledVoxels: " << numFilledVoxels << endl;
+   cout << "Moxel DAG Memory Size: " << nodesBytes << " (" << getMemorySize(nodesBytes) << ")" << endl;
+   cout << "Moxel Table Size: " << moxelTableBytes << " (" << getMemorySize(moxelTableBytes) << ")" << endl;
+   cout << "\t\tTime Loading DAG: " << chrono::duration <double, milli> (diff).count() << " ms" << endl;
+}
+
+/**
+ * Returns whether the path names a DAG saved with DAG::save rather than a mesh
+ */
+bool isDAGFilePath(const std::string& path)
+{
+   size_t extensionLength = strlen(DAG_FILE_EXTENSION);
+   return path.size() > extensionLength 
+    && path.compare(path.size() - extensionLength, extensionLength, DAG_FILE_EXTENSION) == 0;
+}
+
+/**
+ * Maps numBytes of a DAG file starting at offset shared and read only. Sections of a huge page 
+ * or more are placed at a huge page aligned address, with the file offset aligned the same way, 
+ * and advised to use transparent huge pages where the kernel supports them for files. Returns 
+ * NULL for an empty section and MAP_FAILED if the mapping failed.
+ */
+void* mapDAGSection(int fd, uint64_t offset, uint64_t numBytes)
+{
+   if (numBytes == 0)
+   {
+      return NULL;
+   }
+   if (numBytes < DAG_FILE_ALIGNMENT)
+   {
+      return mmap(NULL, numBytes, PROT_READ, MAP_SHARED, fd, offset);
+   }
+
+   // Reserve room for an aligned start and map the file over it
+   uint64_t reservedBytes = numBytes + DAG_FILE_ALIGNMENT;
+   char* reserved = (char*)mmap(NULL, reservedBytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (reserved == MAP_FAILED)
+   {
+      return MAP_FAILED;
+   }
+   char* aligned = (char*)alignCacheOffset((uint64_t)reserved, DAG_FILE_ALIGNMENT);
+   void* mapped = mmap(aligned, numBytes, PROT_READ, MAP_SHARED | MAP_FIXED, fd, offset);
+   if (mapped == MAP_FAILED)
+   {
+      munmap(reserved, reservedBytes);
+      return MAP_FAILED;
+   }
+
+   // Give back the reserved pages on either side
+   uint64_t mappedEnd = alignCacheOffset((uint64_t)aligned + numBytes, getpagesize());
+   if (aligned > reserved)
+   {
+      munmap(reserved, aligned - reserved);
+   }
+   if ((uint64_t)reserved + reservedBytes > mappedEnd)
+   {
+      munmap((void*)mappedEnd, (uint64_t)reserved + reservedBytes - mappedEnd);
+   }
+
+#ifdef MADV_HUGEPAGE
+   madvise(mapped, numBytes, MADV_HUGEPAGE);
+#endif
+   return mapped;
 }
 
-string DAG::getMemorySize(unsigned int size)
+string DAG::getMemorySize(uint64_t size)
 {
    string b = " B";
    string kb = " KB";
    string mb = " MB";
    string gb = " GB";
-   string units[] = {b,kb,mb,gb};
+   string tb = " TB";
+   string units[] = {b,kb,mb,gb,tb};
    float currentSize = (float)size;
    float lastSize = (float)size;
    int i;
 
-   for (i = 0; i < 4 && currentSize > 1.0f; ++i)
+   for (i = 0; i < 5 && currentSize > 1.0f; ++i)
    {
       lastSize = currentSize;
       currentSize /= 1024.0f;
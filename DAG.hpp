@@ -20,33 +20,98 @@
 #include "AABB.hpp"
 #include "MortonCode.hpp"
 #include "PhongMaterial.hpp"
+#include "BuildOptions.hpp"
+#include "VoxelTriangleIndex.hpp"
+#include "DAGNodeTable.hpp"
+#include "DAGStreamBuilder.hpp"
+#include "DAGClustering.hpp"
+#include "BitCount.hpp"
 #include <algorithm>
 #include <unordered_map>
-#include "tbb/concurrent_unordered_map.h"
 
 #include <vector>
 #include <stdint.h>
 #include <cfloat>
 #include <string>
 #include <chrono>
+#include "tbb/tbb.h"
 
 #define SET_8_BITS 255
+#define DAG_BLOCK_SIZE 65536 // Number of nodes one task reduces
+#define NUM_FILLED_PREFIXES 7 // Nothing is filled before the first child
+#define DAG_FILE_MAGIC 0x46474144 // "DAGF"
+#define DAG_FILE_VERSION 3
+#define DAG_FILE_ALIGNMENT (1 << 21) // Section alignment, the size of a huge page so sections can be mapped with them
+#define DAG_FILE_EXTENSION ".dag"
+#define MOXEL_SIZE ((sizeof(float) * 3) + sizeof(unsigned int)) // Bytes of a moxel table entry, the normal and material index
+#define MATERIAL_FLOATS 10 // ka, kd, ks and ns of a material in the DAG file
+
+// Start of a DAG file. The level offsets and sizes, the node stream, the moxel table and the 
+// materials follow at DAG_FILE_ALIGNMENT aligned offsets. Child offsets are relative to 
+// their level, so the node stream is used right where it is mapped, and every process that 
+// maps the file shares the one copy in the page cache.
+typedef struct
+{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t levels;
+   uint32_t numMaterials;
+   float mins[3]; // The squared bounding box
+   float maxs[3];
+   uint32_t childMirrorBits; // Of a mirror reduced DAG
+   uint32_t reserved;
+   uint64_t numFilledVoxels;
+   uint64_t numNodeWords;
+   uint64_t levelOffsetsOffset; // levelOffsets and then sizeAtLevel, levels-1 of each
+   uint64_t nodesOffset;
+   uint64_t moxelTableOffset;
+   uint64_t materialsOffset;
+} DAGFileHeader;
 
 class DAG : public Traceable
 {
    public:
-      DAG(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath, std::vector<PhongMaterial> materialsVal);
+      DAG(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath, std::vector<PhongMaterial> materialsVal, const BuildOptions& optionsVal);
+      DAG(const unsigned int levelsVal, const VoxelSource* voxelSourceVal, std::vector<PhongMaterial> materialsVal, const BuildOptions& optionsVal);
+      DAG(const unsigned int levelsVal, SparseVoxelOctree* svoVal, const BuildOptions& optionsVal);
+      DAG(std::string dagFilePath, const BuildOptions& optionsVal);
       ~DAG();
+      void initialize(unsigned int childMirrorBitsVal);
       void build(const std::vector<Triangle> triangles, std::string meshFilePath);
+      void build(SparseVoxelOctree* svoPtr);
+      void build(const VoxelSource& source);
+      void build(Voxels* voxels, DAGStreamBuilder& stream);
+      template <typename GetLeaf> void writeLeafLevel(uint64_t numUniqueLeafs, const GetLeaf& getUniqueLeaf, std::vector<uint64_t>& childOffsets, std::vector<uint64_t>& childFilledCounts);
+      template <typename GetKey> void writeLevel(int levelIndex, uint64_t numUniqueNodes, const GetKey& getUniqueKey, std::vector<uint64_t>& childOffsets, std::vector<uint64_t>& childFilledCounts);
+      uint32_t* appendLevel(unsigned int level, uint64_t numWords);
+      void finishBuild(chrono::steady_clock::time_point start);
+      bool save(std::string dagFilePath);
+      void load(std::string dagFilePath);
+      void addChildMirrors(std::vector<uint64_t>& nodeIds, const std::vector<unsigned char>& mirrors);
+      uint64_t getNumMirroredChildren(uint64_t& numChildren);
+      template <typename GetKey> uint64_t reduceLevel(uint64_t numNodes, const GetKey& getKey, std::vector<uint64_t>& nodeIds, std::vector<uint64_t>& uniqueIndices);
+      template <typename GetKey> uint64_t clusterLevel(int levelIndex, uint64_t numUniqueNodes, const GetKey& getKey, std::vector<uint64_t>& nodeIds, std::vector<uint64_t>& uniqueIndices, const std::vector<uint64_t>& childFilledCounts);
+      uint64_t getNumFlippedVoxels();
+      uint64_t getNumFlippedVoxels(unsigned int level, uint64_t svoIndex, void* node, unsigned int mirror, unordered_map<void*, uint64_t>& filledCounts);
       void buildMoxelTable(const std::vector<Triangle> triangles);
+      void buildMoxelTable(const std::vector<Triangle>& triangles, void* node, unsigned int level, unsigned int mirror, uint64_t mortonIndex, uint64_t& pairIndex, uint64_t& moxelIndex, uint64_t& numMissing, uint64_t& numInterior);
+      void addMoxel(const std::vector<Triangle>& triangles, uint64_t mortonIndex, uint64_t& pairIndex, uint64_t& moxelIndex, uint64_t& numMissing, uint64_t& numInterior);
+      bool isInteriorVoxel(const std::vector<Triangle>& triangles, uint64_t mortonIndex, uint64_t pairIndex);
       bool isSet(unsigned int x, unsigned int y, unsigned int z);
+      bool getMoxelIndex(unsigned int x, unsigned int y, unsigned int z, uint64_t& moxelIndex);
+      bool getMirroredMoxelIndex(unsigned int x, unsigned int y, unsigned int z, uint64_t& moxelIndex);
       void* getChildPointer(void* node, unsigned int index, unsigned int level);
+      void* getChildPointer(void* node, unsigned int index, unsigned int level, unsigned int& mirror);
+      void* getChildPointerLoop(void* node, unsigned int index, unsigned int level);
       bool isLeafSet(uint64_t* node, unsigned int i);
       bool isChildSet(void* node, unsigned int i);
       void writeImages();
       void printLevels();
       unsigned int getNumChildren(void* node);
+      // Slot of child index among the node's set children, its offset is that many after the header
+      unsigned int getChildSlot(void* node, unsigned int index) { return countSetBitsBelow(*((uint32_t*)node), index); }
       uint64_t getNumFilledVoxels();
+      uint64_t getNumFilledVoxels(void* node, unsigned int level, unordered_map<void*, uint64_t>& filledCounts);
       void printMask(void* node);
       void printSVOMask(SVONode* node);
       bool isSetSVO(unsigned int x, unsigned int y, unsigned int z);
@@ -54,14 +119,17 @@ class DAG : public Traceable
       void writeSVOImages();
       void printSVOLevels();
       uint64_t getNumEmptyLeafNodes(uint64_t leafNode);
-      uint64_t getEmptyCount(void* node, unsigned int index);
+      uint64_t getFilledPrefix(void* node, unsigned int level, unsigned int index);
+      uint64_t getMirroredFilledPrefix(void* node, unsigned int level, unsigned int index, unsigned int mirror, uint64_t& filledCount);
+      void setFilledPrefixes(void* node, unsigned int level, const uint64_t* filledCounts);
       uint64_t getLeafNodeEmptyCount(uint64_t leafNode, unsigned int index);
+      uint64_t getLeafFilledPrefix(uint64_t leafNode, unsigned int index);
       uint64_t getLevelIndexSum(unsigned int level, unsigned int index);
-      void getNormalFromMoxelTable(uint32_t index, glm::vec3& normal, unsigned int& materialIndex);
+      void getNormalFromMoxelTable(uint64_t index, glm::vec3& normal, unsigned int& materialIndex);
       bool intersect(const Ray& ray, float& t, glm::vec3& normal, uint64_t& moxelIndex);
-      bool intersect(const Ray& ray, float& t, void* node, unsigned int level, AABB aabb, glm::vec3& normal, uint64_t& moxelIndex);
-      void getEmptyCount(void* node, uint64_t* expected);
-      string getMemorySize(unsigned int size);
+      bool intersect(const Ray& ray, float& t, void* node, unsigned int level, unsigned int mirror, uint64_t filledCount, AABB aabb, glm::vec3& normal, uint64_t& moxelIndex);
+      void printFilledPrefixes(void* node, unsigned int level, uint64_t* expected);
+      string getMemorySize(uint64_t size);
 
       BoundingBox boundingBox;
       unsigned int numLevels;
@@ -71,14 +139,31 @@ class DAG : public Traceable
       uint64_t numFilledVoxels;
       //SVONode* root;
       void* root;
-      void* svoRoot;
-      void** levels;
-      void** newLevels; //SVO levels
-      unsigned int * sizeAtLevel; // Number nodes at a level
+      void** levels; // The start of each level in nodes
+      uint32_t* nodes; // The node stream, mapped: every level bottom up, the leafs in uint64_t's and then the interior nodes in uint32_t's
+      uint64_t* levelOffsets; // Offset of each level in nodes, in uint32_t's
+      uint64_t numNodeWords; // Number of uint32_t in nodes
+      SparseVoxelOctree* svo; // The compact SVO the DAG was reduced from
+      bool ownsSVO; // Whether the SVO was built for this DAG and is freed with it
+      bool isMapped; // Whether nodes and moxelTable are mapped from a DAG file rather than built
+      uint64_t* sizeAtLevel; // Number nodes at a level
+      unsigned int* filledPrefixBits; // Width of the packed filled voxel prefixes at each level, enough for 8^(numLevels-level)
+      unsigned int* nodeHeaderSizes; // Number of uint32_t holding a node's mask and filled prefixes at each level
+      uint64_t numLossyMergedNodes; // Unique nodes merged into a close one by the lossy reduction
+      unsigned int childMirrorBits; // DAG_MIRROR_BITS when the child offsets carry the mirror the child is seen through, 0 otherwise
+      uint64_t* dagMemoryAlocated; // Bytes of each level of the DAG as built
+      uint64_t* fixedHeaderMemoryAlocated; // ... if every header was as wide as the root's
+      uint64_t* prevDagMemoryAlocated; // ... without filled prefixes
       void* moxelTable;
-      tbb::concurrent_unordered_map<unsigned int, unsigned int>* voxelTriangleIndexMap;
+      VoxelTriangleIndex* voxelTriangleIndex;
+      const VoxelSource* voxelSource; // The source voxelized instead of triangles, or NULL
       std::vector<PhongMaterial> materials;
+      BuildOptions options;
       
 };
 
+uint64_t parallelExclusiveScan(std::vector<uint64_t>& values);
+bool isDAGFilePath(const std::string& path);
+void* mapDAGSection(int fd, uint64_t offset, uint64_t numBytes);
+
 #endif
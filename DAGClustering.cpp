@@ -0,0 +1,229 @@
+/**
+ * DAGClustering.cpp
+ *
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */
+
+#include "DAGClustering.hpp"
+#include "tbb/tbb.h"
+
+/**
+ * Returns the number of nodes of the level with each unique id.
+ */
+std::vector<uint64_t> getInstanceCounts(const std::vector<uint64_t>& nodeIds, uint64_t numUniqueNodes)
+{
+   std::vector<uint64_t> instanceCounts(numUniqueNodes, 0);
+   for (uint64_t i = 0; i < nodeIds.size(); i++)
+   {
+      instanceCounts[nodeIds[i]]++;
+   }
+   return instanceCounts;
+}
+
+/**
+ * Returns the unique ids from the most to the least common, the lower id first between
+ * equally common ones so the clusters do not depend on the sort.
+ */
+std::vector<uint64_t> getClusterOrder(const std::vector<uint64_t>& instanceCounts)
+{
+   std::vector<uint64_t> order(instanceCounts.size());
+   for (uint64_t u = 0; u < order.size(); u++)
+   {
+      order[u] = u;
+   }
+   std::sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) {
+      return instanceCounts[a] > instanceCounts[b] || (instanceCounts[a] == instanceCounts[b] && a < b);
+   });
+   return order;
+}
+
+/**
+ * Returns the bits of chunk of a leaf split into numChunks chunks.
+ */
+static uint64_t getLeafChunk(uint64_t leaf, unsigned int chunk, unsigned int numChunks)
+{
+   unsigned int start = (chunk * 64) / numChunks;
+   unsigned int numBits = (((chunk + 1) * 64) / numChunks) - start;
+   uint64_t mask = (numBits == 64) ? ~(uint64_t)0 : (((uint64_t)1 << numBits) - 1);
+   return (leaf >> start) & mask;
+}
+
+/**
+ * Merges each unique leaf into the closest more common leaf that differs in at most budget
+ * voxels. representatives gets the id each leaf is merged into, its own id for the ones
+ * that are kept. Returns an upper bound on the voxels flipped in the volume, each leaf's
+ * distance to its representative times the number of times it appears. Merges of the
+ * levels above can drop or replace some of those instances, so getNumFlippedVoxels is exact.
+ */
+uint64_t clusterLeafs(const std::vector<DAGNodeKey>& keys, const std::vector<uint64_t>& instanceCounts, unsigned int budget, std::vector<uint64_t>& representatives)
+{
+   unsigned int numChunks = std::min(budget + 1, (unsigned int)DAG_CLUSTER_MAX_CHUNKS);
+   std::vector<std::unordered_map<uint64_t, std::vector<uint64_t> > > buckets(numChunks);
+   std::vector<uint64_t> order = getClusterOrder(instanceCounts);
+   uint64_t numFlipped = 0;
+
+   representatives.resize(keys.size());
+   for (uint64_t k = 0; k < order.size(); k++)
+   {
+      uint64_t u = order[k];
+      uint64_t leaf = keys[u].mask;
+      uint64_t best = u;
+      unsigned int bestDistance = budget + 1;
+
+      for (unsigned int c = 0; c < numChunks && bestDistance > 1; c++)
+      {
+         auto found = buckets[c].find(getLeafChunk(leaf, c, numChunks));
+         if (found == buckets[c].end())
+         {
+            continue;
+         }
+         const std::vector<uint64_t>& candidates = found->second;
+         uint64_t numCandidates = std::min((uint64_t)candidates.size(), (uint64_t)DAG_CLUSTER_MAX_CANDIDATES);
+         for (uint64_t i = 0; i < numCandidates; i++)
+         {
+            unsigned int distance = countSetBits(leaf ^ keys[candidates[i]].mask);
+            if (distance < bestDistance)
+            {
+               best = candidates[i];
+               bestDistance = distance;
+            }
+         }
+      }
+
+      representatives[u] = best;
+      if (best != u)
+      {
+         numFlipped += bestDistance * instanceCounts[u];
+      }
+      else
+      {
+         for (unsigned int c = 0; c < numChunks; c++)
+         {
+            buckets[c][getLeafChunk(leaf, c, numChunks)].push_back(u);
+         }
+      }
+   }
+   return numFlipped;
+}
+
+/**
+ * Merges each unique interior node into the closest more common node it can be merged
+ * into within budget voxels, the same as clusterLeafs. Candidates are found by the children
+ * they share, each representative is listed under each of its (child index, child id) pairs.
+ * childFilledCounts has the filled voxels of the level below by id. Returns an upper bound
+ * on the voxels flipped, the same as clusterLeafs.
+ */
+uint64_t clusterNodes(const std::vector<DAGNodeKey>& keys, const std::vector<uint64_t>& instanceCounts, const std::vector<uint64_t>& childFilledCounts, unsigned int childMirrorBits, unsigned int budget, std::vector<uint64_t>& representatives)
+{
+   std::unordered_map<uint64_t, std::vector<uint64_t> > buckets;
+   std::vector<uint64_t> order = getClusterOrder(instanceCounts);
+   uint64_t numFlipped = 0;
+
+   representatives.resize(keys.size());
+   for (uint64_t k = 0; k < order.size(); k++)
+   {
+      uint64_t u = order[k];
+      const DAGNodeKey& key = keys[u];
+      uint64_t best = u;
+      uint64_t bestDistance = (uint64_t)budget + 1;
+
+      for (unsigned int j = 0; j < 8 && bestDistance > 1; j++)
+      {
+         if (!(key.mask & (1 << j)))
+         {
+            continue;
+         }
+         auto found = buckets.find((key.childIds[j] << 3) | j);
+         if (found == buckets.end())
+         {
+            continue;
+         }
+         const std::vector<uint64_t>& candidates = found->second;
+         uint64_t numCandidates = std::min((uint64_t)candidates.size(), (uint64_t)DAG_CLUSTER_MAX_CANDIDATES);
+         for (uint64_t i = 0; i < numCandidates; i++)
+         {
+            uint64_t distance = getNodeDistance(key, keys[candidates[i]], childFilledCounts, childMirrorBits);
+            if (distance < bestDistance)
+            {
+               best = candidates[i];
+               bestDistance = distance;
+            }
+         }
+      }
+
+      representatives[u] = best;
+      if (best != u)
+      {
+         numFlipped += bestDistance * instanceCounts[u];
+      }
+      else
+      {
+         for (unsigned int j = 0; j < 8; j++)
+         {
+            if (key.mask & (1 << j))
+            {
+               buckets[(key.childIds[j] << 3) | j].push_back(u);
+            }
+         }
+      }
+   }
+   return numFlipped;
+}
+
+/**
+ * Returns the number of voxels that differ between two interior nodes whose children are
+ * the same wherever both have one, DAG_CLUSTER_FAR otherwise.
+ */
+uint64_t getNodeDistance(const DAGNodeKey& a, const DAGNodeKey& b, const std::vector<uint64_t>& childFilledCounts, unsigned int childMirrorBits)
+{
+   uint64_t distance = 0;
+   for (unsigned int j = 0; j < 8; j++)
+   {
+      bool isInA = (a.mask & (1 << j)) != 0;
+      bool isInB = (b.mask & (1 << j)) != 0;
+      if (isInA && isInB)
+      {
+         if (a.childIds[j] != b.childIds[j])
+         {
+            return DAG_CLUSTER_FAR;
+         }
+      }
+      else if (isInA)
+      {
+         distance += childFilledCounts[a.childIds[j] >> childMirrorBits];
+      }
+      else if (isInB)
+      {
+         distance += childFilledCounts[b.childIds[j] >> childMirrorBits];
+      }
+   }
+   return distance;
+}
+
+/**
+ * Numbers the representatives in the order of their old ids, which keeps the unique nodes in
+ * the order they first appear, and gives every node the new id of its representative.
+ * uniqueIndices is cut down to the representatives. Returns the number of them.
+ */
+uint64_t remapToRepresentatives(const std::vector<uint64_t>& representatives, std::vector<uint64_t>& nodeIds, std::vector<uint64_t>& uniqueIndices)
+{
+   uint64_t numUniqueNodes = representatives.size();
+   std::vector<uint64_t> newIds(numUniqueNodes);
+   uint64_t numRepresentatives = 0;
+
+   for (uint64_t u = 0; u < numUniqueNodes; u++)
+   {
+      if (representatives[u] == u)
+      {
+         newIds[u] = numRepresentatives;
+         uniqueIndices[numRepresentatives] = uniqueIndices[u];
+         numRepresentatives++;
+      }
+   }
+   uniqueIndices.resize(numRepresentatives);
+
+   tbb::parallel_for((uint64_t)0, (uint64_t)nodeIds.size(), [&](uint64_t i) {
+      nodeIds[i] = newIds[representatives[nodeIds[i]]];
+   });
+   return numRepresentatives;
+}
@@ -0,0 +1,47 @@
+/**
+ * DAGClustering.hpp
+ *
+ * Lossy reduction of one DAG level after it is hash-consed: a unique node that is within a
+ * few voxels of a more common one is merged into it, and every node with its id is remapped
+ * to the one it was merged into. The parents of merged nodes then have the same children
+ * more often, so the exact reduction of the level above shares more of them too.
+ *
+ * The nodes are visited from the most to the least common. A node becomes a representative
+ * unless one of the representatives before it is within the budget, in which case it is
+ * merged into the closest one. Representatives are never merged, so no node ends up further
+ * than the budget from the one it was merged into.
+ *
+ * Leafs are compared by the Hamming distance of their voxel bits. Representatives are found
+ * by splitting the 64 bits into budget + 1 chunks: two leafs that differ in at most budget
+ * bits have at least one chunk the same. Interior nodes are compared child by child: a child
+ * that only one of them has counts its filled voxels, and two different children can not be
+ * merged, their distance is not known without comparing the subtrees. So a node can take on
+ * or drop small children, and it is found through the children it shares with the
+ * representative.
+ *
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */
+
+#ifndef DAG_CLUSTERING_HPP
+#define DAG_CLUSTERING_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "DAGNodeTable.hpp"
+#include "BitCount.hpp"
+
+#define DAG_CLUSTER_MAX_CHUNKS 16 // Most chunks a leaf is split into, larger budgets may miss a close leaf
+#define DAG_CLUSTER_MAX_CANDIDATES 64 // Representatives tried from one bucket, the most common ones
+#define DAG_CLUSTER_FAR UINT64_MAX // Distance of nodes that can not be merged
+
+std::vector<uint64_t> getInstanceCounts(const std::vector<uint64_t>& nodeIds, uint64_t numUniqueNodes);
+std::vector<uint64_t> getClusterOrder(const std::vector<uint64_t>& instanceCounts);
+uint64_t clusterLeafs(const std::vector<DAGNodeKey>& keys, const std::vector<uint64_t>& instanceCounts, unsigned int budget, std::vector<uint64_t>& representatives);
+uint64_t clusterNodes(const std::vector<DAGNodeKey>& keys, const std::vector<uint64_t>& instanceCounts, const std::vector<uint64_t>& childFilledCounts, unsigned int childMirrorBits, unsigned int budget, std::vector<uint64_t>& representatives);
+uint64_t getNodeDistance(const DAGNodeKey& a, const DAGNodeKey& b, const std::vector<uint64_t>& childFilledCounts, unsigned int childMirrorBits);
+uint64_t remapToRepresentatives(const std::vector<uint64_t>& representatives, std::vector<uint64_t>& nodeIds, std::vector<uint64_t>& uniqueIndices);
+
+#endif
@@ -0,0 +1,203 @@
+/**
+ * DAGNodeTable.cpp
+ * 
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */ 
+
+#include "DAGNodeTable.hpp"
+
+/**
+ * Makes a table sized for maxNodes unique nodes. It has at least twice as many slots so the 
+ * probe sequences stay short, and grows when more nodes are added.
+ */
+DAGNodeTable::DAGNodeTable(uint64_t maxNodes)
+ : slotMask(0)
+{
+   uint64_t numSlots = 16;
+   while (numSlots < 2 * maxNodes)
+   {
+      numSlots *= 2;
+   }
+   slots.assign(numSlots, DAG_NODE_TABLE_EMPTY);
+   slotMask = numSlots - 1;
+   keys.reserve(maxNodes);
+}
+
+/**
+ * Returns the id of the node equal to key, adding it if there is none yet.
+ */
+uint64_t DAGNodeTable::insert(const DAGNodeKey& key)
+{
+   uint64_t slot = hashDAGNodeKey(key) & slotMask;
+
+   while (slots[slot] != DAG_NODE_TABLE_EMPTY)
+   {
+      uint64_t id = slots[slot] - 1;
+      if (isSameDAGNodeKey(keys[id], key))
+      {
+         return id;
+      }
+      slot = (slot + 1) & slotMask;
+   }
+
+   keys.push_back(key);
+   slots[slot] = keys.size();
+   if (2 * keys.size() > slots.size())
+   {
+      grow();
+   }
+   return keys.size() - 1;
+}
+
+/**
+ * Doubles the number of slots and puts the ids back in.
+ */
+void DAGNodeTable::grow()
+{
+   slots.assign(2 * slots.size(), DAG_NODE_TABLE_EMPTY);
+   slotMask = slots.size() - 1;
+
+   for (uint64_t id = 0; id < keys.size(); id++)
+   {
+      uint64_t slot = hashDAGNodeKey(keys[id]) & slotMask;
+      while (slots[slot] != DAG_NODE_TABLE_EMPTY)
+      {
+         slot = (slot + 1) & slotMask;
+      }
+      slots[slot] = id + 1;
+   }
+}
+
+/**
+ * Returns the number of unique nodes.
+ */
+uint64_t DAGNodeTable::size() const
+{
+   return keys.size();
+}
+
+/**
+ * Makes an empty table for up to maxNodes nodes, with at least twice as many slots.
+ */
+ConcurrentDAGNodeTable::ConcurrentDAGNodeTable(uint64_t maxNodes)
+ : slotMask(0)
+{
+   uint64_t numSlots = 16;
+   while (numSlots < 2 * maxNodes)
+   {
+      numSlots *= 2;
+   }
+   slots.assign(numSlots, DAG_NODE_TABLE_EMPTY);
+   slotMask = numSlots - 1;
+}
+
+/**
+ * Returns the key of a leaf word.
+ */
+DAGNodeKey getLeafKey(uint64_t leaf)
+{
+   DAGNodeKey key;
+   key.mask = leaf;
+   for (unsigned int i = 0; i < 8; i++)
+   {
+      key.childIds[i] = 0;
+   }
+   return key;
+}
+
+/**
+ * Returns the key of the node mirrored along the axes set in mirror. A child moves to the 
+ * mirrored index and is itself seen through the mirror, which for the ids of a mirror reduced 
+ * level is xor-ed into their mirror bits.
+ */
+DAGNodeKey mirrorDAGNodeKey(const DAGNodeKey& key, unsigned int mirror, bool isLeaf)
+{
+   DAGNodeKey mirrored = getLeafKey(0);
+
+   if (isLeaf)
+   {
+      mirrored.mask = mirrorLeaf(key.mask, mirror);
+      return mirrored;
+   }
+
+   for (unsigned int i = 0; i < 8; i++)
+   {
+      if (key.mask & (1 << i))
+      {
+         mirrored.mask |= 1 << (i ^ mirror);
+         mirrored.childIds[i ^ mirror] = key.childIds[i] ^ mirror;
+      }
+   }
+   return mirrored;
+}
+
+/**
+ * Replaces the key with the smallest of its mirror images. Returns the mirror that turns the 
+ * canonical key back into the node, mirrors being their own inverse.
+ */
+unsigned int canonicalizeDAGNodeKey(DAGNodeKey& key, bool isLeaf)
+{
+   DAGNodeKey canonical = key;
+   unsigned int canonicalMirror = 0;
+
+   for (unsigned int mirror = 1; mirror < NUM_MIRRORS; mirror++)
+   {
+      DAGNodeKey mirrored = mirrorDAGNodeKey(key, mirror, isLeaf);
+      if (isLessDAGNodeKey(mirrored, canonical))
+      {
+         canonical = mirrored;
+         canonicalMirror = mirror;
+      }
+   }
+   key = canonical;
+   return canonicalMirror;
+}
+
+/**
+ * Orders keys by mask, then by the child ids in index order.
+ */
+bool isLessDAGNodeKey(const DAGNodeKey& a, const DAGNodeKey& b)
+{
+   if (a.mask != b.mask)
+   {
+      return a.mask < b.mask;
+   }
+   for (unsigned int i = 0; i < 8; i++)
+   {
+      if (a.childIds[i] != b.childIds[i])
+      {
+         return a.childIds[i] < b.childIds[i];
+      }
+   }
+   return false;
+}
+
+/**
+ * Mixes the mask and the child ids one word at a time.
+ */
+uint64_t hashDAGNodeKey(const DAGNodeKey& key)
+{
+   uint64_t hash = key.mask * 0x9e3779b97f4a7c15ULL;
+   for (unsigned int i = 0; i < 8; i++)
+   {
+      hash = (hash ^ key.childIds[i]) * 0xff51afd7ed558ccdULL;
+      hash ^= hash >> 32;
+   }
+   return hash ^ (hash >> 29);
+}
+
+bool isSameDAGNodeKey(const DAGNodeKey& a, const DAGNodeKey& b)
+{
+   if (a.mask != b.mask)
+   {
+      return false;
+   }
+   for (unsigned int i = 0; i < 8; i++)
+   {
+      if (a.childIds[i] != b.childIds[i])
+      {
+         return false;
+      }
+   }
+   return true;
+}
@@ -0,0 +1,167 @@
+/**
+ * DAGNodeTable.hpp
+ * 
+ * Hash-conses the nodes of one DAG level. A node is keyed by its child mask and the ids of 
+ * its unique children; a leaf by its 64 voxel bits. Adding a key returns the id of the equal 
+ * node added before, or a new id when it is the first of its kind, so each level is reduced 
+ * in one linear pass. The unique keys are kept in the order they were first added and the 
+ * table uses open addressing with linear probing.
+ *
+ * ConcurrentDAGNodeTable does the same for a whole level from many threads at once without 
+ * locks. Its slots hold the index of a node of the level instead of a copy of its key, and 
+ * equal nodes keep the lowest index, so the result does not depend on the thread timing.
+ *
+ * With mirror reduction the keys are canonicalized before they are added: of the 8 mirror 
+ * images of a node the smallest key is kept, and the ids of its children carry the mirror 
+ * they are seen through in their low DAG_MIRROR_BITS bits.
+ *
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */ 
+
+#ifndef DAG_NODE_TABLE_HPP
+#define DAG_NODE_TABLE_HPP
+
+#include <stdint.h>
+#include <vector>
+
+#define DAG_NODE_TABLE_EMPTY 0 // Slot value of an empty slot, the others hold id + 1
+#define NUM_MIRRORS 8 // Every combination of mirroring along x, y and z
+#define DAG_MIRROR_BITS 3 // Bits of a child reference holding its mirror, bit 0 for x, 1 for y and 2 for z
+
+// The child mask and the unique id of each set child of a node, or the voxel bits of a leaf 
+// in mask with no children
+typedef struct
+{
+   uint64_t mask;
+   uint64_t childIds[8]; // 0 for the children that are not set
+} DAGNodeKey;
+
+uint64_t hashDAGNodeKey(const DAGNodeKey& key);
+bool isSameDAGNodeKey(const DAGNodeKey& a, const DAGNodeKey& b);
+
+class DAGNodeTable
+{
+   public:
+      std::vector<DAGNodeKey> keys; // The unique keys, the index of a key is its id
+      std::vector<uint64_t> slots;
+      uint64_t slotMask; // Number of slots - 1, the number of slots is a power of 2
+
+      DAGNodeTable(uint64_t maxNodes);
+      uint64_t insert(const DAGNodeKey& key);
+      uint64_t size() const;
+      void grow();
+};
+
+// Lock-free set of node indexes of one level. GetKey is a function object returning the key 
+// of the node at an index.
+class ConcurrentDAGNodeTable
+{
+   public:
+      std::vector<uint64_t> slots;
+      uint64_t slotMask;
+
+      ConcurrentDAGNodeTable(uint64_t maxNodes);
+      template <typename GetKey> void insert(uint64_t index, const GetKey& getKey);
+      template <typename GetKey> uint64_t find(uint64_t index, const GetKey& getKey);
+};
+
+/**
+ * Adds the node at index. A slot is claimed with a compare and swap. When an equal node is 
+ * already there the slot keeps whichever index is lower.
+ */
+template <typename GetKey>
+void ConcurrentDAGNodeTable::insert(uint64_t index, const GetKey& getKey)
+{
+   DAGNodeKey key = getKey(index);
+   uint64_t slot = hashDAGNodeKey(key) & slotMask;
+   uint64_t value = index + 1;
+
+   while (true)
+   {
+      uint64_t current = __atomic_load_n(&slots[slot], __ATOMIC_ACQUIRE);
+      if (current == DAG_NODE_TABLE_EMPTY)
+      {
+         if (__atomic_compare_exchange_n(&slots[slot], &current, value, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+         {
+            return;
+         }
+         // Someone else claimed the slot first, look at what they put there
+         continue;
+      }
+
+      DAGNodeKey currentKey = getKey(current - 1);
+      if (isSameDAGNodeKey(currentKey, key))
+      {
+         while (value < current)
+         {
+            if (__atomic_compare_exchange_n(&slots[slot], &current, value, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+               return;
+            }
+         }
+         return;
+      }
+      slot = (slot + 1) & slotMask;
+   }
+}
+
+/**
+ * Returns the index of the node equal to the one at index that was kept. Only valid once all 
+ * the inserts are done.
+ */
+template <typename GetKey>
+uint64_t ConcurrentDAGNodeTable::find(uint64_t index, const GetKey& getKey)
+{
+   DAGNodeKey key = getKey(index);
+   uint64_t slot = hashDAGNodeKey(key) & slotMask;
+
+   while (slots[slot] != DAG_NODE_TABLE_EMPTY)
+   {
+      uint64_t current = slots[slot] - 1;
+      if (current == index || isSameDAGNodeKey(getKey(current), key))
+      {
+         return current;
+      }
+      slot = (slot + 1) & slotMask;
+   }
+   return index;
+}
+
+DAGNodeKey getLeafKey(uint64_t leaf);
+DAGNodeKey mirrorDAGNodeKey(const DAGNodeKey& key, unsigned int mirror, bool isLeaf);
+unsigned int canonicalizeDAGNodeKey(DAGNodeKey& key, bool isLeaf);
+bool isLessDAGNodeKey(const DAGNodeKey& a, const DAGNodeKey& b);
+
+/**
+ * Returns what mirror does to the index of a voxel in a leaf word. The child index bits of a 
+ * node are x, y and z from bit 0 up, and a leaf holds two levels of them, so mirroring flips 
+ * the same bit of both.
+ */
+inline unsigned int getLeafIndexMirror(unsigned int mirror)
+{
+   return mirror | (mirror << 3);
+}
+
+/**
+ * Returns the leaf word mirrored along the axes set in mirror: the voxel at index i moves to 
+ * index i ^ getLeafIndexMirror(mirror). Each flipped index bit swaps the blocks of bits it 
+ * tells apart.
+ */
+inline uint64_t mirrorLeaf(uint64_t leaf, unsigned int mirror)
+{
+   static const uint64_t swapMasks[6] = {0x5555555555555555ULL, 0x3333333333333333ULL, 
+    0x0f0f0f0f0f0f0f0fULL, 0x00ff00ff00ff00ffULL, 0x0000ffff0000ffffULL, 0x00000000ffffffffULL};
+   unsigned int indexMirror = getLeafIndexMirror(mirror);
+
+   for (unsigned int bit = 0; bit < 6; bit++)
+   {
+      if (indexMirror & (1u << bit))
+      {
+         unsigned int shift = 1u << bit;
+         leaf = ((leaf & swapMasks[bit]) << shift) | ((leaf >> shift) & swapMasks[bit]);
+      }
+   }
+   return leaf;
+}
+
+#endif
@@ -0,0 +1,135 @@
+/**
+ * DAGStreamBuilder.cpp
+ *
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */
+
+#include "DAGStreamBuilder.hpp"
+
+DAGStreamBuilder::DAGStreamBuilder(unsigned int numLevelsVal, unsigned int childMirrorBitsVal)
+ : numLevels(numLevelsVal),
+   childMirrorBits(childMirrorBitsVal),
+   tables(numLevelsVal-1),
+   pendingKeys(numLevelsVal-1),
+   pendingIndexes(numLevelsVal-1, 0),
+   hasPending(numLevelsVal-1, false),
+   numLeafs(0),
+   lastLeafIndex(0)
+{
+   for (unsigned int level = 0; level < numLevels-1; level++)
+   {
+      tables[level] = new DAGNodeTable(DAG_STREAM_TABLE_SIZE);
+   }
+}
+
+DAGStreamBuilder::~DAGStreamBuilder()
+{
+   for (unsigned int level = 0; level < numLevels-1; level++)
+   {
+      freeTable(level);
+   }
+}
+
+/**
+ * Adds the next non-empty leaf word. The leaf indexes (voxel Morton code / 64) must be
+ * increasing.
+ */
+void DAGStreamBuilder::addLeaf(uint64_t leafIndex, uint64_t leaf)
+{
+   if (numLeafs > 0 && leafIndex <= lastLeafIndex)
+   {
+      std::string err("\nLeafs were not streamed in Morton order\n");
+      std::cerr << err;
+      throw std::out_of_range(err);
+   }
+
+   unsigned int leafLevel = numLevels-2;
+   addChild(leafLevel, leafIndex, insert(leafLevel, getLeafKey(leaf)));
+   lastLeafIndex = leafIndex;
+   numLeafs++;
+}
+
+/**
+ * Sets the node with the given id as a child of the pending node of the level above. A child
+ * of a different parent means the pending one has all its children, so it is flushed first.
+ */
+void DAGStreamBuilder::addChild(unsigned int level, uint64_t index, uint64_t id)
+{
+   if (level == 0)
+   {
+      return;
+   }
+
+   uint64_t parentIndex = index >> 3;
+   unsigned int childIndex = index & 7;
+
+   if (hasPending[level] && pendingIndexes[level] != parentIndex)
+   {
+      flush(level);
+   }
+   if (!hasPending[level])
+   {
+      pendingKeys[level] = getLeafKey(0);
+      pendingIndexes[level] = parentIndex;
+      hasPending[level] = true;
+   }
+
+   pendingKeys[level].mask |= 1 << childIndex;
+   pendingKeys[level].childIds[childIndex] = id;
+}
+
+/**
+ * Hash-conses the pending parent of the children at level and adds it to the level above.
+ */
+void DAGStreamBuilder::flush(unsigned int level)
+{
+   uint64_t id = insert(level-1, pendingKeys[level]);
+   hasPending[level] = false;
+   addChild(level-1, pendingIndexes[level], id);
+}
+
+/**
+ * Flushes the pending nodes of every level once the last leaf is added, bottom up, which
+ * leaves the root as the only node of level 0.
+ */
+void DAGStreamBuilder::finish()
+{
+   if (numLeafs == 0)
+   {
+      std::string err("\nNo voxels were filled\n");
+      std::cerr << err;
+      throw std::out_of_range(err);
+   }
+
+   for (unsigned int level = numLevels-2; level > 0; level--)
+   {
+      if (hasPending[level])
+      {
+         flush(level);
+      }
+   }
+}
+
+/**
+ * Hash-conses a complete node of level and returns its id, with the mirror it is seen through 
+ * in the low bits for mirror reduction. The root is kept as it is, there is no parent to hold 
+ * its mirror.
+ */
+uint64_t DAGStreamBuilder::insert(unsigned int level, DAGNodeKey key)
+{
+   if (childMirrorBits == 0 || level == 0)
+   {
+      return tables[level]->insert(key);
+   }
+   unsigned int mirror = canonicalizeDAGNodeKey(key, level == numLevels-2);
+   return (tables[level]->insert(key) << childMirrorBits) | mirror;
+}
+
+/**
+ * Frees the unique nodes of a level once they are written out.
+ */
+void DAGStreamBuilder::freeTable(unsigned int level)
+{
+   delete tables[level];
+   tables[level] = NULL;
+}
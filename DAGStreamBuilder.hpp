@@ -0,0 +1,54 @@
+/**
+ * DAGStreamBuilder.hpp
+ *
+ * Builds the unique nodes of a DAG bottom up straight from the non-empty leaf words in Morton
+ * order, without building the SVO first. Each level keeps only the key of the one parent whose
+ * children are still coming in. A child with a different parent completes that key, which is
+ * then hash-consed into the level's table right away and handed up as a child of the level
+ * above. So apart from the tables of unique nodes the builder holds one pending node per level.
+ *
+ * The ids of each level come out in the order the nodes are first completed, which is Morton
+ * order, the same ids DAG::reduceLevel gives.
+ *
+ * With childMirrorBits set the nodes below the root are canonicalized before they are 
+ * hash-consed, and the id handed up carries the node's mirror in its low bits.
+ *
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */
+
+#ifndef DAG_STREAM_BUILDER_HPP
+#define DAG_STREAM_BUILDER_HPP
+
+#include <stdint.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "DAGNodeTable.hpp"
+
+#define DAG_STREAM_TABLE_SIZE 4096 // Nodes each level's table starts with room for
+
+class DAGStreamBuilder
+{
+   public:
+      unsigned int numLevels; // Levels of the volume, the leaf words are level numLevels-2
+      unsigned int childMirrorBits; // DAG_MIRROR_BITS for mirror reduction, 0 otherwise
+      std::vector<DAGNodeTable*> tables; // The unique nodes of each level, the leafs included
+      std::vector<DAGNodeKey> pendingKeys; // The node of each level still getting children
+      std::vector<uint64_t> pendingIndexes; // Its index within its level
+      std::vector<bool> hasPending;
+      uint64_t numLeafs; // Number of leaf words added
+      uint64_t lastLeafIndex;
+
+      DAGStreamBuilder(unsigned int numLevelsVal, unsigned int childMirrorBitsVal = 0);
+      ~DAGStreamBuilder();
+      void addLeaf(uint64_t leafIndex, uint64_t leaf);
+      void addChild(unsigned int level, uint64_t index, uint64_t id);
+      void flush(unsigned int level);
+      void finish();
+      void freeTable(unsigned int level);
+      uint64_t insert(unsigned int level, DAGNodeKey key);
+};
+
+#endif
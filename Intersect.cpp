@@ -397,3 +397,233 @@ bool triangleAABBIntersect(const Triangle& triangle, Vec3& p, Vec3& deltaP)
    return true;
 }
 
+
+/**
+ * Computes the plane constants and the edge normals and constants of the projections exactly 
+ * the same way triangleAABBIntersect does so both give the same answer.
+ */
+TriangleAABBSetup::TriangleAABBSetup(const Triangle& triangle, const Vec3& deltaP)
+{
+   Vec3 n(triangle.getNormal());
+   Vec3 v[3];
+   v[0] = triangle.v0;
+   v[1] = triangle.v1;
+   v[2] = triangle.v2;
+
+   normal[0] = n.x;
+   normal[1] = n.y;
+   normal[2] = n.z;
+
+   // 1) The triangle's plane overlaps the AABB
+   float cx = (n.x > 0) ? deltaP.x : 0.0f;
+   float cy = (n.y > 0) ? deltaP.y : 0.0f;
+   float cz = (n.z > 0) ? deltaP.z : 0.0f;
+
+   planeD1 = n.x*(cx - v[0].x) + n.y*(cy - v[0].y) + n.z*(cz - v[0].z);
+   planeD2 = n.x*(deltaP.x - cx - v[0].x) + n.y*(deltaP.y - cy - v[0].y) + n.z*(deltaP.z - cz - v[0].z);
+
+   // 2) The edge normals and constants of the xy, xz and yz projections
+   for (int i = 0; i <= 2; i++)
+   {
+      Vec3 e = v[(i+1) % 3] - v[i];
+      Vec2 nXY(-1.0 * e.y, e.x);
+      Vec2 nXZ(-1.0 * e.z, e.x);
+      Vec2 nYZ(-1.0 * e.z, e.y);
+
+      if (n.z < 0)
+         nXY *= -1.0;
+      if (n.y >= 0)
+         nXZ *= -1.0;
+      if (n.x < 0)
+         nYZ *= -1.0;
+
+      edgeNormals[PROJECTION_XY][i][0] = nXY.x;
+      edgeNormals[PROJECTION_XY][i][1] = nXY.y;
+      edgeD[PROJECTION_XY][i] = (-1.0 * (nXY.x*v[i].x + nXY.y*v[i].y)) + std::max(0.0f, deltaP.x*nXY.x) + std::max(0.0f, deltaP.y*nXY.y);
+
+      edgeNormals[PROJECTION_XZ][i][0] = nXZ.x;
+      edgeNormals[PROJECTION_XZ][i][1] = nXZ.y;
+      edgeD[PROJECTION_XZ][i] = (-1.0 * (nXZ.x*v[i].x + nXZ.y*v[i].z)) + std::max(0.0f, deltaP.x*nXZ.x) + std::max(0.0f, deltaP.z*nXZ.y);
+
+      edgeNormals[PROJECTION_YZ][i][0] = nYZ.x;
+      edgeNormals[PROJECTION_YZ][i][1] = nYZ.y;
+      edgeD[PROJECTION_YZ][i] = (-1.0 * (nYZ.x*v[i].y + nYZ.y*v[i].z)) + std::max(0.0f, deltaP.y*nYZ.x) + std::max(0.0f, deltaP.z*nYZ.y);
+   }
+}
+
+// The two coordinates of the box corner each projection uses
+static const int projectionAxes[3][2] = { {0, 1}, {0, 2}, {1, 2} };
+
+/**
+ * Tests whether the triangle the setup was made from intersects the box with minimum corner p.
+ */
+bool triangleAABBIntersect(const TriangleAABBSetup& setup, const Vec3& p)
+{
+   float corner[3] = {p.x, p.y, p.z};
+   float nInnerProductP = setup.normal[0]*corner[0] + setup.normal[1]*corner[1] + setup.normal[2]*corner[2];
+
+   if ((nInnerProductP + setup.planeD1) * (nInnerProductP + setup.planeD2) > 0)
+      return false;
+
+   for (int projection = 0; projection < 3; projection++)
+   {
+      float pA = corner[projectionAxes[projection][0]];
+      float pB = corner[projectionAxes[projection][1]];
+
+      for (int i = 0; i <= 2; i++)
+      {
+         const float* edgeNormal = setup.edgeNormals[projection][i];
+         if ((edgeNormal[0]*pA + edgeNormal[1]*pB) + setup.edgeD[projection][i] < 0)
+            return false;
+      }
+   }
+
+   return true;
+}
+
+
+/////////////////*************************** ROWS *************************************///////////////////////////
+
+// Thin wrappers so the row test below is written once for every instruction set. The widest 
+// one the compiler targets is used: 16 lanes with AVX-512, 8 with AVX2 and 4 with SSE2. Every
+// comparison returns one bit per lane.
+#if defined(__AVX512F__)
+
+#define ROW_LANES 16
+typedef __m512 FloatLanes;
+
+static inline FloatLanes lanesSet(float value) { return _mm512_set1_ps(value); }
+static inline FloatLanes lanesAdd(FloatLanes a, FloatLanes b) { return _mm512_add_ps(a, b); }
+static inline FloatLanes lanesMul(FloatLanes a, FloatLanes b) { return _mm512_mul_ps(a, b); }
+static inline unsigned int lanesLessThanZero(FloatLanes a) { return _mm512_cmp_ps_mask(a, _mm512_setzero_ps(), _CMP_LT_OQ); }
+static inline unsigned int lanesGreaterThanZero(FloatLanes a) { return _mm512_cmp_ps_mask(a, _mm512_setzero_ps(), _CMP_GT_OQ); }
+static inline FloatLanes lanesIndices(unsigned int first)
+{
+   __m512i offsets = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+   return _mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_set1_epi32(first), offsets));
+}
+
+#elif defined(__AVX2__)
+
+#define ROW_LANES 8
+typedef __m256 FloatLanes;
+
+static inline FloatLanes lanesSet(float value) { return _mm256_set1_ps(value); }
+static inline FloatLanes lanesAdd(FloatLanes a, FloatLanes b) { return _mm256_add_ps(a, b); }
+static inline FloatLanes lanesMul(FloatLanes a, FloatLanes b) { return _mm256_mul_ps(a, b); }
+static inline unsigned int lanesLessThanZero(FloatLanes a) { return _mm256_movemask_ps(_mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_LT_OQ)); }
+static inline unsigned int lanesGreaterThanZero(FloatLanes a) { return _mm256_movemask_ps(_mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GT_OQ)); }
+static inline FloatLanes lanesIndices(unsigned int first)
+{
+   __m256i offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+   return _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(first), offsets));
+}
+
+#elif defined(__SSE2__)
+
+#define ROW_LANES 4
+typedef __m128 FloatLanes;
+
+static inline FloatLanes lanesSet(float value) { return _mm_set1_ps(value); }
+static inline FloatLanes lanesAdd(FloatLanes a, FloatLanes b) { return _mm_add_ps(a, b); }
+static inline FloatLanes lanesMul(FloatLanes a, FloatLanes b) { return _mm_mul_ps(a, b); }
+static inline unsigned int lanesLessThanZero(FloatLanes a) { return _mm_movemask_ps(_mm_cmplt_ps(a, _mm_setzero_ps())); }
+static inline unsigned int lanesGreaterThanZero(FloatLanes a) { return _mm_movemask_ps(_mm_cmpgt_ps(a, _mm_setzero_ps())); }
+static inline FloatLanes lanesIndices(unsigned int first)
+{
+   __m128i offsets = _mm_setr_epi32(0, 1, 2, 3);
+   return _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(first), offsets));
+}
+
+#endif
+
+/**
+ * Tests the triangle the setup was made from against a row of up to 64 boxes along the given 
+ * axis (0 = x, 1 = y, 2 = z). The other two coordinates of every box's minimum corner come from 
+ * p, and box k's coordinate along the axis is axisMin + (start + k) * width, which is how the 
+ * voxelizer places voxels. Bit k of the result is set if box k intersects the triangle.
+ *
+ * The projection that does not contain the axis is the same for the whole row so it is only 
+ * tested once. The plane and the other two projections are tested ROW_LANES boxes at a time.
+ */
+uint64_t triangleAABBIntersectRow(const TriangleAABBSetup& setup, const Vec3& p, int axis, float axisMin, float width, unsigned int start, unsigned int count)
+{
+   float corner[3] = {p.x, p.y, p.z};
+   uint64_t hits = 0;
+
+   if (count == 0)
+      return 0;
+
+   // The projection that does not vary along the row
+   int fixedProjection = (axis == 0) ? PROJECTION_YZ : ((axis == 1) ? PROJECTION_XZ : PROJECTION_XY);
+   for (int i = 0; i <= 2; i++)
+   {
+      const float* edgeNormal = setup.edgeNormals[fixedProjection][i];
+      float pA = corner[projectionAxes[fixedProjection][0]];
+      float pB = corner[projectionAxes[fixedProjection][1]];
+      if ((edgeNormal[0]*pA + edgeNormal[1]*pB) + setup.edgeD[fixedProjection][i] < 0)
+         return 0;
+   }
+
+#if defined(ROW_LANES)
+   FloatLanes normal[3], planeD1, planeD2, axisMinLanes, widthLanes;
+   FloatLanes edgeNormals[3][3][2], edgeD[3][3];
+   FloatLanes fixedCorner[3];
+
+   for (int k = 0; k < 3; k++)
+   {
+      normal[k] = lanesSet(setup.normal[k]);
+      fixedCorner[k] = lanesSet(corner[k]);
+      for (int i = 0; i <= 2; i++)
+      {
+         edgeNormals[k][i][0] = lanesSet(setup.edgeNormals[k][i][0]);
+         edgeNormals[k][i][1] = lanesSet(setup.edgeNormals[k][i][1]);
+         edgeD[k][i] = lanesSet(setup.edgeD[k][i]);
+      }
+   }
+   planeD1 = lanesSet(setup.planeD1);
+   planeD2 = lanesSet(setup.planeD2);
+   axisMinLanes = lanesSet(axisMin);
+   widthLanes = lanesSet(width);
+
+   for (unsigned int first = 0; first < count; first += ROW_LANES)
+   {
+      FloatLanes lanesCorner[3] = {fixedCorner[0], fixedCorner[1], fixedCorner[2]};
+      lanesCorner[axis] = lanesAdd(axisMinLanes, lanesMul(lanesIndices(start + first), widthLanes));
+
+      FloatLanes nInnerProductP = lanesAdd(lanesAdd(lanesMul(normal[0], lanesCorner[0]), lanesMul(normal[1], lanesCorner[1])), lanesMul(normal[2], lanesCorner[2]));
+      unsigned int misses = lanesGreaterThanZero(lanesMul(lanesAdd(nInnerProductP, planeD1), lanesAdd(nInnerProductP, planeD2)));
+
+      for (int projection = 0; projection < 3; projection++)
+      {
+         if (projection == fixedProjection)
+            continue;
+
+         FloatLanes pA = lanesCorner[projectionAxes[projection][0]];
+         FloatLanes pB = lanesCorner[projectionAxes[projection][1]];
+         for (int i = 0; i <= 2; i++)
+         {
+            FloatLanes distance = lanesAdd(lanesMul(edgeNormals[projection][i][0], pA), lanesMul(edgeNormals[projection][i][1], pB));
+            misses |= lanesLessThanZero(lanesAdd(distance, edgeD[projection][i]));
+         }
+      }
+
+      uint64_t laneHits = (~misses) & ((1u << ROW_LANES) - 1);
+      hits |= laneHits << first;
+   }
+
+   // Clear the lanes past the end of the row
+   if (count < 64)
+      hits &= ((uint64_t)1 << count) - 1;
+#else
+   for (unsigned int k = 0; k < count; k++)
+   {
+      corner[axis] = axisMin + ((start + k) * width);
+      if (triangleAABBIntersect(setup, Vec3(corner[0], corner[1], corner[2])))
+         hits |= (uint64_t)1 << k;
+   }
+#endif
+
+   return hits;
+}
+
@@ -12,7 +12,37 @@
 #include "Vec3.hpp"
 #include <algorithm>
 
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// The projection planes used by the separating axis tests
+#define PROJECTION_XY 0
+#define PROJECTION_XZ 1
+#define PROJECTION_YZ 2
+
+/**
+ * The parts of triangleAABBIntersect that only depend on the triangle and the size of the box 
+ * (the plane constants and the edge normals and constants of the three projections). They 
+ * are computed once per triangle so testing a box only costs the dot products with its corner.
+ */
+class TriangleAABBSetup
+{
+   public:
+      float normal[3];
+      float planeD1; // n.(c - v0)
+      float planeD2; // n.((deltaP - c) - v0)
+      float edgeNormals[3][3][2]; // [projection][edge][axis of the projection]
+      float edgeD[3][3]; // [projection][edge]
+
+      TriangleAABBSetup(const Triangle& triangle, const Vec3& deltaP);
+};
+
 bool triangleAABBIntersect(const Triangle& triangle, Vec3& p, Vec3& deltaP);
+bool triangleAABBIntersect(const TriangleAABBSetup& setup, const Vec3& p);
+uint64_t triangleAABBIntersectRow(const TriangleAABBSetup& setup, const Vec3& p, int axis, float axisMin, float width, unsigned int start, unsigned int count);
 
 #endif
 
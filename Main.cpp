@@ -17,25 +17,213 @@ int main(int argc, char const *argv[])
    unsigned int imageWidth = 500;
    unsigned int imageHeight = 500;
    
+   // The first argument is an OBJ file, a built in voxel source: sdf:sphere, sdf:box, 
+   // sdf:csg or sdf:terrain, or a DAG saved with -save (*.dag), which is rendered as is 
+   // without loading a mesh or voxelizing. A saved DAG keeps the levels it was built with.
    std::string filePath(argv[1]);
-   OBJFile objFile(filePath);
    unsigned int numLevels = atoi(argv[2]);
-   objFile.centerMesh();
+   OBJFile* objFile = NULL;
+   VoxelSource* voxelSource = NULL;
+   bool isDAGFile = isDAGFilePath(filePath);
+   if (isVoxelSourcePath(filePath))
+   {
+      voxelSource = createVoxelSource(filePath);
+   }
+   else if (!isDAGFile)
+   {
+      objFile = new OBJFile(filePath);
+      objFile->centerMesh();
+   }
+
+   // Optional arguments:
+   //   -threads <n>  Limit the number of worker threads used to build and render
+   //   -scaling      Time voxelization with 1 to n threads and exit
+   //   -dagscaling   Time the DAG reduction with 1 to n threads and exit
+   //   -mortonbench  Time the Morton code encoders and decoders and exit
+   //   -moxelbench   Build the DAG, time looking up filled voxels and their moxel indexes and exit
+   //   -verify       Build the DAG, check it against the voxelization and exit (1 on errors)
+   //   -mirrorbench  Reduce the SVO with and without mirror reduction, compare the two DAGs and exit
+   //   -save <file>  Save the DAG with its moxel table and materials to file (*.dag) to render later
+   //   -workers <n>  Render a saved DAG in n processes sharing one mapped copy, print their memory and exit
+   //   -voxelizer <bruteforce|scanline>  Choose how triangles are voxelized
+   //   -build <chunked|topdown>  Choose how the volume is split up while voxelizing
+   //   -schedule <fileorder|morton>  Choose the order triangles are handed to the threads
+   //   -dagbuild <reduce|stream>  Reduce a whole SVO, or hash-cons the leafs as they are voxelized (chunked mesh surface only)
+   //   -reduction <exact|mirror>  Share only equal nodes, or also nodes that mirror each other
+   //   -voxelcache   Reuse the voxelization cached in ./voxelCache, creating it if missing
+   //   -solid        Fill the inside of the (watertight) mesh as well as its surface
+   //   -memory <MB>  Memory budget for the dense voxels of one chunk, 0 for no limit (default 1024)
+   //   -lossy <n[,n...]>  Merge nodes differing in at most n voxels, per level from the leafs up (reduce only)
+   BuildOptions options;
+   unsigned int numThreads = tbb::task_scheduler_init::default_num_threads();
+   bool runScalingBenchmark = false;
+   bool runDAGScalingBenchmark = false;
+   bool runMortonBenchmark = false;
+   bool runMoxelBenchmark = false;
+   bool runVerify = false;
+   bool runMirrorBenchmark = false;
+   std::string saveFilePath;
+   unsigned int numWorkers = 0;
+   for (int i = 3; i < argc; i++)
+   {
+      if (strcmp(argv[i], "-threads") == 0 && i+1 < argc)
+      {
+         numThreads = atoi(argv[++i]);
+      }
+      else if (strcmp(argv[i], "-scaling") == 0)
+      {
+         runScalingBenchmark = true;
+      }
+      else if (strcmp(argv[i], "-dagscaling") == 0)
+      {
+         runDAGScalingBenchmark = true;
+      }
+      else if (strcmp(argv[i], "-mortonbench") == 0)
+      {
+         runMortonBenchmark = true;
+      }
+      else if (strcmp(argv[i], "-moxelbench") == 0)
+      {
+         runMoxelBenchmark = true;
+      }
+      else if (strcmp(argv[i], "-verify") == 0)
+      {
+         runVerify = true;
+      }
+      else if (strcmp(argv[i], "-mirrorbench") == 0)
+      {
+         runMirrorBenchmark = true;
+      }
+      else if (strcmp(argv[i], "-save") == 0 && i+1 < argc)
+      {
+         saveFilePath = argv[++i];
+         if (!isDAGFilePath(saveFilePath))
+         {
+            cerr << "-save needs a " << DAG_FILE_EXTENSION << " file" << endl;
+            exit(1);
+         }
+      }
+      else if (strcmp(argv[i], "-workers") == 0 && i+1 < argc)
+      {
+         numWorkers = atoi(argv[++i]);
+      }
+      else if (options.parseArgument(argc, argv, i))
+      {
+         continue;
+      }
+      else
+      {
+         cerr << "Unknown argument: " << argv[i] << endl;
+         exit(1);
+      }
+   }
+
+   if (runMortonBenchmark)
+   {
+      benchmarkMortonCodes(numLevels);
+      return 0;
+   }
+
+   if ((runScalingBenchmark || runDAGScalingBenchmark || runVerify || runMirrorBenchmark) && objFile == NULL)
+   {
+      cerr << "-scaling, -dagscaling, -verify and -mirrorbench need a mesh" << endl;
+      exit(1);
+   }
+
+   if (options.isLossy() && options.dagBuildMode == DAG_BUILD_STREAM)
+   {
+      cerr << "-lossy needs the whole SVO, use -dagbuild reduce" << endl;
+      exit(1);
+   }
+
+   // Only the chunked surface voxelization of a mesh hands its leafs to the stream chunk by 
+   // chunk, the other builders collect every leaf first
+   if (options.dagBuildMode == DAG_BUILD_STREAM && (options.solid || options.useVoxelCache 
+    || options.voxelBuildMode != BUILD_CHUNKED || voxelSource != NULL))
+   {
+      cerr << "-dagbuild stream needs -build chunked and a mesh, without -solid or -voxelcache" << endl;
+      exit(1);
+   }
+
+   if (numWorkers > 0)
+   {
+      if (!isDAGFile)
+      {
+         cerr << "-workers needs a saved DAG (*" << DAG_FILE_EXTENSION << ")" << endl;
+         exit(1);
+      }
+      // Each worker starts its own threads after the fork
+      return benchmarkSharedWorkers(filePath, options, numWorkers, numThreads, imageWidth, imageHeight) ? 0 : 1;
+   }
+
+   if (runScalingBenchmark)
+   {
+      benchmarkVoxelizationScaling(numLevels, objFile->getBoundingBox(), objFile->getTriangles(), filePath, options, numThreads);
+      return 0;
+   }
+
+   if (runDAGScalingBenchmark)
+   {
+      benchmarkDAGScaling(numLevels, objFile->getBoundingBox(), objFile->getTriangles(), filePath, options, numThreads);
+      return 0;
+   }
+
+   tbb::task_scheduler_init init(numThreads);
+
+   if (runVerify)
+   {
+      return verifyDAG(numLevels, objFile->getBoundingBox(), objFile->getTriangles(), filePath, objFile->materials, options) ? 0 : 1;
+   }
+
+   if (runMirrorBenchmark)
+   {
+      return benchmarkMirrorReduction(numLevels, objFile->getBoundingBox(), objFile->getTriangles(), filePath, options) ? 0 : 1;
+   }
 
    cout << "************************************************************************" << endl;
    cout << "************************************************************************" << endl;
    cout << endl;
    cout << argv[1] << endl << endl;
-   cout << "Levels: " << numLevels << endl;
 
-   DAG dag(numLevels, objFile.getBoundingBox(), objFile.getTriangles(), filePath, objFile.materials);
+   DAG* dag;
+   if (isDAGFile)
+   {
+      dag = new DAG(filePath, options);
+      cout << "Levels: " << dag->numLevels << endl;
+   }
+   else
+   {
+      cout << "Levels: " << numLevels << endl;
+      options.print();
+      if (voxelSource != NULL)
+      {
+         dag = new DAG(numLevels, voxelSource, getVoxelSourceMaterials(), options);
+      }
+      else
+      {
+         dag = new DAG(numLevels, objFile->getBoundingBox(), objFile->getTriangles(), filePath, objFile->materials, options);
+      }
+   }
+   if (!saveFilePath.empty() && !dag->save(saveFilePath))
+   {
+      exit(1);
+   }
    if (argc == 3)
    {
-      //dag.writeImages();
+      //dag->writeImages();
+   }
+
+   if (runMoxelBenchmark)
+   {
+      benchmarkMoxelIndex(dag);
+      delete dag;
+      delete voxelSource;
+      delete objFile;
+      return 0;
    }
 
    auto start = chrono::steady_clock::now();
-   Raytracer raytracer(imageWidth, imageHeight, &dag);
+   Raytracer raytracer(imageWidth, imageHeight, dag);
    raytracer.trace();
    raytracer.writeImage("images/raytraced/image.tga");
    auto end = chrono::steady_clock::now();
@@ -47,5 +235,9 @@ int main(int argc, char const *argv[])
    cout << "************************************************************************" << endl;
    cout << endl << endl << endl;
 
+   // The DAG uses the voxel source, so it goes first
+   delete dag;
+   delete voxelSource;
+   delete objFile;
    return 0;
 }
\ No newline at end of file
@@ -13,12 +13,17 @@
 #include "Triangle.hpp"
 #include "Intersect.hpp"
 #include "Voxels.hpp"
+#include "VoxelSource.hpp"
 #include "SparseVoxelOctree.hpp"
 #include "SVONode.hpp"
 #include "DAG.hpp"
+#include "BuildOptions.hpp"
 #include "Raytracer.hpp"
 #include "MortonCode.hpp"
+#include "Benchmark.hpp"
+#include "tbb/task_scheduler_init.h"
 #include <chrono>
+#include <string.h>
 
 using namespace std;
 
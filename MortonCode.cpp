@@ -6,22 +6,97 @@
 
 #include "MortonCode.hpp"
 
-uint32_t mortonCode(unsigned int x, unsigned int y, unsigned int z, unsigned int level)
+/**
+ * Returns the Morton code of the voxel at x, y and z with the bits of x, y and z interleaved 
+ * as ...zyxzyx. Only the low level bits of each coordinate are used, up to MORTON_MAX_LEVEL.
+ *
+ * Uses BMI2's pdep to deposit each coordinate's bits in one instruction when the CPU has it 
+ * and the magic bits of splitBy3 otherwise. Either way it takes the same time for any level.
+ */
+uint64_t mortonCode(unsigned int x, unsigned int y, unsigned int z, unsigned int level)
+{
+   uint64_t levelMask = (level >= MORTON_MAX_LEVEL) ? 0x1FFFFF : (((uint64_t)1 << level) - 1);
+
+#if defined(__BMI2__)
+   return _pdep_u64(x & levelMask, MORTON_X_MASK) 
+    | _pdep_u64(y & levelMask, MORTON_X_MASK << 1) 
+    | _pdep_u64(z & levelMask, MORTON_X_MASK << 2);
+#else
+   return splitBy3(x & levelMask) | (splitBy3(y & levelMask) << 1) | (splitBy3(z & levelMask) << 2);
+#endif
+}
+
+/**
+ * Sets x, y and z to the coordinates of the voxel with the given Morton code. The inverse of 
+ * mortonCode using pext or compactBy3.
+ */
+void mortonCodeToXYZ(uint64_t mortonCode, unsigned int *x, unsigned int *y, unsigned int *z, unsigned int level)
+{
+   uint64_t levelMask = (level >= MORTON_MAX_LEVEL) ? ~0ULL : (((uint64_t)1 << (3 * level)) - 1);
+   mortonCode &= levelMask;
+
+#if defined(__BMI2__)
+   *x = _pext_u64(mortonCode, MORTON_X_MASK);
+   *y = _pext_u64(mortonCode, MORTON_X_MASK << 1);
+   *z = _pext_u64(mortonCode, MORTON_X_MASK << 2);
+#else
+   *x = compactBy3(mortonCode);
+   *y = compactBy3(mortonCode >> 1);
+   *z = compactBy3(mortonCode >> 2);
+#endif
+}
+
+/**
+ * Spreads the low 21 bits of value out so there are two 0 bits between each of them.
+ */
+uint64_t splitBy3(uint64_t value)
 {
-   uint32_t answer = 0;
+   value &= 0x1FFFFF;
+   value = (value | (value << 32)) & 0x001F00000000FFFFULL;
+   value = (value | (value << 16)) & 0x001F0000FF0000FFULL;
+   value = (value | (value << 8)) & 0x100F00F00F00F00FULL;
+   value = (value | (value << 4)) & 0x10C30C30C30C30C3ULL;
+   value = (value | (value << 2)) & MORTON_X_MASK;
+   return value;
+}
+
+/**
+ * Gathers every third bit of value, starting with bit 0, into its low 21 bits. The inverse 
+ * of splitBy3.
+ */
+uint64_t compactBy3(uint64_t value)
+{
+   value &= MORTON_X_MASK;
+   value = (value | (value >> 2)) & 0x10C30C30C30C30C3ULL;
+   value = (value | (value >> 4)) & 0x100F00F00F00F00FULL;
+   value = (value | (value >> 8)) & 0x001F0000FF0000FFULL;
+   value = (value | (value >> 16)) & 0x001F00000000FFFFULL;
+   value = (value | (value >> 32)) & 0x1FFFFF;
+   return value;
+}
+
+/**
+ * Bit by bit version of mortonCode, O(level). Kept as the reference for the benchmark.
+ */
+uint64_t mortonCodeLoop(unsigned int x, unsigned int y, unsigned int z, unsigned int level)
+{
+   uint64_t answer = 0;
    unsigned int i;
 
    for (i = 0; i < level; ++i)
    {
-      answer |= ((x & ((uint32_t)1 << i)) << 2*i) 
-       | ((y & ((uint32_t)1 << i)) << (2*i + 1)) 
-       | ((z & ((uint32_t)1 << i)) << (2*i + 2));
+      answer |= (((uint64_t)x & ((uint64_t)1 << i)) << 2*i) 
+       | (((uint64_t)y & ((uint64_t)1 << i)) << (2*i + 1)) 
+       | (((uint64_t)z & ((uint64_t)1 << i)) << (2*i + 2));
    }
    
    return answer;
 }
 
-void mortonCodeToXYZ(uint32_t mortonCode, unsigned int *x, unsigned int *y, unsigned int *z, unsigned int level)
+/**
+ * Bit by bit version of mortonCodeToXYZ, O(level). Kept as the reference for the benchmark.
+ */
+void mortonCodeToXYZLoop(uint64_t mortonCode, unsigned int *x, unsigned int *y, unsigned int *z, unsigned int level)
 {
    unsigned int i;
    *x = 0;
@@ -30,9 +105,9 @@ void mortonCodeToXYZ(uint32_t mortonCode, unsigned int *x, unsigned int *y, unsi
 
    for (i = 0; i < level; ++i)
    {
-      *x |= (mortonCode & ((uint32_t)1 << 3*i)) >> (2*i);
-      *y |= (mortonCode & ((uint32_t)1 << (3*i + 1))) >> (2*i+1);
-      *z |= (mortonCode & ((uint32_t)1 << (3*i + 2))) >> (2*i+2);
+      *x |= (mortonCode & ((uint64_t)1 << 3*i)) >> (2*i);
+      *y |= (mortonCode & ((uint64_t)1 << (3*i + 1))) >> (2*i+1);
+      *z |= (mortonCode & ((uint64_t)1 << (3*i + 2))) >> (2*i+2);
    }
 }
 
@@ -9,7 +9,18 @@
 #include <iostream>
 #include <math.h>
 
-uint32_t mortonCode(unsigned int x, unsigned int y, unsigned int z, unsigned int level);
-void mortonCodeToXYZ(uint32_t mortonCode, unsigned int *x, unsigned int *y, unsigned int *z, unsigned int level);
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+#define MORTON_MAX_LEVEL 21 // 3 * 21 bits fit in a uint64_t
+#define MORTON_X_MASK 0x1249249249249249ULL // Every third bit starting at bit 0 (x), 21 bits
+
+uint64_t mortonCode(unsigned int x, unsigned int y, unsigned int z, unsigned int level);
+void mortonCodeToXYZ(uint64_t mortonCode, unsigned int *x, unsigned int *y, unsigned int *z, unsigned int level);
+uint64_t mortonCodeLoop(unsigned int x, unsigned int y, unsigned int z, unsigned int level);
+void mortonCodeToXYZLoop(uint64_t mortonCode, unsigned int *x, unsigned int *y, unsigned int *z, unsigned int level);
+uint64_t splitBy3(uint64_t value);
+uint64_t compactBy3(uint64_t value);
 void printBinary(uint32_t value);
 void printBinary(uint32_t value, unsigned int level);
@@ -7,61 +7,64 @@
 #include "SVONode.hpp"
 
 SVONode::SVONode()
+ : data(0)
+{
+}
+
+SVONode::SVONode(unsigned int childMask, uint64_t firstChild)
+ : data((firstChild << SVO_NODE_MASK_BITS) | (childMask & 0xff))
 {
-   for (int i = 0; i < 8; i++)
-   {
-      childPointers[i] = NULL;
-   }
 }
 
 SVONode::~SVONode()
 {
 }
 
+unsigned int SVONode::getChildMask() const
+{
+   return data & 0xff;
+}
+
+uint64_t SVONode::getFirstChild() const
+{
+   return data >> SVO_NODE_MASK_BITS;
+}
+
+bool SVONode::isChildSet(unsigned int i) const
+{
+   return (data & ((uint64_t)1 << i)) != 0;
+}
+
+/**
+ * Returns the index of child i, which has to be set, in the level below.
+ */
+uint64_t SVONode::getChildIndex(unsigned int i) const
+{
+   return getFirstChild() + countSetBitsBelow(getChildMask(), i);
+}
+
+unsigned int SVONode::getNumChildren() const
+{
+   return countSetBits(getChildMask());
+}
+
 // Returns true if the current object is less than the other object
 // Used for sorting
 bool SVONode::operator< ( const SVONode & other ) const 
 { 
-   for (int i = 0; i < 8; i++)
-   {
-      if (childPointers[i] < other.childPointers[i])
-      {
-         return true;
-      }
-      else if (childPointers[i] > other.childPointers[i])
-      {
-         return false;
-      }
-   }
-   return false;
+   return data < other.data;
 }
 
 // Returns true if the current object is not equal to the other object
-// Used in reduction
 bool SVONode::operator!= ( const SVONode & other ) const 
 { 
-   for (int i = 0; i < 8; i++)
-   {
-      if (childPointers[i] != other.childPointers[i])
-      {
-         return true;
-      }
-   }
-   return false;
+   return data != other.data;
 }
 
-// Returns true if the current object is not equal to the other object
-// Used in reduction
+// Returns true if the current object is equal to the other object
 bool SVONode::operator== ( const SVONode & other ) const 
 { 
-   for (int i = 0; i < 8; i++)
-   {
-      if (childPointers[i] != other.childPointers[i])
-      {
-         return false;
-      }
-   }
-   return true;
+   return data == other.data;
 }
 
 void SVONode::print()
@@ -69,7 +72,10 @@ void SVONode::print()
    std::cerr << "SVONode: " << std::endl;
    for (int i = 0; i < 8; ++i)
    {
-      std::cerr << "\t" << childPointers[i] << std::endl;
+      if (isChildSet(i))
+      {
+         std::cerr << "\t" << i << ": " << getChildIndex(i) << std::endl;
+      }
    }
 }
 
@@ -77,7 +83,14 @@ void SVONode::printOneLine()
 {
    for (int i = 0; i < 8; ++i)
    {
-      std::cout << childPointers[i] << " ";
+      if (isChildSet(i))
+      {
+         std::cout << getChildIndex(i) << " ";
+      }
+      else
+      {
+         std::cout << "- ";
+      }
    }
    std::cout << std::endl;
-}
\ No newline at end of file
+}
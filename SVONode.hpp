@@ -1,6 +1,11 @@
 /**
  * SVONode.hpp
  * 
+ * A node of the compact SVO in one uint64_t: the mask of its non-empty children in the low 
+ * 8 bits and the index of its first child in the level below in the upper 56 bits. The 
+ * children of a node are next to each other in their level in Morton order, so child i is 
+ * at the first child's index plus the number of set mask bits below i.
+ *
  * @author Brent Williams brent.robert.williams@gmail.com
  */ 
 
@@ -10,13 +15,23 @@
 #include <iostream>
 #include <stdint.h>
 
+#include "BitCount.hpp"
+
+#define SVO_NODE_MASK_BITS 8
+
 class SVONode
 {
    public:
-      void* childPointers[8];
+      uint64_t data;
 
       SVONode();
+      SVONode(unsigned int childMask, uint64_t firstChild);
       ~SVONode();
+      unsigned int getChildMask() const;
+      uint64_t getFirstChild() const;
+      bool isChildSet(unsigned int i) const;
+      uint64_t getChildIndex(unsigned int i) const;
+      unsigned int getNumChildren() const;
       bool operator< ( const SVONode & val ) const;
       bool operator!= ( const SVONode & other ) const;
       bool operator== ( const SVONode & other ) const;
@@ -9,12 +9,13 @@
 /**
  * Instantiates and initializes the SVO.
  */
-SparseVoxelOctree::SparseVoxelOctree(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath)
+SparseVoxelOctree::SparseVoxelOctree(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath, const BuildOptions& optionsVal)
  : boundingBox(boundingBoxVal),
    numLevels(levelsVal),
    size(pow(8, levelsVal)), 
    dimension(pow(2,levelsVal)),
-   voxelWidth(0)
+   voxelWidth(0),
+   options(optionsVal)
 {
    if (numLevels <= 2)
    {
@@ -26,114 +27,209 @@ SparseVoxelOctree::SparseVoxelOctree(const unsigned int levelsVal, const Boundin
    boundingBox.square();
    voxelWidth = (boundingBox.maxs.x - boundingBox.mins.x) / dimension;
    levels = new void*[numLevels-1]; // has the -1 because the last two levels are uint64's 
-   levelSizes = new unsigned int[numLevels-1]();
+   levelSizes = new uint64_t[numLevels-1]();
    build(triangles,meshFilePath);
 }
 
+/**
+ * Instantiates the SVO of a voxel source, spanning the source's bounding box.
+ */
+SparseVoxelOctree::SparseVoxelOctree(const unsigned int levelsVal, const VoxelSource& source, const BuildOptions& optionsVal)
+ : boundingBox(source.getBoundingBox()),
+   numLevels(levelsVal),
+   size(pow(8, levelsVal)), 
+   dimension(pow(2,levelsVal)),
+   voxelWidth(0),
+   options(optionsVal)
+{
+   if (numLevels <= 2)
+   {
+      std::string err("\nNumber of levels too small\n");
+      std::cerr << err;
+      throw std::out_of_range(err);
+   }
+   
+   boundingBox.square();
+   voxelWidth = (boundingBox.maxs.x - boundingBox.mins.x) / dimension;
+   levels = new void*[numLevels-1]; // has the -1 because the last two levels are uint64's 
+   levelSizes = new uint64_t[numLevels-1]();
+   build(source);
+}
+
 /**
  * Free any allocated data and clean up
  */
 SparseVoxelOctree::~SparseVoxelOctree()
 {
-   
+   for (unsigned int i = 0; i < numLevels-2; i++)
+   {
+      delete [] (SVONode*)levels[i];
+   }
+   delete voxels;
+   delete voxelTriangleIndex;
+   delete [] levels;
+   delete [] levelSizes;
 }
 
 /**
- * Build the SVO that works for >= 4 levels.
- *
- * Tested: 2-16-2014 
+ * Voxelizes the triangles and builds the SVO from the voxels.
  */
 void SparseVoxelOctree::build(const std::vector<Triangle> triangles, std::string meshFilePath)
 {
    auto start = chrono::steady_clock::now();
-   Voxels* leafVoxels = new Voxels(numLevels, boundingBox, triangles, meshFilePath);
+   Voxels* leafVoxels = new Voxels(numLevels, boundingBox, triangles, meshFilePath, options);
+   auto end = chrono::steady_clock::now();
+   auto diff = end - start;
+   cout << "\t\tTime Voxelization (" << options.getVoxelizationModeName() << ", " << options.getVoxelBuildModeName() << "): " << chrono::duration <double, milli> (diff).count() << " ms" << endl;
+
+   buildLevels(leafVoxels);
+}
+
+/**
+ * Voxelizes the source and builds the SVO from the voxels.
+ */
+void SparseVoxelOctree::build(const VoxelSource& source)
+{
+   auto start = chrono::steady_clock::now();
+   Voxels* leafVoxels = new Voxels(numLevels, source, options);
    auto end = chrono::steady_clock::now();
    auto diff = end - start;
-   cout << "\t\tTime Voxelization: " << chrono::duration <double, milli> (diff).count() << " ms" << endl;
+   cout << "\t\tTime Voxelization (source): " << chrono::duration <double, milli> (diff).count() << " ms" << endl;
 
+   buildLevels(leafVoxels);
+}
+
+/**
+ * Build the SVO that works for >= 4 levels from the compact leafs of the voxels, so every 
+ * level only holds its non-empty nodes.
+ *
+ * Tested: 2-16-2014 
+ */
+void SparseVoxelOctree::buildLevels(Voxels* leafVoxels)
+{
    auto svoStartTime = chrono::steady_clock::now();
-   uint64_t* leafVoxelData = leafVoxels->data;
-   unsigned int numLeafs = leafVoxels->dataSize;
+   uint64_t* leafVoxelData = leafVoxels->leafs;
+   uint64_t numLeafs = leafVoxels->numLeafs;
 
-   voxelTriangleIndexMap = leafVoxels->voxelTriangleIndexMap;
+   voxels = leafVoxels;
+   voxelTriangleIndex = leafVoxels->voxelTriangleIndex;
    
    // std::cout << "levels: " << numLevels << "\n";
    // std::cout << "Number of leaf nodes: " << numLeafs << "\n";
 
-   // Save the pointer to the leaf nodes
-   unsigned int currentLevel = numLevels-2;
-   levels[currentLevel] = (void*)leafVoxelData; 
-   cerr << "Leaf Level = " << currentLevel << endl;
-   currentLevel--;
-   
    if (numLevels <= 3)
    {
       std::cerr << "CANNOT build SVO with levels <= 3.\nExitting...\n";
       exit(EXIT_FAILURE);
    }
-   
-   int numPrevLevelNodes = numLeafs; //512
-   int numCurrLevelNodes = numPrevLevelNodes / 8; //64
-   SVONode* prevLevelNodes;
-   SVONode* currLevelNodes; 
-   currLevelNodes = new SVONode[numCurrLevelNodes](); 
-   levelSizes[numLevels-2] = 0;
-
-   // Set the level above the leaf nodes
-   for (int i = 0; i < numPrevLevelNodes; i++)
+
+   if (numLeafs == 0 && leafVoxels->fullNodes.empty())
    {
-      if (leafVoxelData[i] > 0)
-      {
-         currLevelNodes[i/8].childPointers[i%8] = (void *)  &(leafVoxelData[i]);
-         levelSizes[numLevels-2]++;
-      }
+      std::string err("\nNo voxels were filled by the mesh\n");
+      std::cerr << err;
+      throw std::out_of_range(err);
    }
 
-   levels[currentLevel] = (void*)currLevelNodes;
-   //levelSizes[currentLevel] = numCurrLevelNodes * sizeof(SVONode);
-   currentLevel--;
+   // The full nodes of a solid source go into their levels as they are reached. Every level 
+   // below the highest full node ends in one block of 8 full nodes, after its Morton ordered 
+   // nodes, that the full nodes of the level above all point at. The leafs' block of full 
+   // words is already after the leafs.
+   unsigned int leafLevel = numLevels-2;
+   unsigned int topFullLevel = leafLevel;
+   std::vector< std::vector<uint64_t> > fullNodeIndices(leafLevel);
+   for (uint64_t i = 0; i < leafVoxels->fullNodes.size(); i++)
+   {
+      const FullNode& fullNode = leafVoxels->fullNodes[i];
+      fullNodeIndices[fullNode.level].push_back(fullNode.mortonIndex);
+      topFullLevel = std::min(topFullLevel, fullNode.level);
+   }
+
+   // Save the pointer to the leaf nodes
+   unsigned int currentLevel = leafLevel;
+   levels[currentLevel] = (void*)leafVoxelData; 
+   levelSizes[currentLevel] = numLeafs + ((topFullLevel < currentLevel) ? 8 : 0);
+   cerr << "Leaf Level = " << currentLevel << endl;
+
+   // Only the non-empty nodes of each level are stored, in Morton order. childIndices holds 
+   // the Morton index of each node of the level below within its level.
+   uint64_t* childIndices = leafVoxels->leafIndices;
+   uint64_t numChildren = numLeafs;
    
-   // Set the rest of the non leaf nodes
-   while(numCurrLevelNodes >= 64)
+   while (currentLevel > 0)
    {
-      numPrevLevelNodes = numCurrLevelNodes; //64
-      numCurrLevelNodes /= 8; // 8
-      prevLevelNodes = currLevelNodes;
-      currLevelNodes = new SVONode[numCurrLevelNodes];
-      //levelSizes[currentLevel] = numCurrLevelNodes * sizeof(SVONode);
-      levelSizes[currentLevel+1] = 0;
-      
-      // For each of the previous level's nodes we set the child pointers
-      for (int i = 0; i < numPrevLevelNodes; i++)
+      // Children with the same index / 8 share a parent and are next to each other, so a 
+      // parent only needs its child mask and the index of its first child. Count the parents 
+      // starting in each block of children in parallel, then turn the counts into the index 
+      // of each block's first new parent.
+      uint64_t numBlocks = (numChildren + SVO_BLOCK_SIZE - 1) / SVO_BLOCK_SIZE;
+      std::vector<uint64_t> blockOffsets(numBlocks);
+      tbb::parallel_for((uint64_t)0, numBlocks, [&](uint64_t block) {
+         uint64_t end = std::min((block + 1) * SVO_BLOCK_SIZE, numChildren);
+         uint64_t count = 0;
+         for (uint64_t i = block * SVO_BLOCK_SIZE; i < end; i++)
+         {
+            if (i == 0 || (childIndices[i] / 8) != (childIndices[i-1] / 8))
+            {
+               count++;
+            }
+         }
+         blockOffsets[block] = count;
+      });
+
+      uint64_t numParents = 0;
+      for (uint64_t block = 0; block < numBlocks; block++)
       {
-         if (isNodeNotEmpty(&prevLevelNodes[i]))
+         uint64_t count = blockOffsets[block];
+         blockOffsets[block] = numParents;
+         numParents += count;
+      }
+
+      // Make the parents. A parent is written by the task holding its first child, which 
+      // gathers the mask from the (at most 8) children that follow, so a parent whose children 
+      // straddle two blocks is still written only once.
+      SVONode* parentNodes = new SVONode[numParents];
+      uint64_t* parentIndices = new uint64_t[numParents];
+      tbb::parallel_for((uint64_t)0, numBlocks, [&](uint64_t block) {
+         uint64_t end = std::min((block + 1) * SVO_BLOCK_SIZE, numChildren);
+         uint64_t parent = blockOffsets[block];
+         for (uint64_t i = block * SVO_BLOCK_SIZE; i < end; i++)
          {
-            currLevelNodes[i/8].childPointers[i%8] = (void *)  &(prevLevelNodes[i]);
-            levelSizes[currentLevel+1]++;
+            if (i == 0 || (childIndices[i] / 8) != (childIndices[i-1] / 8))
+            {
+               unsigned int mask = 0;
+               for (uint64_t j = i; j < numChildren && (childIndices[j] / 8) == (childIndices[i] / 8); j++)
+               {
+                  mask |= 1 << (childIndices[j] % 8);
+               }
+               parentNodes[parent] = SVONode(mask, i);
+               parentIndices[parent] = childIndices[i] / 8;
+               parent++;
+            }
          }
+      });
+
+      if (childIndices != leafVoxels->leafIndices)
+      {
+         delete [] childIndices;
       }
 
-      // Save the pointer for each level's nodes in the level's array
-      levels[currentLevel] = currLevelNodes;
+      // The shared block of the level below starts right after its ordered nodes
       currentLevel--;
-   }
-   
-   // Set the root node
-   prevLevelNodes = currLevelNodes;
-   root = new SVONode;
-   levelSizes[currentLevel+1] = 0;
-   for (int i = 0; i < 8; i++)
-   {
-      if (isNodeNotEmpty(&prevLevelNodes[i]))
+      bool hasSharedBlock = topFullLevel < currentLevel;
+      if (hasSharedBlock || !fullNodeIndices[currentLevel].empty())
       {
-         root->childPointers[i] = (void *)  &(prevLevelNodes[i]);
-         levelSizes[currentLevel+1]++;
+         addFullNodes(fullNodeIndices[currentLevel], hasSharedBlock, numChildren, parentNodes, parentIndices, numParents);
       }
+      childIndices = parentIndices;
+      numChildren = numParents;
+
+      // Save the pointer for each level's nodes in the level's array
+      levels[currentLevel] = (void*)parentNodes;
+      levelSizes[currentLevel] = numParents + (hasSharedBlock ? 8 : 0);
    }
+   delete [] childIndices;
 
-   // Save the pointer for root node in the levels array
-   levels[currentLevel] = root;
-   levelSizes[currentLevel] = 1;
+   root = (SVONode*)levels[0];
 
    uint64_t totalSVOMemory = 0;
    cout << "SVO Size: " << endl;
@@ -146,6 +242,7 @@ void SparseVoxelOctree::build(const std::vector<Triangle> triangles, std::string
    totalSVOMemory += levelSizes[numLevels-2] * sizeof(uint64_t);
 
 
+   sizeWithoutMaterials = totalSVOMemory;
    cout << "SVO (without materials) Memory Size: " << totalSVOMemory << " (" << getMemorySize(totalSVOMemory) << ")" << endl;
    
    auto svoEndTime = chrono::steady_clock::now();
@@ -153,18 +250,59 @@ void SparseVoxelOctree::build(const std::vector<Triangle> triangles, std::string
    cout << "\t\tTime SVO Building: " << chrono::duration <double, milli> (svoDiff).count() << " ms" << endl;
 }
 
-string SparseVoxelOctree::getMemorySize(unsigned int size)
+/**
+ * Merges the full nodes of a level, given by their Morton indexes, into the level's Morton 
+ * ordered nodes and appends the level's shared block of 8 full nodes if it has one. All of 
+ * them point at the shared block of the level below, at childSharedBlock. The arrays are 
+ * replaced, and numNodes becomes the number of ordered nodes, without the shared block.
+ */
+void SparseVoxelOctree::addFullNodes(const std::vector<uint64_t>& fullIndices, bool hasSharedBlock, uint64_t childSharedBlock, SVONode*& nodes, uint64_t*& indices, uint64_t& numNodes)
+{
+   SVONode fullNode(SET_8_BITS, childSharedBlock);
+   uint64_t numOrdered = numNodes + fullIndices.size();
+   SVONode* mergedNodes = new SVONode[numOrdered + (hasSharedBlock ? 8 : 0)];
+   uint64_t* mergedIndices = new uint64_t[numOrdered];
+
+   uint64_t i = 0;
+   uint64_t f = 0;
+   for (uint64_t m = 0; m < numOrdered; m++)
+   {
+      if (f < fullIndices.size() && (i == numNodes || fullIndices[f] < indices[i]))
+      {
+         mergedNodes[m] = fullNode;
+         mergedIndices[m] = fullIndices[f++];
+      }
+      else
+      {
+         mergedNodes[m] = nodes[i];
+         mergedIndices[m] = indices[i++];
+      }
+   }
+   if (hasSharedBlock)
+   {
+      std::fill(mergedNodes + numOrdered, mergedNodes + numOrdered + 8, fullNode);
+   }
+
+   delete [] nodes;
+   delete [] indices;
+   nodes = mergedNodes;
+   indices = mergedIndices;
+   numNodes = numOrdered;
+}
+
+string SparseVoxelOctree::getMemorySize(uint64_t size)
 {
    string b = " B";
    string kb = " KB";
    string mb = " MB";
    string gb = " GB";
-   string units[] = {b,kb,mb,gb};
+   string tb = " TB";
+   string units[] = {b,kb,mb,gb,tb};
    float currentSize = (float)size;
    float lastSize = (float)size;
    int i;
 
-   for (i = 0; i < 4 && currentSize > 1.0f; ++i)
+   for (i = 0; i < 5 && currentSize > 1.0f; ++i)
    {
       lastSize = currentSize;
       currentSize /= 1024.0f;
@@ -181,15 +319,7 @@ string SparseVoxelOctree::getMemorySize(unsigned int size)
  */
 bool SparseVoxelOctree::isNodeNotEmpty(SVONode *node)
 {
-   for (int i = 0; i < 8; i++)
-   {
-      if (node->childPointers[i] != NULL)
-      {
-         return true;
-      }
-   }
-
-   return false;
+   return node->getChildMask() != 0;
 }
 
 
@@ -212,7 +342,7 @@ bool SparseVoxelOctree::isLeafSet(uint64_t* node, unsigned int i)
  */
 bool SparseVoxelOctree::isChildSet(SVONode *node, unsigned int i)
 {
-   return node->childPointers[i] != NULL;
+   return node->isChildSet(i);
 }
 
 
@@ -224,27 +354,33 @@ bool SparseVoxelOctree::isChildSet(SVONode *node, unsigned int i)
  */
 bool SparseVoxelOctree::isSet(unsigned int x, unsigned int y, unsigned int z)
 {
-   void* currentNode = root;
-   int currentLevel = numLevels;
-   unsigned int mortonIndex = mortonCode(x,y,z,currentLevel);
+   SVONode* currentNode = root;
+   unsigned int currentLevel = 0;
+   uint64_t mortonIndex = mortonCode(x,y,z,numLevels);
    
-   int divBy = pow(8.0f, (float)currentLevel-1);
-   int modBy = divBy;
-   int index = mortonIndex / divBy;
+   uint64_t divBy = (uint64_t)1 << (3 * (numLevels-1));
+   uint64_t modBy = divBy;
+   unsigned int index = mortonIndex / divBy;
+   uint64_t childIndex = 0;
    
    while (divBy >= 64)
    {
-      if (!isChildSet((SVONode*)currentNode, index)) 
+      if (!isChildSet(currentNode, index)) 
       {
          return false;
       }
-      currentNode = (void*) ((SVONode*)currentNode)->childPointers[index];
+      childIndex = currentNode->getChildIndex(index);
+      currentLevel++;
+      if (currentLevel < numLevels-2)
+      {
+         currentNode = ((SVONode*)levels[currentLevel]) + childIndex;
+      }
       modBy = divBy;
       divBy /= 8;
       index = (mortonIndex % modBy) / divBy;
    }
    index = mortonIndex % modBy;
-   return isLeafSet((uint64_t*)currentNode, index);
+   return isLeafSet(((uint64_t*)levels[numLevels-2]) + childIndex, index);
 }
 
 
@@ -312,21 +448,7 @@ void SparseVoxelOctree::writeImages()
  */
 unsigned int SparseVoxelOctree::countAtLevel(unsigned int level)
 {
-   unsigned int count = 0;
-   if (level == 0)
-      return 1;
-   else if (level == 1)
-   {
-      SVONode curr = *root;
-      for (int i = 0; i < 8; i++)
-      {
-         if (curr.childPointers[i] != NULL)
-         {
-            count++;
-         } 
-      }
-   }
-   return count;
+   return levelSizes[level];
 }
 
 
@@ -15,16 +15,19 @@
 #include "SparseVoxelOctree.hpp"
 #include "SVONode.hpp"
 #include "Image.hpp"
+#include "BuildOptions.hpp"
 
 #include <vector>
 #include <stdint.h>
 #include <string>
 #include <unordered_map>
-#include "tbb/concurrent_unordered_map.h"
 
 #include <chrono>
+#include <algorithm>
+#include "tbb/tbb.h"
 
 #define SET_8_BITS 255
+#define SVO_BLOCK_SIZE 65536 // Number of children linked to their parents by one task
 
 using namespace std;
 
@@ -33,9 +36,13 @@ class SparseVoxelOctree
    private:
       //Fix later
    public:
-      SparseVoxelOctree(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath);
+      SparseVoxelOctree(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath, const BuildOptions& optionsVal);
       ~SparseVoxelOctree();
+      SparseVoxelOctree(const unsigned int levelsVal, const VoxelSource& source, const BuildOptions& optionsVal);
       void build(const std::vector<Triangle> triangles, std::string meshFilePath);
+      void build(const VoxelSource& source);
+      void buildLevels(Voxels* leafVoxels);
+      void addFullNodes(const std::vector<uint64_t>& fullIndices, bool hasSharedBlock, uint64_t childSharedBlock, SVONode*& nodes, uint64_t*& indices, uint64_t& numNodes);
       void setVoxel(unsigned int x, unsigned int y, unsigned int z, uint64_t* activeNodes, uint64_t* nodes);
       void voxelizeTriangle(const Triangle& triangle, uint64_t* activeNodes, uint64_t* nodes);
       bool isSet(unsigned int x, unsigned int y, unsigned int z);
@@ -45,18 +52,20 @@ class SparseVoxelOctree
       void printBinary();
       void writeImages();
       unsigned int countAtLevel(unsigned int level);
-      string getMemorySize(unsigned int size);
+      string getMemorySize(uint64_t size);
       
       BoundingBox boundingBox;
       unsigned int numLevels;
       unsigned long size; // Total number of voxels if the SVO was full
       unsigned int dimension; // Number of voxels for one side of the cube
       float voxelWidth; // The length of one voxel in world space
-      void** levels; // Array of SVONode*'s that correspond to the levels of the SVO with 0 as root
+      void** levels; // The SVONode array of each level with 0 as root, and the leaf words last.
       SVONode* root;
-      tbb::concurrent_unordered_map<unsigned int, unsigned int>* voxelTriangleIndexMap;
-      unsigned int* levelSizes;
+      VoxelTriangleIndex* voxelTriangleIndex;
+      Voxels* voxels; // The voxelization, it holds the leaf level
+      uint64_t* levelSizes; // Number of non-empty nodes at a level
       uint64_t sizeWithoutMaterials;
+      BuildOptions options;
 };
 
 
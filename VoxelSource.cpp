@@ -0,0 +1,320 @@
+/**
+ * VoxelSource.cpp
+ *
+ * by Brent Williams
+ */
+
+#include "VoxelSource.hpp"
+
+VoxelSource::~VoxelSource()
+{
+}
+
+/**
+ * Returns the material of the surface nearest to the point. Sources with only one material
+ * use material 0.
+ */
+unsigned int VoxelSource::getMaterialIndex(const Vec3& /*point*/) const
+{
+   return 0;
+}
+
+/**
+ * Returns the normalized gradient of the distance at the point by central differences, or a
+ * zero vector where the gradient vanishes.
+ */
+Vec3 VoxelSource::getNormal(const Vec3& point, float epsilon) const
+{
+   Vec3 normal(
+    getDistance(Vec3(point.x + epsilon, point.y, point.z)) - getDistance(Vec3(point.x - epsilon, point.y, point.z)),
+    getDistance(Vec3(point.x, point.y + epsilon, point.z)) - getDistance(Vec3(point.x, point.y - epsilon, point.z)),
+    getDistance(Vec3(point.x, point.y, point.z + epsilon)) - getDistance(Vec3(point.x, point.y, point.z - epsilon)));
+
+   if (normal.length() > 0.0f)
+   {
+      normal.normalize();
+   }
+   return normal;
+}
+
+SphereSource::SphereSource(const Vec3& centerVal, float radiusVal, unsigned int materialIndexVal)
+ : center(centerVal),
+   radius(radiusVal),
+   materialIndex(materialIndexVal)
+{
+}
+
+float SphereSource::getDistance(const Vec3& point) const
+{
+   return (point - center).length() - radius;
+}
+
+BoundingBox SphereSource::getBoundingBox() const
+{
+   return BoundingBox(center - Vec3(radius), center + Vec3(radius));
+}
+
+unsigned int SphereSource::getMaterialIndex(const Vec3& /*point*/) const
+{
+   return materialIndex;
+}
+
+BoxSource::BoxSource(const Vec3& centerVal, const Vec3& halfExtentsVal, unsigned int materialIndexVal)
+ : center(centerVal),
+   halfExtents(halfExtentsVal),
+   materialIndex(materialIndexVal)
+{
+}
+
+/**
+ * Exact distance to an axis aligned box: the length of the part of the offset outside the box,
+ * or the (negative) distance to the nearest face inside it.
+ */
+float BoxSource::getDistance(const Vec3& point) const
+{
+   Vec3 q(fabsf(point.x - center.x) - halfExtents.x,
+    fabsf(point.y - center.y) - halfExtents.y,
+    fabsf(point.z - center.z) - halfExtents.z);
+   Vec3 outside(fmaxf(q.x, 0.0f), fmaxf(q.y, 0.0f), fmaxf(q.z, 0.0f));
+   float inside = fminf(fmaxf(q.x, fmaxf(q.y, q.z)), 0.0f);
+
+   return outside.length() + inside;
+}
+
+BoundingBox BoxSource::getBoundingBox() const
+{
+   return BoundingBox(center - halfExtents, center + halfExtents);
+}
+
+unsigned int BoxSource::getMaterialIndex(const Vec3& /*point*/) const
+{
+   return materialIndex;
+}
+
+CSGSource::CSGSource(CSGOperation operationVal, VoxelSource* leftVal, VoxelSource* rightVal)
+ : operation(operationVal),
+   left(leftVal),
+   right(rightVal)
+{
+}
+
+CSGSource::~CSGSource()
+{
+   delete left;
+   delete right;
+}
+
+float CSGSource::getDistance(const Vec3& point) const
+{
+   float leftDistance = left->getDistance(point);
+   float rightDistance = right->getDistance(point);
+
+   if (operation == CSG_UNION)
+   {
+      return fminf(leftDistance, rightDistance);
+   }
+   else if (operation == CSG_INTERSECTION)
+   {
+      return fmaxf(leftDistance, rightDistance);
+   }
+   return fmaxf(leftDistance, -rightDistance);
+}
+
+BoundingBox CSGSource::getBoundingBox() const
+{
+   BoundingBox leftBox = left->getBoundingBox();
+   BoundingBox rightBox = right->getBoundingBox();
+
+   if (operation == CSG_UNION)
+   {
+      return BoundingBox(
+       Vec3(fminf(leftBox.mins.x, rightBox.mins.x), fminf(leftBox.mins.y, rightBox.mins.y), fminf(leftBox.mins.z, rightBox.mins.z)),
+       Vec3(fmaxf(leftBox.maxs.x, rightBox.maxs.x), fmaxf(leftBox.maxs.y, rightBox.maxs.y), fmaxf(leftBox.maxs.z, rightBox.maxs.z)));
+   }
+   else if (operation == CSG_INTERSECTION)
+   {
+      return BoundingBox(
+       Vec3(fmaxf(leftBox.mins.x, rightBox.mins.x), fmaxf(leftBox.mins.y, rightBox.mins.y), fmaxf(leftBox.mins.z, rightBox.mins.z)),
+       Vec3(fminf(leftBox.maxs.x, rightBox.maxs.x), fminf(leftBox.maxs.y, rightBox.maxs.y), fminf(leftBox.maxs.z, rightBox.maxs.z)));
+   }
+   return leftBox;
+}
+
+/**
+ * Returns the material of the operand whose surface makes up the result at the point. The
+ * surface cut by a difference gets the material of the subtracted source.
+ */
+unsigned int CSGSource::getMaterialIndex(const Vec3& point) const
+{
+   float leftDistance = left->getDistance(point);
+   float rightDistance = right->getDistance(point);
+   bool isLeft;
+
+   if (operation == CSG_UNION)
+   {
+      isLeft = leftDistance <= rightDistance;
+   }
+   else if (operation == CSG_INTERSECTION)
+   {
+      isLeft = leftDistance >= rightDistance;
+   }
+   else
+   {
+      isLeft = leftDistance >= -rightDistance;
+   }
+   return isLeft ? left->getMaterialIndex(point) : right->getMaterialIndex(point);
+}
+
+/**
+ * Each octave doubles the frequency and halves the amplitude, so every octave's slope is
+ * bounded by the same amplitude * frequency. With lattice values in [0, 1] and smoothstep
+ * interpolation (slope at most 1.5) the gradient of one octave is at most
+ * sqrt(2) * 1.5 * amplitude * frequency.
+ */
+NoiseTerrainSource::NoiseTerrainSource(const BoundingBox& boundingBoxVal, float baseHeightVal, float amplitudeVal, float frequencyVal, uint32_t seedVal)
+ : boundingBox(boundingBoxVal),
+   baseHeight(baseHeightVal),
+   amplitude(amplitudeVal),
+   frequency(frequencyVal),
+   seed(seedVal),
+   lipschitzScale(1.0f)
+{
+   float maxSlope = sqrtf(2.0f) * 1.5f * amplitude * frequency * TERRAIN_OCTAVES;
+   lipschitzScale = 1.0f / sqrtf(1.0f + (maxSlope * maxSlope));
+}
+
+float NoiseTerrainSource::getDistance(const Vec3& point) const
+{
+   return (point.y - getHeight(point.x, point.z)) * lipschitzScale;
+}
+
+BoundingBox NoiseTerrainSource::getBoundingBox() const
+{
+   return boundingBox;
+}
+
+/**
+ * Rock below the base height, grass up to a quarter of the amplitude above it, snow above.
+ */
+unsigned int NoiseTerrainSource::getMaterialIndex(const Vec3& point) const
+{
+   if (point.y < baseHeight)
+   {
+      return 0;
+   }
+   return (point.y < baseHeight + (0.25f * amplitude)) ? 3 : 4;
+}
+
+float NoiseTerrainSource::getHeight(float x, float z) const
+{
+   float height = baseHeight;
+   float octaveAmplitude = amplitude;
+   float octaveFrequency = frequency;
+
+   for (uint32_t octave = 0; octave < TERRAIN_OCTAVES; octave++)
+   {
+      height += octaveAmplitude * (getValueNoise(x * octaveFrequency, z * octaveFrequency, octave) - 0.5f);
+      octaveAmplitude *= 0.5f;
+      octaveFrequency *= 2.0f;
+   }
+   return height;
+}
+
+/**
+ * Interpolates the lattice values around the point with smoothstep weights.
+ */
+float NoiseTerrainSource::getValueNoise(float x, float z, uint32_t octave) const
+{
+   float cellX = floorf(x);
+   float cellZ = floorf(z);
+   int ix = (int)cellX;
+   int iz = (int)cellZ;
+   float u = x - cellX;
+   float v = z - cellZ;
+
+   u = u * u * (3.0f - (2.0f * u));
+   v = v * v * (3.0f - (2.0f * v));
+
+   float v00 = getLatticeValue(ix, iz, octave);
+   float v10 = getLatticeValue(ix + 1, iz, octave);
+   float v01 = getLatticeValue(ix, iz + 1, octave);
+   float v11 = getLatticeValue(ix + 1, iz + 1, octave);
+   float near = v00 + (u * (v10 - v00));
+   float far = v01 + (u * (v11 - v01));
+
+   return near + (v * (far - near));
+}
+
+/**
+ * Hashes the lattice point into a value in [0, 1].
+ */
+float NoiseTerrainSource::getLatticeValue(int x, int z, uint32_t octave) const
+{
+   uint32_t hash = ((uint32_t)x * 73856093u) ^ ((uint32_t)z * 19349663u) ^ ((seed + octave) * 83492791u);
+
+   hash ^= hash >> 16;
+   hash *= 0x85ebca6bu;
+   hash ^= hash >> 13;
+   hash *= 0xc2b2ae35u;
+   hash ^= hash >> 16;
+   return (float)(hash & 0xffffff) / (float)0xffffff;
+}
+
+/**
+ * Returns true if the path names a built in source ("sdf:<name>") instead of a mesh file.
+ */
+bool isVoxelSourcePath(const std::string& path)
+{
+   return path.compare(0, strlen(VOXEL_SOURCE_PREFIX), VOXEL_SOURCE_PREFIX) == 0;
+}
+
+/**
+ * Creates the built in source named by the path, all about 20 units wide around the origin
+ * like a centered mesh:
+ *    sdf:sphere   a sphere
+ *    sdf:box      a box
+ *    sdf:csg      a box with a sphere cut out of it and a smaller sphere inside
+ *    sdf:terrain  a value noise terrain
+ */
+VoxelSource* createVoxelSource(const std::string& path)
+{
+   std::string name = path.substr(strlen(VOXEL_SOURCE_PREFIX));
+
+   if (name == "sphere")
+   {
+      return new SphereSource(Vec3(0.0f), 10.0f, 1);
+   }
+   else if (name == "box")
+   {
+      return new BoxSource(Vec3(0.0f), Vec3(8.0f, 6.0f, 4.0f), 0);
+   }
+   else if (name == "csg")
+   {
+      VoxelSource* shell = new CSGSource(CSG_DIFFERENCE, new BoxSource(Vec3(0.0f), Vec3(8.0f), 0), new SphereSource(Vec3(0.0f), 10.0f, 1));
+      return new CSGSource(CSG_UNION, shell, new SphereSource(Vec3(0.0f), 6.0f, 2));
+   }
+   else if (name == "terrain")
+   {
+      return new NoiseTerrainSource(BoundingBox(Vec3(-10.0f), Vec3(10.0f)), -2.0f, 8.0f, 0.125f, 1);
+   }
+
+   std::string err("\nUnknown voxel source " + path + ", expected sdf:sphere, sdf:box, sdf:csg or sdf:terrain\n");
+   std::cerr << err;
+   throw std::out_of_range(err);
+}
+
+/**
+ * The materials the built in sources index: grey, red, blue, green and white.
+ */
+std::vector<PhongMaterial> getVoxelSourceMaterials()
+{
+   std::vector<PhongMaterial> materials;
+   glm::vec3 colors[] = {glm::vec3(0.5f, 0.5f, 0.5f), glm::vec3(0.8f, 0.2f, 0.2f),
+    glm::vec3(0.2f, 0.3f, 0.8f), glm::vec3(0.2f, 0.6f, 0.2f), glm::vec3(0.9f, 0.9f, 0.9f)};
+
+   for (unsigned int i = 0; i < 5; i++)
+   {
+      materials.push_back(PhongMaterial(colors[i] * 0.2f, colors[i], glm::vec3(0.3f), 20.0f));
+   }
+   return materials;
+}
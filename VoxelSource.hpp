@@ -0,0 +1,117 @@
+/**
+ * VoxelSource.hpp
+ *
+ * A volume that can be voxelized without triangles: an implicit surface given by a signed
+ * distance function (SDF). The distance is negative inside and must never be larger than the
+ * true distance to the surface (the function is 1-Lipschitz), so a point further away from the
+ * surface than a node's half diagonal tells that the whole node is empty, or full when inside.
+ * That lets the voxelizer cull whole octants without visiting their leafs.
+ *
+ * Built in sources: spheres, boxes, CSG of two sources and a value noise terrain.
+ *
+ * by Brent Williams
+ */
+
+#ifndef VOXEL_SOURCE_HPP
+#define VOXEL_SOURCE_HPP
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Vec3.hpp"
+#include "BoundingBox.hpp"
+#include "PhongMaterial.hpp"
+
+#define VOXEL_SOURCE_PREFIX "sdf:" // Mesh path prefix that selects a built in source instead
+#define TERRAIN_OCTAVES 6
+
+enum CSGOperation
+{
+   CSG_UNION,
+   CSG_INTERSECTION,
+   CSG_DIFFERENCE
+};
+
+class VoxelSource
+{
+   public:
+      virtual ~VoxelSource();
+      virtual float getDistance(const Vec3& point) const = 0;
+      virtual BoundingBox getBoundingBox() const = 0;
+      virtual unsigned int getMaterialIndex(const Vec3& point) const;
+      Vec3 getNormal(const Vec3& point, float epsilon) const;
+};
+
+class SphereSource : public VoxelSource
+{
+   public:
+      Vec3 center;
+      float radius;
+      unsigned int materialIndex;
+
+      SphereSource(const Vec3& centerVal, float radiusVal, unsigned int materialIndexVal);
+      float getDistance(const Vec3& point) const;
+      BoundingBox getBoundingBox() const;
+      unsigned int getMaterialIndex(const Vec3& point) const;
+};
+
+class BoxSource : public VoxelSource
+{
+   public:
+      Vec3 center;
+      Vec3 halfExtents;
+      unsigned int materialIndex;
+
+      BoxSource(const Vec3& centerVal, const Vec3& halfExtentsVal, unsigned int materialIndexVal);
+      float getDistance(const Vec3& point) const;
+      BoundingBox getBoundingBox() const;
+      unsigned int getMaterialIndex(const Vec3& point) const;
+};
+
+// Combines two sources. Min and max of two distance bounds are still distance bounds, so the
+// result can be culled the same way. The CSG source owns both operands.
+class CSGSource : public VoxelSource
+{
+   public:
+      CSGOperation operation;
+      VoxelSource* left;
+      VoxelSource* right;
+
+      CSGSource(CSGOperation operationVal, VoxelSource* leftVal, VoxelSource* rightVal);
+      ~CSGSource();
+      float getDistance(const Vec3& point) const;
+      BoundingBox getBoundingBox() const;
+      unsigned int getMaterialIndex(const Vec3& point) const;
+};
+
+// A height field of value noise octaves over x and z, filled below the height. The height
+// difference is divided by the bound on the slope so it stays a distance bound.
+class NoiseTerrainSource : public VoxelSource
+{
+   public:
+      BoundingBox boundingBox;
+      float baseHeight; // Height of the terrain without noise
+      float amplitude; // Height range of the first octave
+      float frequency; // Lattice cells per world unit of the first octave
+      uint32_t seed;
+      float lipschitzScale; // 1 / sqrt(1 + maximum slope^2)
+
+      NoiseTerrainSource(const BoundingBox& boundingBoxVal, float baseHeightVal, float amplitudeVal, float frequencyVal, uint32_t seedVal);
+      float getDistance(const Vec3& point) const;
+      BoundingBox getBoundingBox() const;
+      unsigned int getMaterialIndex(const Vec3& point) const;
+      float getHeight(float x, float z) const;
+      float getValueNoise(float x, float z, uint32_t octave) const;
+      float getLatticeValue(int x, int z, uint32_t octave) const;
+};
+
+bool isVoxelSourcePath(const std::string& path);
+VoxelSource* createVoxelSource(const std::string& path);
+std::vector<PhongMaterial> getVoxelSourceMaterials();
+
+#endif
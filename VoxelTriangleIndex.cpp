@@ -0,0 +1,186 @@
+/**
+ * VoxelTriangleIndex.cpp
+ * 
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */ 
+
+#include "VoxelTriangleIndex.hpp"
+
+VoxelTriangleIndex::VoxelTriangleIndex(unsigned int levels)
+ : pairs(NULL),
+   numPairs(0),
+   ownsPairs(true),
+   mortonBits(3 * levels)
+{
+}
+
+VoxelTriangleIndex::~VoxelTriangleIndex()
+{
+   releasePairs();
+}
+
+/**
+ * Frees the pairs array, or unmaps it if it was mapped from the voxel cache.
+ */
+void VoxelTriangleIndex::releasePairs()
+{
+   if (ownsPairs)
+   {
+      delete [] pairs;
+   }
+   else if (pairs != NULL)
+   {
+      munmap(pairs, numPairs * sizeof(VoxelTrianglePair));
+   }
+   pairs = NULL;
+   numPairs = 0;
+   ownsPairs = true;
+}
+
+/**
+ * Uses pairs that were mapped from the voxel cache, already sorted and without duplicates. 
+ * They are unmapped when the index is destroyed.
+ */
+void VoxelTriangleIndex::setMappedPairs(VoxelTrianglePair* pairsVal, uint64_t numPairsVal)
+{
+   releasePairs();
+   pairs = pairsVal;
+   numPairs = numPairsVal;
+   ownsPairs = (pairs == NULL);
+}
+
+/**
+ * Returns the buffer of the calling thread. Only that thread may append to it.
+ */
+VoxelTriangleBuffer& VoxelTriangleIndex::getThreadBuffer()
+{
+   return threadBuffers.local();
+}
+
+/**
+ * Merges the per-thread buffers into the pairs array, sorts it by Morton code and keeps one 
+ * pair per voxel. When several triangles filled the same voxel the lowest triangle index is 
+ * kept so the result does not depend on how the triangles were scheduled.
+ */
+void VoxelTriangleIndex::build()
+{
+   std::vector<VoxelTriangleBuffer*> buffers;
+   std::vector<uint64_t> offsets;
+   uint64_t total = 0;
+
+   for (tbb::enumerable_thread_specific<VoxelTriangleBuffer>::iterator it = threadBuffers.begin(); it != threadBuffers.end(); ++it)
+   {
+      buffers.push_back(&(*it));
+      offsets.push_back(total);
+      total += it->size();
+   }
+
+   releasePairs();
+   if (total == 0)
+   {
+      threadBuffers.clear();
+      return;
+   }
+
+   // Concatenate the buffers, releasing each one as soon as it has been copied
+   VoxelTrianglePair* merged = new VoxelTrianglePair[total];
+   tbb::parallel_for((size_t)0, buffers.size(), [&](size_t b) {
+      std::copy(buffers[b]->begin(), buffers[b]->end(), merged + offsets[b]);
+      VoxelTriangleBuffer().swap(*buffers[b]);
+   });
+   threadBuffers.clear();
+
+   VoxelTrianglePair* scratch = new VoxelTrianglePair[total];
+   radixSortPairs(merged, scratch, total, mortonBits);
+
+   // Keep the lowest triangle index of each run of equal Morton codes
+   uint64_t unique = 0;
+   for (uint64_t i = 0; i < total; i++)
+   {
+      if (unique > 0 && scratch[unique-1].mortonIndex == merged[i].mortonIndex)
+      {
+         if (merged[i].triangleIndex < scratch[unique-1].triangleIndex)
+         {
+            scratch[unique-1].triangleIndex = merged[i].triangleIndex;
+         }
+      }
+      else
+      {
+         scratch[unique] = merged[i];
+         unique++;
+      }
+   }
+   delete [] merged;
+
+   pairs = new VoxelTrianglePair[unique];
+   std::copy(scratch, scratch + unique, pairs);
+   numPairs = unique;
+   delete [] scratch;
+}
+
+uint64_t VoxelTriangleIndex::getMemorySize() const
+{
+   return numPairs * sizeof(VoxelTrianglePair);
+}
+
+/**
+ * Stable LSD radix sort of the pairs by their Morton code, RADIX_BITS at a time. Each pass 
+ * splits the array into blocks, counts the digits of every block in parallel, turns the counts 
+ * into per-block output offsets and then scatters the blocks in parallel. Passes whose digit 
+ * is the same for every pair are skipped. The sorted result ends up in pairs.
+ */
+void radixSortPairs(VoxelTrianglePair* pairs, VoxelTrianglePair* scratch, uint64_t numPairs, unsigned int keyBits)
+{
+   uint64_t numBlocks = (numPairs + RADIX_BLOCK_SIZE - 1) / RADIX_BLOCK_SIZE;
+   std::vector<uint64_t> counts(numBlocks * RADIX_BUCKETS);
+   VoxelTrianglePair* source = pairs;
+   VoxelTrianglePair* destination = scratch;
+
+   for (unsigned int shift = 0; shift < keyBits; shift += RADIX_BITS)
+   {
+      std::fill(counts.begin(), counts.end(), 0);
+
+      tbb::parallel_for((uint64_t)0, numBlocks, [&](uint64_t block) {
+         uint64_t* blockCounts = &counts[block * RADIX_BUCKETS];
+         uint64_t end = std::min((block + 1) * RADIX_BLOCK_SIZE, numPairs);
+         for (uint64_t i = block * RADIX_BLOCK_SIZE; i < end; i++)
+         {
+            blockCounts[(source[i].mortonIndex >> shift) & (RADIX_BUCKETS - 1)]++;
+         }
+      });
+
+      // Turn the counts into offsets ordered by digit first and block second
+      uint64_t offset = 0;
+      bool isOneDigit = false;
+      for (unsigned int digit = 0; digit < RADIX_BUCKETS; digit++)
+      {
+         uint64_t digitStart = offset;
+         for (uint64_t block = 0; block < numBlocks; block++)
+         {
+            uint64_t count = counts[block * RADIX_BUCKETS + digit];
+            counts[block * RADIX_BUCKETS + digit] = offset;
+            offset += count;
+         }
+         isOneDigit = isOneDigit || (offset - digitStart == numPairs);
+      }
+
+      if (isOneDigit)
+         continue;
+
+      tbb::parallel_for((uint64_t)0, numBlocks, [&](uint64_t block) {
+         uint64_t* blockOffsets = &counts[block * RADIX_BUCKETS];
+         uint64_t end = std::min((block + 1) * RADIX_BLOCK_SIZE, numPairs);
+         for (uint64_t i = block * RADIX_BLOCK_SIZE; i < end; i++)
+         {
+            destination[blockOffsets[(source[i].mortonIndex >> shift) & (RADIX_BUCKETS - 1)]++] = source[i];
+         }
+      });
+
+      std::swap(source, destination);
+   }
+
+   if (source != pairs)
+   {
+      std::copy(source, source + numPairs, pairs);
+   }
+}
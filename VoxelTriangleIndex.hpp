@@ -0,0 +1,57 @@
+/**
+ * VoxelTriangleIndex.hpp
+ * 
+ * Records which triangle filled each voxel so the moxel table can look up a voxel's normal 
+ * and material. While voxelizing, every thread appends (mortonIndex, triangleIndex) pairs to 
+ * its own buffer without any locking. build() then merges the buffers into one compact array 
+ * sorted by Morton code with a parallel radix sort.
+ *
+ * @author Brent Williams brent.robert.williams@gmail.com
+ */ 
+
+#ifndef VOXEL_TRIANGLE_INDEX_HPP
+#define VOXEL_TRIANGLE_INDEX_HPP
+
+#include <stdint.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <sys/mman.h>
+
+#include "tbb/tbb.h"
+#include "tbb/enumerable_thread_specific.h"
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS 256
+#define RADIX_BLOCK_SIZE 65536
+
+// Packed to 12 bytes, the 4 bytes of padding would be a quarter of the index and the cache
+typedef struct __attribute__((packed))
+{
+   uint64_t mortonIndex;
+   uint32_t triangleIndex;
+} VoxelTrianglePair;
+
+typedef std::vector<VoxelTrianglePair> VoxelTriangleBuffer;
+
+class VoxelTriangleIndex
+{
+   public:
+      tbb::enumerable_thread_specific<VoxelTriangleBuffer> threadBuffers;
+      VoxelTrianglePair* pairs; // Sorted by mortonIndex with one pair per voxel
+      uint64_t numPairs;
+      bool ownsPairs; // False when pairs is mapped from the voxel cache
+      unsigned int mortonBits; // Number of significant bits in a Morton code
+
+      VoxelTriangleIndex(unsigned int levels);
+      ~VoxelTriangleIndex();
+      VoxelTriangleBuffer& getThreadBuffer();
+      void build();
+      void setMappedPairs(VoxelTrianglePair* pairsVal, uint64_t numPairsVal);
+      void releasePairs();
+      uint64_t getMemorySize() const;
+};
+
+void radixSortPairs(VoxelTrianglePair* pairs, VoxelTrianglePair* scratch, uint64_t numPairs, unsigned int keyBits);
+
+#endif
@@ -8,26 +8,31 @@
 
 
 /**
- * Instantiates and initializes the voxel data to be all empty (i.e. 0).
+ * Voxelizes the triangles, or reads the voxelization from the cache, into the compact Morton 
+ * ordered array of non-empty leaf words. Given a leaf stream, the chunked builder hands it the 
+ * leaf words instead and the arrays stay empty. The leafs are still kept when they are needed 
+ * afterwards: to fill the interior, to write the cache, or when they come from the cache or 
+ * the top-down builder, whose leafs are not in Morton order until the end.
  */
-Voxels::Voxels(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath)
- : data(0), 
+Voxels::Voxels(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath, const BuildOptions& optionsVal, DAGStreamBuilder* leafStreamVal)
+ : leafs(0),
+   leafIndices(0),
+   numLeafs(0),
    boundingBox(boundingBoxVal),
    levels(levelsVal),
    size(pow(8, levelsVal)), 
    dimension(pow(2,levelsVal)),
    voxelWidth(0),
-   dataSize(0)
+   dataSize(0),
+   chunkLevel(0),
+   chunkDataSize(0),
+   ownsData(true),
+   leafStream(NULL),
+   options(optionsVal)
 {
    dataSize = calculateDataSize(levels);
-   data = new uint64_t[dataSize]();
-   
-   if (data == NULL)
-   {
-      std::string err("\nAllocation failed for data\n");
-      std::cerr << err;
-      throw std::out_of_range(err);
-   }
+   chunkLevel = calculateChunkLevel();
+   chunkDataSize = dataSize >> (3 * chunkLevel);
    
    boundingBox.square();
    //std::cout << "Voxels constructor boundingBox: " << endl;
@@ -38,22 +43,71 @@ Voxels::Voxels(const unsigned int levelsVal, const BoundingBox& boundingBoxVal,
    //std::cout << "Number of 64bit ints allocated: " << dataSize << "\n";
    //std::cout << "sizeof(uint64_t) " << sizeof(uint64_t) << "\n";
 
-   string fileName = getFileNameFromPath(meshFilePath);
-   //std::cout << "FILENAME: " << fileName << endl;
+   voxelTriangleIndex = new VoxelTriangleIndex(levels);
+
+   uint64_t cacheKey = 0;
+   bool useCache = options.useVoxelCache && getCacheKey(meshFilePath, cacheKey);
+   std::string cacheFilePath = useCache ? getCacheFilePath(meshFilePath, cacheKey) : "";
+
+   // The cache and the interior fill need every leaf, and the top-down builder collects them 
+   // from its tasks, so only the chunked surface build streams
+   if (!useCache && !options.solid && options.voxelBuildMode == BUILD_CHUNKED)
+   {
+      leafStream = leafStreamVal;
+   }
+
+   if (useCache && readVoxelCache(cacheFilePath, cacheKey))
+   {
+      std::cout << "Read voxel cache " << cacheFilePath << endl;
+      return;
+   }
+
+   build(triangles);
 
-   voxelTriangleIndexMap = new tbb::concurrent_unordered_map<unsigned int, unsigned int>();
+   if (useCache)
+   {
+      writeVoxelCache(cacheFilePath, cacheKey);
+   }
+}
 
-   // if (!cacheExists(fileName))
-   // {
-   //    std::cout << "@@@@@@@@@@@@@@@@@@@@@@@@@@@@@  NO VOXEL CACHE... VOXELIZING NOW  @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@" << endl;
-      build(triangles);
-   //    writeVoxelCache(fileName);
-   // }
-   // else
-   // {
-   //    std::cout << "@@@@@@@@@@@@@@@@@@@@@@@@@@@@@  FOUND VOXEL CACHE... READING IN VOXELIZATION  @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@" << endl;
-   //    build(fileName);
-   // }
+/**
+ * Voxelizes the given source instead of triangles. The volume is the source's bounding box. 
+ * No triangles fill the voxels, so the voxel triangle index stays empty and the result is 
+ * not cached.
+ */
+Voxels::Voxels(const unsigned int levelsVal, const VoxelSource& source, const BuildOptions& optionsVal)
+ : leafs(0),
+   leafIndices(0),
+   numLeafs(0),
+   boundingBox(source.getBoundingBox()),
+   levels(levelsVal),
+   size(pow(8, levelsVal)), 
+   dimension(pow(2,levelsVal)),
+   voxelWidth(0),
+   dataSize(0),
+   chunkLevel(0),
+   chunkDataSize(0),
+   ownsData(true),
+   leafStream(NULL),
+   options(optionsVal)
+{
+   dataSize = calculateDataSize(levels);
+   boundingBox.square();
+   voxelWidth = (boundingBox.maxs.x - boundingBox.mins.x) / dimension;
+   voxelTriangleIndex = new VoxelTriangleIndex(levels);
+
+   std::vector<uint64_t> leafList;
+   std::vector<uint64_t> leafIndexList;
+   buildFromSource(source, 0, 0, leafList, leafIndexList, fullNodes);
+
+   // The full nodes all end in the same 8 full leaf words, stored once after the leafs
+   numLeafs = leafList.size();
+   uint64_t numSharedLeafs = fullNodes.empty() ? 0 : 8;
+   leafs = new uint64_t[numLeafs + numSharedLeafs];
+   leafIndices = new uint64_t[numLeafs];
+   std::copy(leafList.begin(), leafList.end(), leafs);
+   std::copy(leafIndexList.begin(), leafIndexList.end(), leafIndices);
+   std::fill(leafs + numLeafs, leafs + numLeafs + numSharedLeafs, ~(uint64_t)0);
 }
 
 /**
@@ -61,7 +115,16 @@ Voxels::Voxels(const unsigned int levelsVal, const BoundingBox& boundingBoxVal,
  */
 Voxels::~Voxels()
 {
-   delete [] data;
+   if (ownsData)
+   {
+      delete [] leafs;
+      delete [] leafIndices;
+   }
+   else
+   {
+      munmap(leafs, numLeafs * sizeof(uint64_t));
+      munmap(leafIndices, numLeafs * sizeof(uint64_t));
+   }
 }
 
 /**
@@ -70,16 +133,32 @@ Voxels::~Voxels()
  *
  * Tested: 9-3-2013 
  */
-unsigned int Voxels::calculateDataSize(unsigned int levels)
+uint64_t Voxels::calculateDataSize(unsigned int levels)
 {
-   if (levels < 2)
+   if (levels < 2 || levels > MORTON_MAX_LEVEL)
    {
       std::string err("\nInvalid number of levels!\n");
       std::cerr << err;
       throw std::out_of_range(err);
    }
    
-   return pow(8, levels-2);
+   return (uint64_t)1 << (3 * (levels-2));
+}
+
+/**
+ * Returns how many times Morton space has to be split into octants so the dense leaf words of 
+ * one chunk fit in the memory budget. Each level splits it into 8 times as many chunks.
+ */
+unsigned int Voxels::calculateChunkLevel()
+{
+   unsigned int level = 0;
+
+   while (level < levels-2 && options.memoryBudget > 0 
+    && ((dataSize >> (3 * level)) * sizeof(uint64_t)) > options.memoryBudget)
+   {
+      level++;
+   }
+   return level;
 }
 
 /**
@@ -88,7 +167,7 @@ unsigned int Voxels::calculateDataSize(unsigned int levels)
  *
  * Tested: 9-3-2013 
  */
-uint64_t& Voxels::operator[](unsigned int i)
+uint64_t Voxels::operator[](uint64_t i)
 {
    if (i >= dataSize)
    {
@@ -99,22 +178,30 @@ uint64_t& Voxels::operator[](unsigned int i)
       std::cerr << err;
       throw std::out_of_range(err);
    }
-   return data[i];
+
+   uint64_t* leafIndex = std::lower_bound(leafIndices, leafIndices + numLeafs, i);
+   if (leafIndex != leafIndices + numLeafs && *leafIndex == i)
+   {
+      return leafs[leafIndex - leafIndices];
+   }
+   return 0;
 }
 
 /**
- * Sets the voxel at the given x, y and z values as filled 
+ * Sets the voxel at the given x, y and z values as filled. The voxel has to be in the given 
+ * block. Safe to call from multiple threads at once since the bit is set with an 
+ * atomic fetch-or on its 64-bit leaf word rather than under a lock.
  *
  * Tested: 9-3-2013 
  */
-void Voxels::set(unsigned int x, unsigned int y, unsigned int z)
+void Voxels::set(unsigned int x, unsigned int y, unsigned int z, VoxelBlock& block)
 {
    //If each individual voxel had an index, the voxeNumber is that index
-   unsigned int voxelNumber = mortonCode(x,y,z,levels);
+   uint64_t voxelNumber = mortonCode(x,y,z,levels);
    //unsigned int voxelNumber = x + dimension*y + dimension*dimension*z;
    
-   //dataIndex is the index into the uint64 array of the current voxel
-   unsigned int dataIndex = voxelNumber / 64;
+   //dataIndex is the index into the block's uint64 array of the current voxel
+   uint64_t dataIndex = (voxelNumber / 64) - block.start;
    
    //bitIndex is the current voxel (represented by a bit) to set
    unsigned int bitIndex =  voxelNumber % 64;
@@ -122,11 +209,13 @@ void Voxels::set(unsigned int x, unsigned int y, unsigned int z)
    //The mask used to set the voxel
    uint64_t toOr = (1L << bitIndex);
    
-   tbb::mutex::scoped_lock lock;
-   lock.acquire(sMutex);
-   //#pragma omp atomic
-   data[dataIndex] |= toOr; // sets the bitIndex bit 
-   lock.release();
+   // Many triangles share a leaf, so only issue the atomic or when the bit is 
+   // not set yet. That keeps the cache line shared instead of bouncing it 
+   // between the cores writing the same word.
+   if ((__atomic_load_n(&block.data[dataIndex], __ATOMIC_RELAXED) & toOr) == 0)
+   {
+      __atomic_fetch_or(&block.data[dataIndex], toOr, __ATOMIC_RELAXED); // sets the bitIndex bit 
+   }
 }
 
 /**
@@ -137,11 +226,11 @@ void Voxels::set(unsigned int x, unsigned int y, unsigned int z)
 bool Voxels::isSet(unsigned int x, unsigned int y, unsigned int z)
 {
    //If each individual voxel had an index, the voxeNumber is that index
-   unsigned int voxelNumber = mortonCode(x,y,z,levels);
+   uint64_t voxelNumber = mortonCode(x,y,z,levels);
    //unsigned int voxelNumber = x + dimension*y + dimension*dimension*z;
    
    //dataIndex is the index into the uint64 array of the current voxel
-   unsigned int dataIndex = voxelNumber / 64;
+   uint64_t dataIndex = voxelNumber / 64;
    
    //bitIndex is the current voxel (represented by a bit) to set
    unsigned int bitIndex =  voxelNumber % 64;
@@ -149,7 +238,7 @@ bool Voxels::isSet(unsigned int x, unsigned int y, unsigned int z)
    //The mask used check if the voxel is set
    uint64_t toAnd = (1L << bitIndex);
    
-   return (data[dataIndex] & toAnd) > 0;
+   return ((*this)[dataIndex] & toAnd) > 0;
 }
 
 /**
@@ -189,341 +278,1461 @@ unsigned long Voxels::getSize() const
 
 
 /**
- * Builds the volume of voxels from triangles
+ * Builds the volume of voxels from triangles into the compact Morton ordered array of 
+ * non-empty leaf words, with the builder picked in the options.
  */
 void Voxels::build(const std::vector<Triangle> triangles)
 {
-   //unsigned int i;
-   unsigned int stepSize = triangles.size() / 100;
-   tbb::atomic<unsigned int> progress = 0;
-   tbb::mutex sm;
+   std::vector<uint64_t> leafList;
+   std::vector<uint64_t> leafIndexList;
 
-   tbb::parallel_for((unsigned int)0, (unsigned int)triangles.size(), [&](unsigned int i) {
+   if (options.voxelBuildMode == BUILD_TOP_DOWN)
+   {
+      buildTopDown(triangles, leafList, leafIndexList);
+   }
+   else
+   {
+      buildChunked(triangles, leafList, leafIndexList);
+   }
 
-      tbb::mutex::scoped_lock lock;
-      voxelizeTriangle(triangles[i], i);
+   numLeafs = leafList.size();
+   leafs = new uint64_t[numLeafs];
+   leafIndices = new uint64_t[numLeafs];
+   std::copy(leafList.begin(), leafList.end(), leafs);
+   std::copy(leafIndexList.begin(), leafIndexList.end(), leafIndices);
 
-      progress.fetch_and_increment();
+   if (options.solid)
+   {
+      fillInterior(triangles);
+   }
 
-      if (progress % (stepSize-1) == 0)
-      {
-         
-         lock.acquire(sm);
-         float percentDone = (((float) progress) / ( (float)triangles.size() )) * 100.0f;
-         cerr << setprecision(3) << "Voxelization: " << percentDone << "%" << endl;
-         lock.release();
-      }
-      
-   });
+   // Merge the triangles recorded by each thread into one array sorted by Morton code
+   voxelTriangleIndex->build();
 }
 
-
-
 /**
- * Builds the volume of voxels from cache
+ * Builds the volume one chunk at a time. Only one chunk's leaf words are allocated densely; 
+ * after voxelizing a chunk its non-empty words are appended to the lists, so the memory used 
+ * grows with the surface of the mesh instead of the volume. Chunks are visited in Morton 
+ * order which keeps the lists sorted.
  */
-void Voxels::build(std::string fileName)
+void Voxels::buildChunked(const std::vector<Triangle>& triangles, std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList)
 {
-   unsigned int i, j, k;
+   uint64_t numChunks = (uint64_t)1 << (3 * chunkLevel);
+   std::vector< std::vector<unsigned int> > chunkTriangles;
+   tbb::atomic<unsigned int> progress;
+   progress = 0;
+
+   binTriangles(triangles, chunkTriangles);
+   unsigned int numTasks = 0;
+   for (uint64_t chunk = 0; chunk < numChunks; chunk++)
+   {
+      numTasks += chunkTriangles[chunk].size();
+   }
 
-   for (k = 0; k < dimension; k++)
-   {  
-      //cout << "Witing image " << k << endl;
-      char filePath[1000];
-      sprintf(filePath, "./voxelCache/%s/%d/%04d.tga",fileName.c_str(),levels,k);
-      Image image(dimension,dimension);
-      image.readTGA(filePath);
-      for (j = 0; j < dimension; j++)
+   if (numChunks > 1)
+   {
+      cout << "Voxelizing in " << numChunks << " chunks of " << chunkDataSize << " leaf words" << endl;
+   }
+
+   VoxelBlock chunk;
+   uint64_t* data = new uint64_t[chunkDataSize];
+
+   for (uint64_t chunkIndex = 0; chunkIndex < numChunks; chunkIndex++)
+   {
+      if (chunkTriangles[chunkIndex].empty())
       {
-         for (i = 0; i < dimension; i++)
-         {
-            glm::vec3 color = image.getColor(i,j);
-            if (color.x > 0)
-            {
-               set(i,j,k);
-            }
-            // if (isSet(i,j,k))
-            // {
-            //    image.setColor(i,j, 1.0f,1.0f,1.0f);
-            // }
-         }
+         continue;
+      }
+
+      initBlock(chunk, chunkLevel, chunkIndex);
+      chunk.data = data;
+      memset(data, 0, chunkDataSize * sizeof(uint64_t));
+      voxelizeChunk(triangles, chunkTriangles[chunkIndex], chunk, progress, numTasks);
+      if (leafStream != NULL)
+      {
+         streamBlockLeafs(chunk, chunkDataSize);
+      }
+      else
+      {
+         appendBlockLeafs(chunk, chunkDataSize, leafList, leafIndexList);
       }
+
+      // Release the chunk's triangle list as soon as it is done
+      std::vector<unsigned int>().swap(chunkTriangles[chunkIndex]);
    }
+
+   // The dense words are not needed anymore
+   delete [] data;
+
+   printThreadLoads();
 }
 
+/**
+ * Builds the volume top down. Starting with all triangles at the root, each node's triangle 
+ * list is split into the lists of its 8 octants and only octants that got triangles are 
+ * visited, each subtree as its own TBB task. Once a node is TOP_DOWN_BLOCK_DIMENSION voxels 
+ * wide its triangles are voxelized into a small dense block. Empty space costs nothing and 
+ * no memory is allocated for the whole volume.
+ */
+void Voxels::buildTopDown(const std::vector<Triangle>& triangles, std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList)
+{
+   std::vector<unsigned int> triangleIndices(triangles.size());
+   for (unsigned int i = 0; i < triangles.size(); i++)
+   {
+      triangleIndices[i] = i;
+   }
+
+   buildTopDown(triangles, triangleIndices, 0, 0, leafList, leafIndexList);
+}
 
 /**
- * Voxelizes the given triangle into the volume 
+ * Appends the non-empty leaf words below the node at the given level and Morton index, 
+ * which the given triangles may overlap.
+ *
+ * A triangle is passed to an octant when the voxel index range voxelizeTriangle would test 
+ * overlaps the octant and its plane passes near the octant, so every voxel is still tested 
+ * against the same triangles as when voxelizing the whole volume and the leafs are identical.
  */
-void Voxels::voxelizeTriangle(const Triangle& triangle, unsigned int i)
+void Voxels::buildTopDown(const std::vector<Triangle>& triangles, const std::vector<unsigned int>& triangleIndices, unsigned int level, uint64_t mortonIndex, std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList)
 {
-   Vec3 triMins(triangle.getMins());
-   Vec3 triMaxs(triangle.getMaxs());
-   
-   //Calculate the indexes into the voxel
-   unsigned int minX = (triMins.x - boundingBox.mins.x) / voxelWidth;
-   unsigned int maxX = (triMaxs.x - boundingBox.mins.x + 0.5) / voxelWidth;
-   unsigned int minY = (triMins.y - boundingBox.mins.y) / voxelWidth;
-   unsigned int maxY = (triMaxs.y - boundingBox.mins.y + 0.5) / voxelWidth;
-   unsigned int minZ = (triMins.z - boundingBox.mins.z) / voxelWidth;
-   unsigned int maxZ = (triMaxs.z - boundingBox.mins.z + 0.5) / voxelWidth;
-   
-   //Deal with floating point error
-   maxX = (maxX >= dimension) ? (dimension-1) : maxX;
-   maxY = (maxY >= dimension) ? (dimension-1) : maxY; 
-   maxZ = (maxZ >= dimension) ? (dimension-1) : maxZ;
-   
-   unsigned int x, y, z;
-   Vec3 deltaP(voxelWidth, voxelWidth, voxelWidth); //The (maxs-mins) of the 
-                                                    //voxel's bounding box
-   
-   for (x = minX; x <= maxX; x++)
+   VoxelBlock node;
+   initBlock(node, level, mortonIndex);
+
+   if ((dimension >> level) <= TOP_DOWN_BLOCK_DIMENSION)
    {
-      for (y = minY; y <= maxY; y++)
+      uint64_t numWords = dataSize >> (3 * level);
+      std::vector<uint64_t> data(numWords, 0);
+      node.data = &data[0];
+
+      for (unsigned int t = 0; t < triangleIndices.size(); t++)
       {
-         for (z = minZ; z <= maxZ; z++)
+         unsigned int i = triangleIndices[t];
+         if (options.voxelizationMode == VOXELIZE_SCANLINE)
          {
-            Vec3 p(boundingBox.mins.x + (x*voxelWidth),  //The mins of the 
-             boundingBox.mins.y + (y*voxelWidth),        //voxel's bounding box
-             boundingBox.mins.z + (z*voxelWidth) );
-             
-            if (triangleAABBIntersect(triangle, p, deltaP))
-            {
-               unsigned int mortonIndex = mortonCode(x, y, z, levels);
-               glm::vec3 v0(triangle.v0.x,triangle.v0.y,triangle.v0.z);
-               glm::vec3 v1(triangle.v1.x,triangle.v1.y,triangle.v1.z);
-               glm::vec3 v2(triangle.v2.x,triangle.v2.y,triangle.v2.z);
+            voxelizeTriangleScanline(triangles[i], i, node);
+         }
+         else
+         {
+            voxelizeTriangle(triangles[i], i, node);
+         }
+      }
+      appendBlockLeafs(node, numWords, leafList, leafIndexList);
+      return;
+   }
 
-               // Calculate the normal of the triangle/plane
-               // glm::vec3 normal = glm::normalize( glm::cross(v1-v0, v2-v0) );
-               // cout << "Voxelization: (" << x << ", " << y << ", " << z << ") => mortonIndex: " << mortonIndex << endl;
-               // cout << "\tTriangle (" << i << ") " << endl;
-               // cout << "\tTriangle Normal: <" << normal.x << ", " << normal.y << ", " << normal.z << ">" << endl; 
-               // cout << endl;
+   // Split the triangles between the octants
+   std::vector<unsigned int> childTriangles[8];
+   VoxelBlock children[8];
+   for (unsigned int child = 0; child < 8; child++)
+   {
+      initBlock(children[child], level+1, (mortonIndex * 8) + child);
+   }
 
-               voxelTriangleIndexMap->insert( std::make_pair<unsigned int,unsigned int>( (unsigned int)mortonIndex, (unsigned int)i ) );
+   for (unsigned int t = 0; t < triangleIndices.size(); t++)
+   {
+      unsigned int i = triangleIndices[t];
+      unsigned int mins[3], maxs[3];
+      if (!getVoxelRange(triangles[i], node, mins, maxs))
+      {
+         continue;
+      }
 
-               set(x,y,z);
-            }
+      for (unsigned int child = 0; child < 8; child++)
+      {
+         bool isOverlapping = true;
+         for (int axis = 0; axis < 3; axis++)
+         {
+            isOverlapping = isOverlapping && mins[axis] <= children[child].maxs[axis] 
+             && maxs[axis] >= children[child].mins[axis];
+         }
+
+         if (isOverlapping && isPlaneNearBlock(triangles[i], children[child]))
+         {
+            childTriangles[child].push_back(i);
          }
       }
-   }   
-   
-   
+   }
+
+   std::vector<uint64_t> childLeafs[8];
+   std::vector<uint64_t> childLeafIndices[8];
+   tbb::parallel_for((unsigned int)0, (unsigned int)8, [&](unsigned int child) {
+      if (!childTriangles[child].empty())
+      {
+         buildTopDown(triangles, childTriangles[child], level+1, (mortonIndex * 8) + child, childLeafs[child], childLeafIndices[child]);
+      }
+   });
+
+   appendChildLeafs(childLeafs, childLeafIndices, leafList, leafIndexList);
 }
 
 /**
- * Returns the number of voxels that are set
- *
- * Tested: 9-12-2013 
+ * Appends the non-empty leaf words below the node at the given level and Morton index by 
+ * evaluating the source's distance hierarchically. The distance at the node's center bounds 
+ * the distance at every voxel center in it, so a node further from the surface than its half 
+ * diagonal is skipped without visiting its leafs. Without -solid the voxels within half a 
+ * voxel diagonal of the surface are filled. With -solid every voxel whose center is inside is 
+ * filled, and a node above the leafs that is entirely inside is appended to fullNodeList once 
+ * instead of as all of its full leaf words.
  */
-unsigned int Voxels::countSetVoxels()
+void Voxels::buildFromSource(const VoxelSource& source, unsigned int level, uint64_t mortonIndex, std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList, std::vector<FullNode>& fullNodeList)
 {
-   unsigned int i, count = 0;
-   
-   for (i = 0; i < dataSize; i++)
-      count += countSetBits(data[i]);
-   
-   return count;
+   VoxelBlock node;
+   initBlock(node, level, mortonIndex);
+
+   unsigned int blockDimension = dimension >> level;
+   float halfWidth = 0.5f * blockDimension * voxelWidth;
+   Vec3 center(boundingBox.mins.x + (node.mins[0] * voxelWidth) + halfWidth,
+    boundingBox.mins.y + (node.mins[1] * voxelWidth) + halfWidth,
+    boundingBox.mins.z + (node.mins[2] * voxelWidth) + halfWidth);
+   float halfDiagonal = sqrtf(3.0f) * halfWidth;
+   float voxelHalfDiagonal = sqrtf(3.0f) * 0.5f * voxelWidth;
+   float distance = source.getDistance(center);
+
+   if (options.solid)
+   {
+      if (distance > halfDiagonal)
+      {
+         return;
+      }
+      if (distance < -halfDiagonal)
+      {
+         if (level == levels-2)
+         {
+            leafList.push_back(~(uint64_t)0);
+            leafIndexList.push_back(node.start);
+         }
+         else
+         {
+            FullNode fullNode = {mortonIndex, level};
+            fullNodeList.push_back(fullNode);
+         }
+         return;
+      }
+   }
+   else if (fabsf(distance) > halfDiagonal + voxelHalfDiagonal)
+   {
+      return;
+   }
+
+   if (level == levels-2)
+   {
+      uint64_t leaf = voxelizeSourceLeaf(source, node);
+      if (leaf != 0)
+      {
+         leafList.push_back(leaf);
+         leafIndexList.push_back(node.start);
+      }
+      return;
+   }
+
+   std::vector<uint64_t> childLeafs[8];
+   std::vector<uint64_t> childLeafIndices[8];
+   std::vector<FullNode> childFullNodes[8];
+   if (blockDimension > SOURCE_TASK_DIMENSION)
+   {
+      tbb::parallel_for((unsigned int)0, (unsigned int)8, [&](unsigned int child) {
+         buildFromSource(source, level+1, (mortonIndex * 8) + child, childLeafs[child], childLeafIndices[child], childFullNodes[child]);
+      });
+   }
+   else
+   {
+      for (unsigned int child = 0; child < 8; child++)
+      {
+         buildFromSource(source, level+1, (mortonIndex * 8) + child, childLeafs[child], childLeafIndices[child], childFullNodes[child]);
+      }
+   }
+
+   appendChildLeafs(childLeafs, childLeafIndices, leafList, leafIndexList);
+   for (unsigned int child = 0; child < 8; child++)
+   {
+      fullNodeList.insert(fullNodeList.end(), childFullNodes[child].begin(), childFullNodes[child].end());
+   }
 }
 
 /**
- * Returns the string representation of the binary of an unsigned 64-bit int 
- *
- * Tested: 12-21-2013 
+ * Returns the leaf word of the 4x4x4 voxels of the leaf block, evaluating the source at each 
+ * voxel's center.
  */
-void binaryToString(uint64_t data, char* str)
+uint64_t Voxels::voxelizeSourceLeaf(const VoxelSource& source, const VoxelBlock& leaf)
 {
-   unsigned int i;
-   
-   for (i = 0; i < 64; i++)
+   float voxelHalfDiagonal = sqrtf(3.0f) * 0.5f * voxelWidth;
+   uint64_t word = 0;
+
+   for (unsigned int bit = 0; bit < 64; bit++)
    {
-      if (data & 1)
-         str[i] = '1';
-      else
-         str[i] = '0';
-      
-      data >>= 1;
+      unsigned int x, y, z;
+      mortonCodeToXYZ(bit, &x, &y, &z, 2);
+      float distance = source.getDistance(getVoxelCenter(leaf.mins[0] + x, leaf.mins[1] + y, leaf.mins[2] + z));
+
+      if (options.solid ? (distance <= 0.0f) : (fabsf(distance) <= voxelHalfDiagonal))
+      {
+         word |= (uint64_t)1 << bit;
+      }
    }
+   return word;
 }
 
 /**
- * Print the binary representation of the voxels
- *
- * Tested: 12-21-2013 
+ * Returns the world space center of the voxel at the given index.
  */
-void Voxels::printBinary()
+Vec3 Voxels::getVoxelCenter(unsigned int x, unsigned int y, unsigned int z)
 {
-   unsigned int i, j, k;
-   
-   for (k = 0; k < dimension; k++)
-   {  
-      std::cout << "z = " << k << "\n";
-      for (j = 0; j < dimension; j++)
-      {
-         for (i = 0; i < dimension; i++)
-         {
-            if (isSet(i,j,k))
-               std::cout << "1 ";
-            else
-               std::cout << "0 ";
-         }
-         std::cout << "\n";
-      }
-      std::cout << "\n";
-   }
+   return Vec3(boundingBox.mins.x + ((x + 0.5f) * voxelWidth),
+    boundingBox.mins.y + ((y + 0.5f) * voxelWidth),
+    boundingBox.mins.z + ((z + 0.5f) * voxelWidth));
 }
 
 /**
- * Returns the number of set bits in an unsigned 64-bit int
- *
- * Written based on the algorithm published by Peter Wagner in CACM 3 (1960)
- *
- * Tested: 9-12-2013 
+ * Returns false only if the triangle's plane is clearly too far from the block for any of 
+ * the block's voxels to overlap the triangle. The plane is allowed an extra voxel width (plus 
+ * a little floating point slack relative to the volume) so the test stays conservative, and 
+ * degenerate triangles are always kept.
  */
-unsigned int countSetBits(uint64_t data)
+bool Voxels::isPlaneNearBlock(const Triangle& triangle, const VoxelBlock& block)
 {
-   unsigned int count; 
-   
-   for (count = 0; data; count++) 
-      data &= data - 1;
-   
-   return count;
+   Vec3 normal(triangle.getNormal());
+   float halfWidth = 0.5f * (block.maxs[0] - block.mins[0] + 1) * voxelWidth;
+   Vec3 center(boundingBox.mins.x + (block.mins[0] * voxelWidth) + halfWidth,
+    boundingBox.mins.y + (block.mins[1] * voxelWidth) + halfWidth,
+    boundingBox.mins.z + (block.mins[2] * voxelWidth) + halfWidth);
+
+   float distance = normal.x * (center.x - triangle.v0.x) + normal.y * (center.y - triangle.v0.y) 
+    + normal.z * (center.z - triangle.v0.z);
+   float radius = halfWidth * (fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z));
+   float slack = voxelWidth + ((boundingBox.maxs.x - boundingBox.mins.x) * 0.00001f);
+
+   return !(fabsf(distance) > radius + slack);
 }
 
 /**
- * Writes the voxel data to tga files where the file name is the z axis voxel number.
- *
- *
- * Tested: 12-15-2014
+ * Puts the index of every triangle into the list of each chunk its voxel range overlaps.
  */
-void Voxels::writeImages()
+void Voxels::binTriangles(const std::vector<Triangle>& triangles, std::vector< std::vector<unsigned int> >& chunkTriangles)
 {
-   unsigned int i, j, k;
-   
-   for (k = 0; k < dimension; k++)
-   {  
-      cout << "Witing image " << k << endl;
-      Image image(dimension,dimension);
-      for (j = 0; j < dimension; j++)
+   unsigned int chunkDimension = dimension >> chunkLevel;
+   uint64_t numChunks = (uint64_t)1 << (3 * chunkLevel);
+
+   chunkTriangles.resize(numChunks);
+   if (numChunks == 1)
+   {
+      chunkTriangles[0].resize(triangles.size());
+      for (unsigned int i = 0; i < triangles.size(); i++)
       {
-         for (i = 0; i < dimension; i++)
+         chunkTriangles[0][i] = i;
+      }
+      return;
+   }
+
+   // Get the voxel ranges over the whole volume
+   VoxelBlock volume;
+   initBlock(volume, 0, 0);
+
+   for (unsigned int i = 0; i < triangles.size(); i++)
+   {
+      unsigned int mins[3], maxs[3];
+      if (!getVoxelRange(triangles[i], volume, mins, maxs))
+      {
+         continue;
+      }
+
+      for (unsigned int z = mins[2] / chunkDimension; z <= maxs[2] / chunkDimension; z++)
+      {
+         for (unsigned int y = mins[1] / chunkDimension; y <= maxs[1] / chunkDimension; y++)
          {
-            if (isSet(i,j,k))
+            for (unsigned int x = mins[0] / chunkDimension; x <= maxs[0] / chunkDimension; x++)
             {
-               image.setColor(i,j, 1.0f,1.0f,1.0f);
+               chunkTriangles[mortonCode(x, y, z, chunkLevel)].push_back(i);
             }
          }
       }
-      char fileName[30];
-      sprintf(fileName, "./images/%04d.tga",k);
-      image.writeTGA((fileName));
    }
 }
 
-bool Voxels::cacheExists(std::string fileName)
+/**
+ * Sets up the block covering the octree node at the given level (0 being the whole volume) 
+ * and Morton index within that level. The block's data is left for the caller to provide.
+ */
+void Voxels::initBlock(VoxelBlock& block, unsigned int level, uint64_t mortonIndex)
 {
-   struct stat sb;
-   std::string parentFolderPath = "./voxelCache/";
-   parentFolderPath += fileName + "/";
-   std::ostringstream strm;
-   strm << levels;
-   std::string levelFolderName = strm.str();
-   std::string fullPath = parentFolderPath + levelFolderName;
-   
-   return stat(fullPath.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode);
-}
+   unsigned int blockDimension = dimension >> level;
+   unsigned int x, y, z;
 
+   mortonCodeToXYZ(mortonIndex, &x, &y, &z, level);
+   block.data = NULL;
+   block.start = mortonIndex * (dataSize >> (3 * level));
+   block.mins[0] = x * blockDimension;
+   block.mins[1] = y * blockDimension;
+   block.mins[2] = z * blockDimension;
+   for (int axis = 0; axis < 3; axis++)
+   {
+      block.maxs[axis] = block.mins[axis] + blockDimension - 1;
+   }
+}
 
 /**
- * Writes the voxel cache to tga files where the file name is the z axis voxel number.
- *
- *
- * Tested: 3-22-2015
+ * Voxelizes the part of each of the given triangles that is inside the chunk. The work is 
+ * scheduled by scheduleTriangles and every thread adds the time it spent to its ThreadLoad.
  */
-void Voxels::writeVoxelCache(std::string fileName)
+void Voxels::voxelizeChunk(const std::vector<Triangle>& triangles, const std::vector<unsigned int>& triangleIndices, VoxelBlock& chunk, tbb::atomic<unsigned int>& progress, unsigned int numTasks)
 {
-   unsigned int i, j, k;
-
-   char meshFolderPath[1000];
-   sprintf(meshFolderPath, "./voxelCache/%s",fileName.c_str());
-   struct stat st1;  
-
-   // If the folder doesn not already exist, create it
-   if (stat(meshFolderPath, &st1) == -1) {
-      mkdir(meshFolderPath, 0777);
-   } 
+   unsigned int stepSize = std::max(numTasks / 100, 2u);
+   std::vector<VoxelizationTask> tasks;
+   tbb::mutex sm;
 
-   char parentFolderPath[1000];
-   sprintf(parentFolderPath, "./voxelCache/%s/%d",fileName.c_str(),levels);
-   struct stat st2;
+   scheduleTriangles(triangles, triangleIndices, chunk, tasks, progress);
 
-   // If the folder doesn not already exist, create it
-   if (stat(parentFolderPath, &st2) == -1) {
-      mkdir(parentFolderPath, 0777);
-   }
+   tbb::parallel_for(tbb::blocked_range<size_t>(0, tasks.size()), [&](const tbb::blocked_range<size_t>& range) {
 
-   for (k = 0; k < dimension; k++)
-   {  
-      cout << "Witing image " << k << endl;
-      Image image(dimension,dimension);
-      for (j = 0; j < dimension; j++)
+      auto start = chrono::steady_clock::now();
+      tbb::mutex::scoped_lock lock;
+      for (size_t t = range.begin(); t != range.end(); t++)
       {
-         for (i = 0; i < dimension; i++)
+         const VoxelizationTask& task = tasks[t];
+         VoxelBlock block = chunk;
+         for (int axis = 0; axis < 3; axis++)
          {
-            if (isSet(i,j,k))
+            block.mins[axis] = task.mins[axis];
+            block.maxs[axis] = task.maxs[axis];
+         }
+
+         unsigned int i = task.triangleIndex;
+         if (options.voxelizationMode == VOXELIZE_SCANLINE)
+         {
+            voxelizeTriangleScanline(triangles[i], i, block);
+         }
+         else
+         {
+            voxelizeTriangle(triangles[i], i, block);
+         }
+
+         if (!task.isFirstPart)
+         {
+            continue;
+         }
+
+         unsigned int done = progress.fetch_and_increment() + 1;
+
+         if (done % (stepSize-1) == 0)
+         {
+            
+            lock.acquire(sm);
+            float percentDone = (((float) done) / ( (float)numTasks )) * 100.0f;
+            cerr << setprecision(3) << "Voxelization: " << percentDone << "%" << endl;
+            lock.release();
+         }
+      }
+      auto end = chrono::steady_clock::now();
+
+      ThreadLoad& load = threadLoads.local();
+      load.time += chrono::duration <double, milli> (end - start).count();
+      load.numTasks += range.size();
+   });
+}
+
+/**
+ * Turns the triangles of the chunk into voxelization tasks.
+ *
+ * With SCHEDULE_FILE_ORDER every triangle is one task in the order of the mesh file, so one 
+ * huge triangle is one long task and consecutive tasks write all over the chunk. With 
+ * SCHEDULE_MORTON a triangle whose voxel range is wider than VOXELIZE_TASK_DIMENSION is split 
+ * into the grid aligned tiles of that width its range and plane touch, and the tasks are sorted 
+ * by the Morton code of the triangle's centroid or the tile's center. The tasks are then about 
+ * the same size and the ranges TBB hands to a thread write to nearby leaf words. Each voxel is 
+ * still tested against the same triangles, so the result does not change.
+ */
+void Voxels::scheduleTriangles(const std::vector<Triangle>& triangles, const std::vector<unsigned int>& triangleIndices, const VoxelBlock& chunk, std::vector<VoxelizationTask>& tasks, tbb::atomic<unsigned int>& progress)
+{
+   unsigned int numSkipped = 0;
+
+   tasks.reserve(triangleIndices.size());
+   for (unsigned int t = 0; t < triangleIndices.size(); t++)
+   {
+      unsigned int i = triangleIndices[t];
+      VoxelizationTask task;
+      task.mortonCode = 0;
+      task.triangleIndex = i;
+      task.isFirstPart = true;
+      for (int axis = 0; axis < 3; axis++)
+      {
+         task.mins[axis] = chunk.mins[axis];
+         task.maxs[axis] = chunk.maxs[axis];
+      }
+
+      if (options.triangleSchedule == SCHEDULE_FILE_ORDER)
+      {
+         tasks.push_back(task);
+         continue;
+      }
+
+      unsigned int mins[3], maxs[3];
+      if (!getVoxelRange(triangles[i], chunk, mins, maxs))
+      {
+         numSkipped++;
+         continue;
+      }
+
+      bool isLarge = false;
+      for (int axis = 0; axis < 3; axis++)
+      {
+         isLarge = isLarge || (maxs[axis] - mins[axis] + 1 > VOXELIZE_TASK_DIMENSION);
+      }
+
+      if (!isLarge)
+      {
+         const Triangle& triangle = triangles[i];
+         float centroid[3] = {
+            (triangle.v0.x + triangle.v1.x + triangle.v2.x) / 3.0f - boundingBox.mins.x,
+            (triangle.v0.y + triangle.v1.y + triangle.v2.y) / 3.0f - boundingBox.mins.y,
+            (triangle.v0.z + triangle.v1.z + triangle.v2.z) / 3.0f - boundingBox.mins.z };
+         unsigned int center[3];
+         for (int axis = 0; axis < 3; axis++)
+         {
+            float voxel = centroid[axis] / voxelWidth;
+            center[axis] = (voxel < (float)mins[axis]) ? mins[axis] : (unsigned int)voxel;
+            center[axis] = std::min(center[axis], maxs[axis]);
+         }
+         task.mortonCode = mortonCode(center[0], center[1], center[2], levels);
+         tasks.push_back(task);
+         continue;
+      }
+
+      // The chunk is at least a tile wide here, so the tiles stay inside it
+      unsigned int tileMins[3], tileMaxs[3];
+      for (int axis = 0; axis < 3; axis++)
+      {
+         tileMins[axis] = mins[axis] / VOXELIZE_TASK_DIMENSION;
+         tileMaxs[axis] = maxs[axis] / VOXELIZE_TASK_DIMENSION;
+      }
+
+      VoxelBlock tile = chunk;
+      for (unsigned int z = tileMins[2]; z <= tileMaxs[2]; z++)
+      {
+         for (unsigned int y = tileMins[1]; y <= tileMaxs[1]; y++)
+         {
+            for (unsigned int x = tileMins[0]; x <= tileMaxs[0]; x++)
             {
-               image.setColor(i,j, 1.0f,1.0f,1.0f);
+               unsigned int tileIndex[3] = {x, y, z};
+               for (int axis = 0; axis < 3; axis++)
+               {
+                  tile.mins[axis] = tileIndex[axis] * VOXELIZE_TASK_DIMENSION;
+                  tile.maxs[axis] = tile.mins[axis] + VOXELIZE_TASK_DIMENSION - 1;
+               }
+
+               if (!isPlaneNearBlock(triangles[i], tile))
+               {
+                  continue;
+               }
+
+               for (int axis = 0; axis < 3; axis++)
+               {
+                  task.mins[axis] = tile.mins[axis];
+                  task.maxs[axis] = tile.maxs[axis];
+               }
+               task.mortonCode = mortonCode(tile.mins[0] + (VOXELIZE_TASK_DIMENSION / 2), 
+                tile.mins[1] + (VOXELIZE_TASK_DIMENSION / 2), tile.mins[2] + (VOXELIZE_TASK_DIMENSION / 2), levels);
+               tasks.push_back(task);
+               task.isFirstPart = false;
             }
          }
       }
 
-      char filePath[1000];
-      sprintf(filePath, "./voxelCache/%s/%d/%04d.tga",fileName.c_str(),levels,k);
-      image.writeTGA((filePath));
+      if (task.isFirstPart)
+      {
+         numSkipped++;
+      }
+   }
+
+   // Triangles that can't fill a voxel of the chunk are done already
+   progress += numSkipped;
+
+   if (options.triangleSchedule == SCHEDULE_MORTON)
+   {
+      tbb::parallel_sort(tasks.begin(), tasks.end(), [](const VoxelizationTask& a, const VoxelizationTask& b) {
+         return (a.mortonCode < b.mortonCode) || (a.mortonCode == b.mortonCode && a.triangleIndex < b.triangleIndex);
+      });
    }
 }
 
+/**
+ * Prints the time each thread spent voxelizing and how far the slowest one is from the mean. 
+ * With a perfect balance the imbalance is 1.
+ */
+void Voxels::printThreadLoads()
+{
+   double totalTime = 0.0;
+   double maxTime = 0.0;
+   uint64_t totalTasks = 0;
+   unsigned int numThreads = 0;
+
+   for (tbb::enumerable_thread_specific<ThreadLoad>::iterator it = threadLoads.begin(); it != threadLoads.end(); ++it)
+   {
+      totalTime += it->time;
+      maxTime = std::max(maxTime, it->time);
+      totalTasks += it->numTasks;
+      numThreads++;
+   }
 
+   if (numThreads == 0)
+   {
+      return;
+   }
 
-std::string Voxels::getFileNameFromPath(string filePath)
+   cout << "Voxelization Thread Load (" << options.getTriangleScheduleName() << ", " << totalTasks << " tasks):" << endl;
+   unsigned int thread = 0;
+   for (tbb::enumerable_thread_specific<ThreadLoad>::iterator it = threadLoads.begin(); it != threadLoads.end(); ++it)
+   {
+      cout << "\tThread " << thread << ": " << it->time << " ms, " << it->numTasks << " tasks" << endl;
+      thread++;
+   }
+   cout << "\tImbalance (slowest / mean): " << (maxTime / (totalTime / numThreads)) << endl;
+}
+
+/**
+ * Fills the voxels inside the mesh with a parity fill along z. The ray through the centers of 
+ * every column of voxels is crossed with all the triangles in parallel, and the crossings are 
+ * sorted by column. Then the volume is walked in SOLID_BLOCK_DIMENSION wide blocks in Morton 
+ * order, groups of blocks in parallel: each block starts out as its surface leaf words and 
+ * every voxel whose center is between an odd and the following even crossing of its column is 
+ * set. Blocks without surface voxels or crossings are skipped. The leafs are replaced by the 
+ * result, so blocks deep inside become all-ones words the DAG merges into one node.
+ *
+ * The mesh has to be watertight. A column crossing it an odd number of times ignores its last 
+ * crossing.
+ */
+void Voxels::fillInterior(const std::vector<Triangle>& triangles)
 {
-   string filename = filePath;
-   // Remove directory if present.
-   // Do this before extension removal incase directory has a period character.
-   const size_t last_slash_idx = filename.find_last_of("\\/");
-   if (std::string::npos != last_slash_idx)
+   auto start = chrono::steady_clock::now();
+   unsigned int blockDimension = std::min((unsigned int)SOLID_BLOCK_DIMENSION, dimension);
+   unsigned int blockLevel = 0;
+   while ((dimension >> blockLevel) > blockDimension)
    {
-       filename.erase(0, last_slash_idx + 1);
+      blockLevel++;
    }
+   uint64_t numBlocks = (uint64_t)1 << (3 * blockLevel);
+   uint64_t numWords = dataSize >> (3 * blockLevel);
+   uint64_t columnsPerBlock = (uint64_t)blockDimension * blockDimension;
 
-   // Remove extension if present.
-   const size_t period_idx = filename.rfind('.');
-   if (std::string::npos != period_idx)
+   tbb::enumerable_thread_specific< std::vector<ColumnCrossing> > threadCrossings;
+   tbb::parallel_for((size_t)0, triangles.size(), [&](size_t i) {
+      addColumnCrossings(triangles[i], threadCrossings.local());
+   });
+
+   std::vector<ColumnCrossing> crossings;
+   for (tbb::enumerable_thread_specific< std::vector<ColumnCrossing> >::iterator it = threadCrossings.begin(); it != threadCrossings.end(); ++it)
    {
-       filename.erase(period_idx);
+      crossings.insert(crossings.end(), it->begin(), it->end());
+      std::vector<ColumnCrossing>().swap(*it);
    }
-   return filename;
+   tbb::parallel_sort(crossings.begin(), crossings.end(), [](const ColumnCrossing& a, const ColumnCrossing& b) {
+      return (a.column < b.column) || (a.column == b.column && a.z < b.z);
+   });
+
+   uint64_t numOddColumns = 0;
+   for (uint64_t i = 0; i < crossings.size(); )
+   {
+      uint64_t end = i;
+      while (end < crossings.size() && crossings[end].column == crossings[i].column)
+      {
+         end++;
+      }
+      numOddColumns += (end - i) % 2;
+      i = end;
+   }
+   if (numOddColumns > 0)
+   {
+      cerr << "Warning: " << numOddColumns << " columns cross the mesh an odd number of times, it is not watertight" << endl;
+   }
+
+   uint64_t numGroups = std::min(numBlocks, (uint64_t)SOLID_FILL_GROUPS);
+   std::vector< std::vector<uint64_t> > groupLeafs(numGroups);
+   std::vector< std::vector<uint64_t> > groupLeafIndices(numGroups);
+
+   tbb::parallel_for((uint64_t)0, numGroups, [&](uint64_t group) {
+      std::vector<uint64_t> data(numWords);
+      uint64_t firstBlock = (group * numBlocks) / numGroups;
+      uint64_t lastBlock = ((group + 1) * numBlocks) / numGroups;
+
+      for (uint64_t b = firstBlock; b < lastBlock; b++)
+      {
+         VoxelBlock block;
+         initBlock(block, blockLevel, b);
+
+         uint64_t* surfaceStart = std::lower_bound(leafIndices, leafIndices + numLeafs, block.start);
+         uint64_t* surfaceEnd = std::lower_bound(surfaceStart, leafIndices + numLeafs, block.start + numWords);
+
+         ColumnCrossing firstColumn;
+         firstColumn.column = getColumnKey(block.mins[0], block.mins[1]);
+         firstColumn.z = 0.0f;
+         std::vector<ColumnCrossing>::iterator crossingStart = std::lower_bound(crossings.begin(), crossings.end(), firstColumn, 
+          [](const ColumnCrossing& a, const ColumnCrossing& b) { return a.column < b.column; });
+         std::vector<ColumnCrossing>::iterator crossingEnd = crossingStart;
+         while (crossingEnd != crossings.end() && crossingEnd->column < firstColumn.column + columnsPerBlock)
+         {
+            crossingEnd++;
+         }
+
+         if (surfaceStart == surfaceEnd && crossingStart == crossingEnd)
+         {
+            continue;
+         }
+
+         std::fill(data.begin(), data.end(), 0);
+         block.data = &data[0];
+         for (uint64_t* leafIndex = surfaceStart; leafIndex != surfaceEnd; leafIndex++)
+         {
+            block.data[*leafIndex - block.start] = leafs[leafIndex - leafIndices];
+         }
+
+         for (std::vector<ColumnCrossing>::iterator crossing = crossingStart; crossing != crossingEnd; )
+         {
+            std::vector<ColumnCrossing>::iterator columnEnd = crossing;
+            while (columnEnd != crossingEnd && columnEnd->column == crossing->column)
+            {
+               columnEnd++;
+            }
+
+            uint64_t local = crossing->column - firstColumn.column;
+            unsigned int x = block.mins[0] + (local % blockDimension);
+            unsigned int y = block.mins[1] + (local / blockDimension);
+
+            // Set the voxels with zEnter <= center < zExit
+            for (; crossing + 1 < columnEnd; crossing += 2)
+            {
+               float zEnter = std::max(ceilf(crossing->z), (float)block.mins[2]);
+               float zExit = std::min(ceilf((crossing+1)->z) - 1.0f, (float)block.maxs[2]);
+               for (float z = zEnter; z <= zExit; z += 1.0f)
+               {
+                  uint64_t voxelNumber = mortonCode(x, y, (unsigned int)z, levels);
+                  block.data[(voxelNumber / 64) - block.start] |= (uint64_t)1 << (voxelNumber % 64);
+               }
+            }
+            crossing = columnEnd;
+         }
+
+         appendBlockLeafs(block, numWords, groupLeafs[group], groupLeafIndices[group]);
+      }
+   });
+
+   uint64_t numSolidLeafs = 0;
+   for (uint64_t group = 0; group < numGroups; group++)
+   {
+      numSolidLeafs += groupLeafs[group].size();
+   }
+
+   uint64_t numSurfaceLeafs = numLeafs;
+   delete [] leafs;
+   delete [] leafIndices;
+   leafs = new uint64_t[numSolidLeafs];
+   leafIndices = new uint64_t[numSolidLeafs];
+   numLeafs = 0;
+   for (uint64_t group = 0; group < numGroups; group++)
+   {
+      std::copy(groupLeafs[group].begin(), groupLeafs[group].end(), leafs + numLeafs);
+      std::copy(groupLeafIndices[group].begin(), groupLeafIndices[group].end(), leafIndices + numLeafs);
+      numLeafs += groupLeafs[group].size();
+   }
+
+   auto end = chrono::steady_clock::now();
+   cout << "Solid fill: " << crossings.size() << " column crossings, " << numSurfaceLeafs << " surface leaf words to " << numLeafs << endl;
+   cout << "\t\tTime Solid Fill: " << chrono::duration <double, milli> (end - start).count() << " ms" << endl;
+}
+
+/**
+ * Adds a crossing for every column of voxels whose center ray along z passes through the 
+ * triangle. Edges are owned by one side only (the top-left rule on the triangle projected 
+ * onto the xy plane), so a ray through an edge shared by two triangles crosses the mesh once.
+ */
+void Voxels::addColumnCrossings(const Triangle& triangle, std::vector<ColumnCrossing>& crossings)
+{
+   // Vertices in voxels, with the center of voxel k at k
+   double v[3][3] = {
+      {triangle.v0.x, triangle.v0.y, triangle.v0.z},
+      {triangle.v1.x, triangle.v1.y, triangle.v1.z},
+      {triangle.v2.x, triangle.v2.y, triangle.v2.z} };
+   double gridMins[3] = {boundingBox.mins.x, boundingBox.mins.y, boundingBox.mins.z};
+   for (int i = 0; i < 3; i++)
+   {
+      for (int axis = 0; axis < 3; axis++)
+      {
+         v[i][axis] = ((v[i][axis] - gridMins[axis]) / voxelWidth) - 0.5;
+      }
+   }
+
+   double area = ((v[1][0] - v[0][0]) * (v[2][1] - v[0][1])) - ((v[1][1] - v[0][1]) * (v[2][0] - v[0][0]));
+   if (area == 0.0)
+   {
+      return; // Parallel to the rays
+   }
+   if (area < 0.0)
+   {
+      for (int axis = 0; axis < 3; axis++)
+      {
+         std::swap(v[1][axis], v[2][axis]);
+      }
+      area = -area;
+   }
+
+   double mins[2], maxs[2];
+   for (int axis = 0; axis < 2; axis++)
+   {
+      mins[axis] = std::max(ceil(std::min(std::min(v[0][axis], v[1][axis]), v[2][axis])), 0.0);
+      maxs[axis] = std::min(floor(std::max(std::max(v[0][axis], v[1][axis]), v[2][axis])), (double)(dimension-1));
+   }
+
+   for (double y = mins[1]; y <= maxs[1]; y += 1.0)
+   {
+      for (double x = mins[0]; x <= maxs[0]; x += 1.0)
+      {
+         double weights[3];
+         bool isInside = true;
+         for (int e = 0; e < 3 && isInside; e++)
+         {
+            // Edge from vertex a to b, weighting the opposite vertex e
+            const double* a = v[(e+1)%3];
+            const double* b = v[(e+2)%3];
+            double dx = b[0] - a[0];
+            double dy = b[1] - a[1];
+            weights[e] = (dx * (y - a[1])) - (dy * (x - a[0]));
+            bool isTopLeft = (dy > 0.0) || (dy == 0.0 && dx < 0.0);
+            isInside = (weights[e] > 0.0) || (weights[e] == 0.0 && isTopLeft);
+         }
+
+         if (isInside)
+         {
+            ColumnCrossing crossing;
+            crossing.column = getColumnKey((unsigned int)x, (unsigned int)y);
+            crossing.z = ((weights[0] * v[0][2]) + (weights[1] * v[1][2]) + (weights[2] * v[2][2])) / area;
+            crossings.push_back(crossing);
+         }
+      }
+   }
+}
+
+/**
+ * Returns the key of the column of voxels at x, y. The columns are numbered one 
+ * SOLID_BLOCK_DIMENSION square tile after another, so a fill block's columns are a range.
+ */
+uint64_t Voxels::getColumnKey(unsigned int x, unsigned int y)
+{
+   uint64_t tileDimension = std::min((unsigned int)SOLID_BLOCK_DIMENSION, dimension);
+   uint64_t tilesPerSide = dimension / tileDimension;
+   uint64_t tile = ((y / tileDimension) * tilesPerSide) + (x / tileDimension);
+   return (tile * tileDimension * tileDimension) + ((y % tileDimension) * tileDimension) + (x % tileDimension);
+}
+
+/**
+ * Appends the leafs of a node's 8 octants. The octants are in Morton order, so appending them 
+ * keeps the leafs sorted. The first non-empty octant's lists are taken over when nothing was 
+ * appended before, the rest are copied in once and freed right away.
+ */
+void Voxels::appendChildLeafs(std::vector<uint64_t> childLeafs[8], std::vector<uint64_t> childLeafIndices[8], std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList)
+{
+   uint64_t numNodeLeafs = leafList.size();
+   for (unsigned int child = 0; child < 8; child++)
+   {
+      numNodeLeafs += childLeafs[child].size();
+   }
+
+   for (unsigned int child = 0; child < 8; child++)
+   {
+      if (leafList.empty())
+      {
+         leafList.swap(childLeafs[child]);
+         leafIndexList.swap(childLeafIndices[child]);
+         leafList.reserve(numNodeLeafs);
+         leafIndexList.reserve(numNodeLeafs);
+      }
+      else
+      {
+         leafList.insert(leafList.end(), childLeafs[child].begin(), childLeafs[child].end());
+         leafIndexList.insert(leafIndexList.end(), childLeafIndices[child].begin(), childLeafIndices[child].end());
+         std::vector<uint64_t>().swap(childLeafs[child]);
+         std::vector<uint64_t>().swap(childLeafIndices[child]);
+      }
+   }
+}
+
+/**
+ * Appends the non-empty leaf words of the block and their Morton indexes.
+ */
+void Voxels::appendBlockLeafs(const VoxelBlock& block, uint64_t numWords, std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList)
+{
+   for (uint64_t i = 0; i < numWords; i++)
+   {
+      if (block.data[i] != 0)
+      {
+         leafList.push_back(block.data[i]);
+         leafIndexList.push_back(block.start + i);
+      }
+   }
+}
+
+/**
+ * Hands the non-empty leaf words of the block to the leaf stream.
+ */
+void Voxels::streamBlockLeafs(const VoxelBlock& block, uint64_t numWords)
+{
+   for (uint64_t i = 0; i < numWords; i++)
+   {
+      if (block.data[i] != 0)
+      {
+         leafStream->addLeaf(block.start + i, block.data[i]);
+      }
+   }
+}
+
+/**
+ * Calculates the range of voxel indexes the triangle's bounding box covers, clamped to the 
+ * block. Returns false if the range is empty.
+ */
+bool Voxels::getVoxelRange(const Triangle& triangle, const VoxelBlock& block, unsigned int mins[3], unsigned int maxs[3])
+{
+   Vec3 triMins(triangle.getMins());
+   Vec3 triMaxs(triangle.getMaxs());
+   
+   //Calculate the indexes into the voxel
+   mins[0] = (triMins.x - boundingBox.mins.x) / voxelWidth;
+   maxs[0] = (triMaxs.x - boundingBox.mins.x + 0.5) / voxelWidth;
+   mins[1] = (triMins.y - boundingBox.mins.y) / voxelWidth;
+   maxs[1] = (triMaxs.y - boundingBox.mins.y + 0.5) / voxelWidth;
+   mins[2] = (triMins.z - boundingBox.mins.z) / voxelWidth;
+   maxs[2] = (triMaxs.z - boundingBox.mins.z + 0.5) / voxelWidth;
+   
+   bool isEmpty = false;
+   for (int axis = 0; axis < 3; axis++)
+   {
+      //Deal with floating point error
+      maxs[axis] = (maxs[axis] >= dimension) ? (dimension-1) : maxs[axis];
+
+      mins[axis] = std::max(mins[axis], block.mins[axis]);
+      maxs[axis] = std::min(maxs[axis], block.maxs[axis]);
+      isEmpty = isEmpty || (mins[axis] > maxs[axis]);
+   }
+   return !isEmpty;
+}
+
+
+
+/**
+ * Voxelizes the given triangle into the volume 
+ */
+void Voxels::voxelizeTriangle(const Triangle& triangle, unsigned int i, VoxelBlock& block)
+{
+   unsigned int mins[3], maxs[3];
+   if (!getVoxelRange(triangle, block, mins, maxs))
+   {
+      return;
+   }
+   
+   unsigned int x, y, z;
+   Vec3 deltaP(voxelWidth, voxelWidth, voxelWidth); //The (maxs-mins) of the 
+                                                    //voxel's bounding box
+   TriangleAABBSetup setup(triangle, deltaP);
+   VoxelTriangleBuffer& buffer = voxelTriangleIndex->getThreadBuffer();
+   
+   for (x = mins[0]; x <= maxs[0]; x++)
+   {
+      for (y = mins[1]; y <= maxs[1]; y++)
+      {
+         Vec3 p(boundingBox.mins.x + (x*voxelWidth),  //The mins of the 
+          boundingBox.mins.y + (y*voxelWidth),        //voxel's bounding box
+          0.0f );
+
+         // Test the row along z up to 64 voxels at a time
+         for (z = mins[2]; z <= maxs[2]; z += 64)
+         {
+            unsigned int count = std::min(maxs[2] - z + 1, 64u);
+            addVoxelRow(triangleAABBIntersectRow(setup, p, 2, boundingBox.mins.z, voxelWidth, z, count), x, y, z, 2, i, buffer, block);
+         }
+      }
+   }   
+   
+   
 }
 
+/**
+ * Voxelizes the given triangle into the volume by only visiting the voxels that can overlap it.
+ *
+ * The triangle is projected along the axis its normal is most aligned with (the dominant axis). 
+ * For every column of voxels along that axis whose square overlaps the projected triangle, the 
+ * triangle's plane is clipped to the column to find the few voxels in it that the plane passes 
+ * through. Only those candidates are tested against the triangle, so a triangle costs 
+ * O(n^2) tests instead of one test for every voxel in its O(n^3) bounding box. The candidates 
+ * are a superset of the hits within the same index ranges voxelizeTriangle uses, so both modes 
+ * produce the same voxels.
+ */
+void Voxels::voxelizeTriangleScanline(const Triangle& triangle, unsigned int i, VoxelBlock& block)
+{
+   Vec3 n(triangle.getNormal());
 
+   float normal[3] = {n.x, n.y, n.z};
+   float gridMins[3] = {boundingBox.mins.x, boundingBox.mins.y, boundingBox.mins.z};
+   Vec3 v[3] = {triangle.v0, triangle.v1, triangle.v2};
+   
+   // Calculate the indexes into the voxel the same way as voxelizeTriangle
+   unsigned int mins[3], maxs[3];
+   if (!getVoxelRange(triangle, block, mins, maxs))
+   {
+      return;
+   }
 
+   // The dominant axis (c) is walked per column, the other two (a and b) span the columns
+   int c = 0;
+   if (fabsf(normal[1]) > fabsf(normal[c]))
+      c = 1;
+   if (fabsf(normal[2]) > fabsf(normal[c]))
+      c = 2;
+   int a = (c + 1) % 3;
+   int b = (c + 2) % 3;
+
+   // Degenerate triangles have no usable plane, so let the brute force path handle them
+   if (!(fabsf(normal[c]) > 0.0f))
+   {
+      voxelizeTriangle(triangle, i, block);
+      return;
+   }
 
+   // Small slack so the candidate search is conservative with respect to floating point error
+   float epsilon = voxelWidth * 0.001f;
 
+   // Edge functions of the triangle projected onto the ab plane, oriented to be positive inside
+   float edgeNormalA[3], edgeNormalB[3], edgeDistance[3];
+   float orientation = (normal[c] > 0.0f) ? 1.0f : -1.0f;
+   for (int e = 0; e < 3; e++)
+   {
+      float v0[3] = {v[e].x, v[e].y, v[e].z};
+      float v1[3] = {v[(e+1)%3].x, v[(e+1)%3].y, v[(e+1)%3].z};
+      edgeNormalA[e] = -(v1[b] - v0[b]) * orientation;
+      edgeNormalB[e] = (v1[a] - v0[a]) * orientation;
+      edgeDistance[e] = -(edgeNormalA[e] * v0[a] + edgeNormalB[e] * v0[b]);
+   }
 
+   // The plane of the triangle solved for the dominant axis: c = planeD - planeA*a - planeB*b
+   float v0Coords[3] = {v[0].x, v[0].y, v[0].z};
+   float planeD = (normal[0]*v0Coords[0] + normal[1]*v0Coords[1] + normal[2]*v0Coords[2]) / normal[c];
+   float planeA = normal[a] / normal[c];
+   float planeB = normal[b] / normal[c];
 
+   Vec3 deltaP(voxelWidth, voxelWidth, voxelWidth);
+   TriangleAABBSetup setup(triangle, deltaP);
+   VoxelTriangleBuffer& buffer = voxelTriangleIndex->getThreadBuffer();
+   unsigned int index[3];
 
+   for (index[a] = mins[a]; index[a] <= maxs[a]; index[a]++)
+   {
+      float columnMinA = gridMins[a] + (index[a] * voxelWidth);
+      float columnMaxA = columnMinA + voxelWidth;
 
+      for (index[b] = mins[b]; index[b] <= maxs[b]; index[b]++)
+      {
+         float columnMinB = gridMins[b] + (index[b] * voxelWidth);
+         float columnMaxB = columnMinB + voxelWidth;
 
+         // Skip the column if its square is fully outside one of the projected edges 
+         bool isOutside = false;
+         for (int e = 0; e < 3 && !isOutside; e++)
+         {
+            float cornerA = (edgeNormalA[e] > 0.0f) ? columnMaxA : columnMinA;
+            float cornerB = (edgeNormalB[e] > 0.0f) ? columnMaxB : columnMinB;
+            float distance = edgeNormalA[e] * cornerA + edgeNormalB[e] * cornerB + edgeDistance[e];
+            isOutside = distance < -epsilon;
+         }
+         if (isOutside)
+         {
+            continue;
+         }
 
+         // Range of the plane along the dominant axis over the column's square
+         float cornerHeights[4] = {
+            planeD - planeA*columnMinA - planeB*columnMinB,
+            planeD - planeA*columnMaxA - planeB*columnMinB,
+            planeD - planeA*columnMinA - planeB*columnMaxB,
+            planeD - planeA*columnMaxA - planeB*columnMaxB };
+         float minHeight = cornerHeights[0];
+         float maxHeight = cornerHeights[0];
+         for (int k = 1; k < 4; k++)
+         {
+            minHeight = std::min(minHeight, cornerHeights[k]);
+            maxHeight = std::max(maxHeight, cornerHeights[k]);
+         }
 
+         float minVoxel = floorf((minHeight - epsilon - gridMins[c]) / voxelWidth);
+         float maxVoxel = floorf((maxHeight + epsilon - gridMins[c]) / voxelWidth);
+         if (maxVoxel < (float)mins[c] || minVoxel > (float)maxs[c])
+         {
+            continue;
+         }
+         unsigned int startC = (minVoxel < (float)mins[c]) ? mins[c] : (unsigned int)minVoxel;
+         unsigned int endC = (maxVoxel > (float)maxs[c]) ? maxs[c] : (unsigned int)maxVoxel;
 
+         index[c] = 0;
+         Vec3 p(boundingBox.mins.x + (index[0]*voxelWidth),  //The mins of the 
+          boundingBox.mins.y + (index[1]*voxelWidth),        //voxel's bounding box
+          boundingBox.mins.z + (index[2]*voxelWidth) );
 
+         for (index[c] = startC; index[c] <= endC; index[c] += 64)
+         {
+            unsigned int count = std::min(endC - index[c] + 1, 64u);
+            addVoxelRow(triangleAABBIntersectRow(setup, p, c, gridMins[c], voxelWidth, index[c], count), index[0], index[1], index[2], c, i, buffer, block);
+         }
+      }
+   }
+}
 
+/**
+ * Adds the voxels of a row whose bits are set in hits, where bit k is the voxel k past 
+ * (x, y, z) along the given axis.
+ */
+void Voxels::addVoxelRow(uint64_t hits, unsigned int x, unsigned int y, unsigned int z, int axis, unsigned int triangleIndex, VoxelTriangleBuffer& buffer, VoxelBlock& block)
+{
+   unsigned int index[3] = {x, y, z};
+   unsigned int start = index[axis];
 
+   while (hits)
+   {
+      index[axis] = start + __builtin_ctzll(hits);
+      addVoxel(index[0], index[1], index[2], triangleIndex, buffer, block);
+      hits &= hits - 1;
+   }
+}
 
+/**
+ * Marks the voxel as filled and records the triangle that filled it for the moxel table in 
+ * the calling thread's buffer.
+ */
+void Voxels::addVoxel(unsigned int x, unsigned int y, unsigned int z, unsigned int triangleIndex, VoxelTriangleBuffer& buffer, VoxelBlock& block)
+{
+   VoxelTrianglePair pair;
+   pair.mortonIndex = mortonCode(x, y, z, levels);
+   pair.triangleIndex = triangleIndex;
+   buffer.push_back(pair);
+   set(x,y,z,block);
+}
 
+/**
+ * Returns the number of voxels that are set
+ *
+ * Tested: 9-12-2013 
+ */
+uint64_t Voxels::countSetVoxels()
+{
+   uint64_t i, count = 0;
+   
+   for (i = 0; i < numLeafs; i++)
+      count += countSetBits(leafs[i]);
+   
+   return count;
+}
 
+/**
+ * Returns the string representation of the binary of an unsigned 64-bit int 
+ *
+ * Tested: 12-21-2013 
+ */
+void binaryToString(uint64_t data, char* str)
+{
+   unsigned int i;
+   
+   for (i = 0; i < 64; i++)
+   {
+      if (data & 1)
+         str[i] = '1';
+      else
+         str[i] = '0';
+      
+      data >>= 1;
+   }
+}
 
+/**
+ * Print the binary representation of the voxels
+ *
+ * Tested: 12-21-2013 
+ */
+void Voxels::printBinary()
+{
+   unsigned int i, j, k;
+   
+   for (k = 0; k < dimension; k++)
+   {  
+      std::cout << "z = " << k << "\n";
+      for (j = 0; j < dimension; j++)
+      {
+         for (i = 0; i < dimension; i++)
+         {
+            if (isSet(i,j,k))
+               std::cout << "1 ";
+            else
+               std::cout << "0 ";
+         }
+         std::cout << "\n";
+      }
+      std::cout << "\n";
+   }
+}
 
+/**
+ * Writes the voxel data to tga files where the file name is the z axis voxel number.
+ *
+ *
+ * Tested: 12-15-2014
+ */
+void Voxels::writeImages()
+{
+   unsigned int i, j, k;
+   
+   for (k = 0; k < dimension; k++)
+   {  
+      cout << "Witing image " << k << endl;
+      Image image(dimension,dimension);
+      for (j = 0; j < dimension; j++)
+      {
+         for (i = 0; i < dimension; i++)
+         {
+            if (isSet(i,j,k))
+            {
+               image.setColor(i,j, 1.0f,1.0f,1.0f);
+            }
+         }
+      }
+      char fileName[30];
+      sprintf(fileName, "./images/%04d.tga",k);
+      image.writeTGA((fileName));
+   }
+}
+
+/**
+ * Computes the key identifying a voxelization: an FNV-1a hash of the mesh file's bytes, the 
+ * number of levels, the (squared) bounding box and whether the voxels are solid. Returns 
+ * false if the mesh file can't be read.
+ */
+bool Voxels::getCacheKey(std::string meshFilePath, uint64_t& key)
+{
+   int fd = open(meshFilePath.c_str(), O_RDONLY);
+   struct stat sb;
+
+   if (fd < 0 || fstat(fd, &sb) != 0)
+   {
+      std::cerr << "Could not read " << meshFilePath << " to key the voxel cache" << endl;
+      if (fd >= 0)
+         close(fd);
+      return false;
+   }
+
+   key = FNV_OFFSET_BASIS;
+   if (sb.st_size > 0)
+   {
+      void* meshBytes = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (meshBytes == MAP_FAILED)
+      {
+         std::cerr << "Could not map " << meshFilePath << " to key the voxel cache" << endl;
+         close(fd);
+         return false;
+      }
+      key = fnv1a(key, meshBytes, sb.st_size);
+      munmap(meshBytes, sb.st_size);
+   }
+   close(fd);
+
+   float bounds[6] = {boundingBox.mins.x, boundingBox.mins.y, boundingBox.mins.z, 
+    boundingBox.maxs.x, boundingBox.maxs.y, boundingBox.maxs.z};
+   uint32_t levelCount = levels;
+   key = fnv1a(key, &levelCount, sizeof(levelCount));
+   key = fnv1a(key, bounds, sizeof(bounds));
+   if (options.solid)
+   {
+      uint8_t solidFlag = 1;
+      key = fnv1a(key, &solidFlag, sizeof(solidFlag));
+   }
+   return true;
+}
+
+/**
+ * Returns the path of the cache file for the mesh, ./voxelCache/<mesh>-<levels>-<key>.vox
+ */
+std::string Voxels::getCacheFilePath(std::string meshFilePath, uint64_t key)
+{
+   char filePath[1000];
+   snprintf(filePath, sizeof(filePath), "./voxelCache/%s-%u-%016llx.vox", getFileNameFromPath(meshFilePath).c_str(), levels, (unsigned long long)key);
+   return filePath;
+}
+
+/**
+ * Maps the leaf words, their indexes and the voxel triangle pairs of the cache file straight 
+ * into memory, no parsing needed. Returns false, leaving the voxels untouched, if the file is 
+ * missing or was written for a different mesh, level count, bounding box or version.
+ *
+ * Tested: 10-18-2026
+ */
+bool Voxels::readVoxelCache(std::string cacheFilePath, uint64_t key)
+{
+   int fd = open(cacheFilePath.c_str(), O_RDONLY);
+   if (fd < 0)
+   {
+      return false;
+   }
+
+   VoxelCacheHeader header;
+   struct stat sb;
+   bool isValid = pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) 
+    && fstat(fd, &sb) == 0
+    && header.magic == VOXEL_CACHE_MAGIC 
+    && header.version == VOXEL_CACHE_VERSION 
+    && header.key == key 
+    && header.levels == levels 
+    && header.pairSize == sizeof(VoxelTrianglePair) 
+    && header.numLeafs <= dataSize 
+    && header.leafsOffset % VOXEL_CACHE_ALIGNMENT == 0 
+    && header.leafIndicesOffset % VOXEL_CACHE_ALIGNMENT == 0 
+    && header.pairsOffset % VOXEL_CACHE_ALIGNMENT == 0 
+    && header.leafsOffset + (header.numLeafs * sizeof(uint64_t)) <= (uint64_t)sb.st_size 
+    && header.leafIndicesOffset + (header.numLeafs * sizeof(uint64_t)) <= (uint64_t)sb.st_size 
+    && header.pairsOffset + (header.numPairs * sizeof(VoxelTrianglePair)) <= (uint64_t)sb.st_size;
+
+   if (!isValid)
+   {
+      std::cerr << "Ignoring invalid voxel cache " << cacheFilePath << endl;
+      close(fd);
+      return false;
+   }
+
+   uint64_t leafsBytes = header.numLeafs * sizeof(uint64_t);
+   uint64_t leafIndicesBytes = header.numLeafs * sizeof(uint64_t);
+   uint64_t pairsBytes = header.numPairs * sizeof(VoxelTrianglePair);
+   void* mappedLeafs = mapCacheSection(fd, header.leafsOffset, leafsBytes);
+   void* mappedLeafIndices = mapCacheSection(fd, header.leafIndicesOffset, leafIndicesBytes);
+   void* mappedPairs = mapCacheSection(fd, header.pairsOffset, pairsBytes);
+   close(fd);
+
+   if (mappedLeafs == MAP_FAILED || mappedLeafIndices == MAP_FAILED || mappedPairs == MAP_FAILED)
+   {
+      std::cerr << "Could not map voxel cache " << cacheFilePath << endl;
+      if (mappedLeafs != MAP_FAILED && mappedLeafs != NULL)
+         munmap(mappedLeafs, leafsBytes);
+      if (mappedLeafIndices != MAP_FAILED && mappedLeafIndices != NULL)
+         munmap(mappedLeafIndices, leafIndicesBytes);
+      if (mappedPairs != MAP_FAILED && mappedPairs != NULL)
+         munmap(mappedPairs, pairsBytes);
+      return false;
+   }
+
+   leafs = (uint64_t*)mappedLeafs;
+   leafIndices = (uint64_t*)mappedLeafIndices;
+   numLeafs = header.numLeafs;
+   ownsData = false;
+   voxelTriangleIndex->setMappedPairs((VoxelTrianglePair*)mappedPairs, header.numPairs);
+   return true;
+}
 
+/**
+ * Writes the leaf words, their indexes and the voxel triangle pairs to the cache file. The 
+ * file is written under a temporary name and renamed into place so a reader never sees half 
+ * of it.
+ *
+ * Tested: 10-18-2026
+ */
+void Voxels::writeVoxelCache(std::string cacheFilePath, uint64_t key)
+{
+   struct stat sb;
+
+   // If the folder does not already exist, create it
+   if (stat("./voxelCache", &sb) == -1) {
+      mkdir("./voxelCache", 0777);
+   }
+
+   VoxelCacheHeader header;
+   memset(&header, 0, sizeof(header));
+   header.magic = VOXEL_CACHE_MAGIC;
+   header.version = VOXEL_CACHE_VERSION;
+   header.key = key;
+   header.levels = levels;
+   header.pairSize = sizeof(VoxelTrianglePair);
+   header.numLeafs = numLeafs;
+   header.numPairs = voxelTriangleIndex->numPairs;
+   header.leafsOffset = VOXEL_CACHE_ALIGNMENT;
+   header.leafIndicesOffset = alignCacheOffset(header.leafsOffset + (header.numLeafs * sizeof(uint64_t)));
+   header.pairsOffset = alignCacheOffset(header.leafIndicesOffset + (header.numLeafs * sizeof(uint64_t)));
+
+   std::string tempFilePath = cacheFilePath + ".tmp";
+   FILE* file = fopen(tempFilePath.c_str(), "wb");
+   if (file == NULL)
+   {
+      std::cerr << "Could not open " << tempFilePath << " to write the voxel cache" << endl;
+      return;
+   }
+
+   bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1 
+    && fseeko(file, header.leafsOffset, SEEK_SET) == 0
+    && fwrite(leafs, sizeof(uint64_t), numLeafs, file) == numLeafs
+    && fseeko(file, header.leafIndicesOffset, SEEK_SET) == 0
+    && fwrite(leafIndices, sizeof(uint64_t), numLeafs, file) == numLeafs
+    && fseeko(file, header.pairsOffset, SEEK_SET) == 0
+    && fwrite(voxelTriangleIndex->pairs, sizeof(VoxelTrianglePair), header.numPairs, file) == header.numPairs;
+   isWritten = (fclose(file) == 0) && isWritten;
+
+   if (!isWritten || rename(tempFilePath.c_str(), cacheFilePath.c_str()) != 0)
+   {
+      std::cerr << "Could not write the voxel cache " << cacheFilePath << endl;
+      remove(tempFilePath.c_str());
+      return;
+   }
+   std::cout << "Wrote voxel cache " << cacheFilePath << endl;
+}
+
+/**
+ * Maps numBytes of the cache file starting at offset read only. Returns NULL for an empty 
+ * section and MAP_FAILED if the mapping failed.
+ */
+void* mapCacheSection(int fd, uint64_t offset, uint64_t numBytes)
+{
+   if (numBytes == 0)
+   {
+      return NULL;
+   }
+   return mmap(NULL, numBytes, PROT_READ, MAP_PRIVATE, fd, offset);
+}
+
+/**
+ * Rounds the offset up to the next multiple of alignment, VOXEL_CACHE_ALIGNMENT by default
+ */
+uint64_t alignCacheOffset(uint64_t offset, uint64_t alignment)
+{
+   return ((offset + alignment - 1) / alignment) * alignment;
+}
+
+
+std::string Voxels::getFileNameFromPath(string filePath)
+{
+   string filename = filePath;
+   // Remove directory if present.
+   // Do this before extension removal incase directory has a period character.
+   const size_t last_slash_idx = filename.find_last_of("\\/");
+   if (std::string::npos != last_slash_idx)
+   {
+       filename.erase(0, last_slash_idx + 1);
+   }
+
+   // Remove extension if present.
+   const size_t period_idx = filename.rfind('.');
+   if (std::string::npos != period_idx)
+   {
+       filename.erase(period_idx);
+   }
+   return filename;
+}
+
+/**
+ * Continues the 64-bit FNV-1a hash with the given bytes. Start a new hash with 
+ * FNV_OFFSET_BASIS.
+ */
+uint64_t fnv1a(uint64_t hash, const void* bytes, size_t numBytes)
+{
+   const unsigned char* byte = (const unsigned char*)bytes;
+   for (size_t i = 0; i < numBytes; i++)
+   {
+      hash ^= byte[i];
+      hash *= FNV_PRIME;
+   }
+   return hash;
+}
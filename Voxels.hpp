@@ -14,6 +14,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 #include <iostream>
 #include <stdexcept>
@@ -22,7 +23,11 @@
 #include <sstream>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <iomanip>
+#include <chrono>
 
 // OpenMP
 #include <omp.h>
@@ -32,53 +37,161 @@
 #include "Intersect.hpp"
 #include "MortonCode.hpp"
 #include "Image.hpp"
-#include <unordered_map>
-#include "tbb/concurrent_unordered_map.h"
+#include "BuildOptions.hpp"
+#include "VoxelTriangleIndex.hpp"
+#include "VoxelSource.hpp"
+#include "DAGStreamBuilder.hpp"
+#include "BitCount.hpp"
 #include "tbb/mutex.h"
 #include "tbb/atomic.h"
 #include "tbb/tbb.h"
 
+#define VOXEL_CACHE_MAGIC 0x43584f56 // "VOXC"
+#define VOXEL_CACHE_VERSION 4
+#define VOXEL_CACHE_ALIGNMENT 65536 // Section alignment, a multiple of any page size
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define TOP_DOWN_BLOCK_DIMENSION 32 // The top-down builder voxelizes nodes this wide densely
+#define VOXELIZE_TASK_DIMENSION 64 // Triangles with a wider voxel range are split into tiles this wide
+#define SOLID_BLOCK_DIMENSION 32 // The interior is filled in dense blocks this wide
+#define SOLID_FILL_GROUPS 256 // Number of Morton ordered groups of blocks filled in parallel
+#define SOURCE_TASK_DIMENSION 64 // Source nodes wider than this split their octants into parallel tasks
+
+// Start of a voxel cache file. The non-empty leaf words, their Morton indexes and the voxel 
+// triangle pairs follow at VOXEL_CACHE_ALIGNMENT aligned offsets so each can be mapped on its own.
+typedef struct
+{
+   uint32_t magic;
+   uint32_t version;
+   uint64_t key; // Hash of the mesh file, the number of levels and the bounding box
+   uint32_t levels;
+   uint32_t pairSize;
+   uint64_t numLeafs;
+   uint64_t leafsOffset;
+   uint64_t leafIndicesOffset;
+   uint64_t numPairs;
+   uint64_t pairsOffset;
+} VoxelCacheHeader;
+
+// The part of the volume being voxelized into a dense block of leaf words: a whole chunk, or 
+// one octree node of the top-down builder
+typedef struct
+{
+   uint64_t* data; // Dense leaf words of the block
+   uint64_t start; // Morton index of the first leaf word
+   unsigned int mins[3]; // Voxel index range of the block
+   unsigned int maxs[3];
+} VoxelBlock;
+
+// One piece of voxelization work for a chunk: a whole triangle, or the part of a large 
+// triangle's voxel range inside one tile
+typedef struct
+{
+   uint64_t mortonCode; // Morton code of the triangle's centroid or the tile's center, the sort key
+   unsigned int triangleIndex;
+   unsigned int mins[3]; // Voxel index range to voxelize, the chunk or a tile
+   unsigned int maxs[3];
+   bool isFirstPart; // Only the first task of a triangle counts towards the progress
+} VoxelizationTask;
+
+// A point where the ray along +z through the centers of a column of voxels crosses a triangle
+typedef struct
+{
+   uint64_t column; // Column key, the columns of one fill block are next to each other
+   float z; // In voxels, with the center of voxel k at k
+} ColumnCrossing;
+
+// A node a solid source fills entirely, kept once instead of as all of its full leaf words
+typedef struct
+{
+   uint64_t mortonIndex; // Within its level
+   unsigned int level;
+} FullNode;
+
+// Time one worker thread spent voxelizing and how many tasks it ran
+struct ThreadLoad
+{
+   double time;
+   uint64_t numTasks;
+
+   ThreadLoad() : time(0.0), numTasks(0) {}
+};
 
 class Voxels
 {
    public:
    //Will be after testing
    //private:
-      uint64_t *data;
+      uint64_t *leafs; // The non-empty leaf words in Morton order
+      uint64_t *leafIndices; // The Morton index of each non-empty leaf word (voxel Morton code / 64)
+      uint64_t numLeafs; // The number of non-empty leaf words
+      std::vector<FullNode> fullNodes; // In Morton order, their leafs are not in leafs but share the 8 full words after them
       BoundingBox boundingBox;
       unsigned int levels;
       unsigned long size; // Total number of voxels 
       unsigned int dimension; // Number of voxels for one side of the cube
       float voxelWidth; // The length of one voxel in world space
-      unsigned int dataSize; // The number of uint64_t allocated to data
-      tbb::mutex sMutex;
+      uint64_t dataSize; // The number of uint64_t needed if all the leafs were stored
+      unsigned int chunkLevel; // Morton space is voxelized in 8^chunkLevel chunks
+      uint64_t chunkDataSize; // The number of uint64_t allocated for one chunk
+      bool ownsData; // False when leafs and leafIndices are mapped from the voxel cache
+      DAGStreamBuilder* leafStream; // Gets the leaf words as they are voxelized instead of leafs, or NULL
+      BuildOptions options;
       
-      unsigned int calculateDataSize(unsigned int levels);
-      void set(unsigned int x, unsigned int y, unsigned int z);
+      uint64_t calculateDataSize(unsigned int levels);
+      unsigned int calculateChunkLevel();
+      void set(unsigned int x, unsigned int y, unsigned int z, VoxelBlock& block);
       bool isSet(unsigned int x, unsigned int y, unsigned int z);
       void build(const std::vector<Triangle> triangles);
-      void build(std::string meshFilePath);
-      void voxelizeTriangle(const Triangle& triangle, unsigned int i);
-      unsigned int countSetVoxels();
+      void buildChunked(const std::vector<Triangle>& triangles, std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList);
+      void buildTopDown(const std::vector<Triangle>& triangles, std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList);
+      void buildTopDown(const std::vector<Triangle>& triangles, const std::vector<unsigned int>& triangleIndices, unsigned int level, uint64_t mortonIndex, std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList);
+      void buildFromSource(const VoxelSource& source, unsigned int level, uint64_t mortonIndex, std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList, std::vector<FullNode>& fullNodeList);
+      uint64_t voxelizeSourceLeaf(const VoxelSource& source, const VoxelBlock& leaf);
+      Vec3 getVoxelCenter(unsigned int x, unsigned int y, unsigned int z);
+      bool isPlaneNearBlock(const Triangle& triangle, const VoxelBlock& block);
+      void binTriangles(const std::vector<Triangle>& triangles, std::vector< std::vector<unsigned int> >& chunkTriangles);
+      void initBlock(VoxelBlock& block, unsigned int level, uint64_t mortonIndex);
+      void scheduleTriangles(const std::vector<Triangle>& triangles, const std::vector<unsigned int>& triangleIndices, const VoxelBlock& chunk, std::vector<VoxelizationTask>& tasks, tbb::atomic<unsigned int>& progress);
+      void printThreadLoads();
+      void fillInterior(const std::vector<Triangle>& triangles);
+      void addColumnCrossings(const Triangle& triangle, std::vector<ColumnCrossing>& crossings);
+      uint64_t getColumnKey(unsigned int x, unsigned int y);
+      void voxelizeChunk(const std::vector<Triangle>& triangles, const std::vector<unsigned int>& triangleIndices, VoxelBlock& chunk, tbb::atomic<unsigned int>& progress, unsigned int numTasks);
+      void appendBlockLeafs(const VoxelBlock& block, uint64_t numWords, std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList);
+      void appendChildLeafs(std::vector<uint64_t> childLeafs[8], std::vector<uint64_t> childLeafIndices[8], std::vector<uint64_t>& leafList, std::vector<uint64_t>& leafIndexList);
+      void streamBlockLeafs(const VoxelBlock& block, uint64_t numWords);
+      bool getVoxelRange(const Triangle& triangle, const VoxelBlock& block, unsigned int mins[3], unsigned int maxs[3]);
+      void voxelizeTriangle(const Triangle& triangle, unsigned int i, VoxelBlock& block);
+      void voxelizeTriangleScanline(const Triangle& triangle, unsigned int i, VoxelBlock& block);
+      void addVoxel(unsigned int x, unsigned int y, unsigned int z, unsigned int triangleIndex, VoxelTriangleBuffer& buffer, VoxelBlock& block);
+      void addVoxelRow(uint64_t hits, unsigned int x, unsigned int y, unsigned int z, int axis, unsigned int triangleIndex, VoxelTriangleBuffer& buffer, VoxelBlock& block);
+      uint64_t countSetVoxels();
       void printBinary();
       void writeImages();
-      bool cacheExists(std::string fileName);
-      void writeVoxelCache(std::string fileName);
+      bool getCacheKey(std::string meshFilePath, uint64_t& key);
+      std::string getCacheFilePath(std::string meshFilePath, uint64_t key);
+      bool readVoxelCache(std::string cacheFilePath, uint64_t key);
+      void writeVoxelCache(std::string cacheFilePath, uint64_t key);
       std::string getFileNameFromPath(std::string fileName);
-      tbb::concurrent_unordered_map<unsigned int, unsigned int>* voxelTriangleIndexMap;
+      VoxelTriangleIndex* voxelTriangleIndex;
+      tbb::enumerable_thread_specific<ThreadLoad> threadLoads;
       
    //Will be
    //public:
-      Voxels(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath);
+      Voxels(const unsigned int levelsVal, const BoundingBox& boundingBoxVal, const std::vector<Triangle> triangles, std::string meshFilePath, const BuildOptions& optionsVal, DAGStreamBuilder* leafStreamVal = NULL);
+      Voxels(const unsigned int levelsVal, const VoxelSource& source, const BuildOptions& optionsVal);
       ~Voxels();
-      uint64_t& operator[](unsigned int i);
+      uint64_t operator[](uint64_t i);
       
       unsigned long getSize() const;
       
 };
 
 void binaryToString(uint64_t data, char* str);
-unsigned int countSetBits(uint64_t data);
+uint64_t fnv1a(uint64_t hash, const void* bytes, size_t numBytes);
+void* mapCacheSection(int fd, uint64_t offset, uint64_t numBytes);
+uint64_t alignCacheOffset(uint64_t offset, uint64_t alignment = VOXEL_CACHE_ALIGNMENT);
 
 #endif
 